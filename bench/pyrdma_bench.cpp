@@ -0,0 +1,737 @@
+// Native benchmark for every Communicator backend: sweeps operation x
+// message size x queue depth x thread count and reports latency
+// percentiles, GB/s and Mops/s as JSON or CSV.
+//
+//   pyrdma_bench --role server [--port 7480] [--dev rxe0]
+//   pyrdma_bench --role client --host 10.0.0.1 --transport rdma --dev rxe0
+//                --ops send,write,read --sizes 8,4K,1M --depths 1,16 --threads 1,4
+//
+// Each thread drives its own connection. A separate control socket carries
+// the test plan, so the server only needs --role and the local device.
+#include "src/communicator_factory.h"
+#include "src/shm_communicator.h"
+#include "src/soft_rdma_communicator.h"
+#include "src/tcp_communicator.h"
+#include <arpa/inet.h>
+#include <endian.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static void die(const char* msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+enum BenchOp {
+    OP_PINGPONG = 0,    // send/recv round trip, latency is half of it
+    OP_SEND = 1,        // streamed sends, the receiver acknowledges the last one
+    OP_WRITE = 2,
+    OP_READ = 3,
+    OP_QUIT = 0xff,
+};
+
+static const char* const OP_NAMES[] = { "pingpong", "send", "write", "read" };
+static const int NUM_OPS = 4;
+static const char* const TRANSPORT_NAMES[] = { "auto", "tcp", "soft", "rdma", "shm" };
+
+// Receives the server keeps posted ahead of a stream of sends
+static const size_t RECV_WINDOW = 32;
+// Room behind the data buffer for the end-of-stream acknowledgement
+static const size_t ACK_LEN = 64;
+
+struct Options {
+    bool server;
+    std::string host;
+    int port;
+    TransportKind transport;
+    std::string dev;
+    int gid_index;
+    std::vector<int> ops;
+    std::vector<size_t> sizes;
+    std::vector<int> depths;
+    std::vector<int> threads;
+    uint64_t iters;
+    uint64_t warmup;
+    uint64_t max_bytes;     // per test, caps iters for large messages
+    bool csv;
+    std::string output;
+
+    Options() : server(false), host("127.0.0.1"), port(7480), transport(TRANSPORT_TCP), gid_index(0),
+                iters(10000), warmup(100), max_bytes(1ULL << 30), csv(false) {}
+};
+
+// Test plan sent from the client to the server before each run
+struct Spec {
+    uint32_t op;
+    uint32_t threads;
+    uint64_t size;
+    uint32_t depth;
+    uint64_t count;
+};
+
+// One data connection: communicator, registered buffer and the peer's
+struct Conn {
+    int fd;
+    std::unique_ptr<Communicator> comm;
+    RDMACommunicator* rdma;         // set when the transport has non-blocking ops
+    SoftRDMACommunicator* soft;
+    TCPCommunicator* tcp;
+    char* buf;                      // max_size bytes of data, then ACK_LEN
+    size_t buf_size;
+    bool shm_buf;                   // from ShmCommunicator::alloc_buffer
+    uint64_t remote_addr;
+    uint32_t remote_rkey;
+};
+
+struct ThreadResult {
+    std::vector<uint64_t> lat_ns;
+    double seconds;
+    int error;
+};
+
+struct Result {
+    std::string transport;
+    std::string op;
+    size_t size;
+    int depth;
+    int threads;
+    uint64_t iters;
+    double seconds;
+    double gb_per_s;
+    double mops;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+};
+
+// Releases all threads of a run at once, so their clocks start together
+class StartBarrier {
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    int waiting;
+    int count;
+    Clock::time_point start;
+
+public:
+    explicit StartBarrier(int count) : waiting(0), count(count) {}
+
+    Clock::time_point wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (++waiting == count) {
+            start = Clock::now();
+            cv.notify_all();
+        } else {
+            cv.wait(lock, [this] { return waiting == count; });
+        }
+        return start;
+    }
+};
+
+// ---- control channel ----
+
+static int write_full(int fd, const void* p, size_t n) {
+    const char* c = (const char*)p;
+    while (n > 0) {
+        ssize_t k = ::write(fd, c, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        c += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void* p, size_t n) {
+    char* c = (char*)p;
+    while (n > 0) {
+        ssize_t k = ::read(fd, c, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        c += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int send_u64s(int fd, const uint64_t* v, int n) {
+    uint64_t wire[8];
+    for (int i = 0; i < n; i++) wire[i] = htobe64(v[i]);
+    return write_full(fd, wire, n * sizeof(uint64_t));
+}
+
+static int recv_u64s(int fd, uint64_t* v, int n) {
+    uint64_t wire[8];
+    if (read_full(fd, wire, n * sizeof(uint64_t))) return -1;
+    for (int i = 0; i < n; i++) v[i] = be64toh(wire[i]);
+    return 0;
+}
+
+static int send_spec(int fd, const Spec& s) {
+    uint64_t v[5] = { s.op, s.threads, s.size, s.depth, s.count };
+    return send_u64s(fd, v, 5);
+}
+
+static int recv_spec(int fd, Spec& s) {
+    uint64_t v[5];
+    if (recv_u64s(fd, v, 5)) return -1;
+    s.op = (uint32_t)v[0];
+    s.threads = (uint32_t)v[1];
+    s.size = v[2];
+    s.depth = (uint32_t)v[3];
+    s.count = v[4];
+    return 0;
+}
+
+// ---- sockets ----
+
+static int connect_to(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res)) return -1;
+    int fd = -1;
+    for (addrinfo* a = res; a; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&sa, sizeof(sa)) || listen(fd, 64)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// ---- connections ----
+
+static void setup_conn(Conn& c, int fd, bool initiator, const Options& opt, TransportKind kind, size_t max_size) {
+    c.fd = fd;
+    c.comm = create_communicator(fd, initiator, kind, opt.dev.empty() ? nullptr : opt.dev.c_str(), opt.gid_index);
+    if (!c.comm) die("Failed to create communicator");
+    c.rdma = dynamic_cast<RDMACommunicator*>(c.comm.get());
+    c.soft = dynamic_cast<SoftRDMACommunicator*>(c.comm.get());
+    c.tcp = dynamic_cast<TCPCommunicator*>(c.comm.get());
+
+    // Shared memory is fastest on memory both processes map
+    c.buf_size = max_size + ACK_LEN;
+    ShmCommunicator* shm = dynamic_cast<ShmCommunicator*>(c.comm.get());
+    c.shm_buf = shm != nullptr;
+    if (shm) {
+        c.buf = (char*)shm->alloc_buffer(c.buf_size);
+    } else {
+        void* p = nullptr;
+        c.buf = posix_memalign(&p, 4096, c.buf_size) ? nullptr : (char*)p;
+    }
+    if (!c.buf) die("Failed to allocate buffer");
+    memset(c.buf, 0x5a, c.buf_size);
+    // Transports without one-sided operations refuse, which is fine
+    c.comm->set_buffer(c.buf, c.buf_size);
+    c.remote_addr = 0;
+    c.remote_rkey = 0;
+}
+
+static void teardown_conn(Conn& c) {
+    c.comm->invalidate_memory(c.buf, c.buf_size);
+    c.comm.reset();
+    if (!c.shm_buf) free(c.buf);
+    close(c.fd);
+}
+
+// Advertise our buffer on the control socket and learn the peer's
+static int exchange_regions(int ctl, std::vector<Conn>& conns) {
+    for (auto& c : conns) {
+        uint64_t v[2] = { (uint64_t)(uintptr_t)c.buf, c.comm->get_rkey() };
+        if (send_u64s(ctl, v, 2)) return -1;
+    }
+    for (auto& c : conns) {
+        uint64_t v[2];
+        if (recv_u64s(ctl, v, 2)) return -1;
+        c.remote_addr = v[0];
+        c.remote_rkey = (uint32_t)v[1];
+    }
+    return 0;
+}
+
+static bool supports(const Conn& c, int op) {
+    // Plain TCP has no one-sided operations
+    return !(c.tcp && (op == OP_WRITE || op == OP_READ));
+}
+
+// ---- operations ----
+
+// Post an operation without waiting where the transport allows it. A
+// handle of 0 means the operation already completed.
+static int64_t post_op(Conn& c, int op, size_t len) {
+    switch (op) {
+    case OP_SEND:
+        if (c.rdma) return c.rdma->post_send(c.buf, len);
+        if (c.tcp) return c.tcp->post_send(c.buf, len);
+        return c.comm->send(c.buf, len) < 0 ? -1 : 0;
+    case OP_WRITE:
+        if (c.rdma) return c.rdma->post_write(c.buf, len, c.remote_addr, c.remote_rkey);
+        if (c.soft) return c.soft->post_write(c.buf, len, c.remote_addr, c.remote_rkey);
+        return c.comm->write(c.buf, len, c.remote_addr, c.remote_rkey) < 0 ? -1 : 0;
+    case OP_READ:
+        if (c.rdma) return c.rdma->post_read(c.buf, len, c.remote_addr, c.remote_rkey);
+        if (c.soft) return c.soft->post_read(c.buf, len, c.remote_addr, c.remote_rkey);
+        return c.comm->read(c.buf, len, c.remote_addr, c.remote_rkey) < 0 ? -1 : 0;
+    default:
+        return -1;
+    }
+}
+
+static int wait_op(Conn& c, int64_t req) {
+    if (req == 0) return 0;
+    if (c.rdma) return c.rdma->wait(req) < 0 ? -1 : 0;
+    if (c.soft) return c.soft->wait(req) < 0 ? -1 : 0;
+    if (c.tcp) return c.tcp->wait(req);
+    return -1;
+}
+
+static uint64_t elapsed_ns(Clock::time_point t0, Clock::time_point t1) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+static void client_thread(Conn& c, const Spec& s, StartBarrier& barrier, ThreadResult& out) {
+    out.error = 0;
+    out.lat_ns.clear();
+    out.lat_ns.reserve(s.count);
+    char* ack = c.buf + c.buf_size - ACK_LEN;
+
+    // The server's end-of-stream acknowledgement needs a receive in place
+    if (s.op == OP_SEND && c.comm->post_receive(ack, 1)) {
+        out.error = 1;
+        return;
+    }
+
+    Clock::time_point start = barrier.wait();
+    if (s.op == OP_PINGPONG) {
+        for (uint64_t i = 0; i < s.count; i++) {
+            Clock::time_point t0 = Clock::now();
+            if (c.comm->post_receive(c.buf, s.size) || c.comm->send(c.buf, s.size) < 0 ||
+                c.comm->recv(c.buf, s.size) != (int)s.size) {
+                out.error = 1;
+                return;
+            }
+            out.lat_ns.push_back(elapsed_ns(t0, Clock::now()) / 2);
+        }
+    } else {
+        // Keep up to depth operations in flight, latency is post to completion
+        std::deque<std::pair<int64_t, Clock::time_point>> inflight;
+        for (uint64_t i = 0; i < s.count || !inflight.empty();) {
+            if (i < s.count && inflight.size() < s.depth) {
+                Clock::time_point t0 = Clock::now();
+                int64_t req = post_op(c, s.op, s.size);
+                if (req < 0) {
+                    out.error = 1;
+                    return;
+                }
+                inflight.push_back(std::make_pair(req, t0));
+                i++;
+                continue;
+            }
+            if (wait_op(c, inflight.front().first)) {
+                out.error = 1;
+                return;
+            }
+            out.lat_ns.push_back(elapsed_ns(inflight.front().second, Clock::now()));
+            inflight.pop_front();
+        }
+        if (s.op == OP_SEND && c.comm->recv(ack, 1) != 1) {
+            out.error = 1;
+            return;
+        }
+    }
+    out.seconds = elapsed_ns(start, Clock::now()) / 1e9;
+}
+
+static int server_thread(Conn& c, const Spec& s) {
+    if (s.op == OP_PINGPONG) {
+        for (uint64_t i = 0; i < s.count; i++) {
+            if (c.comm->post_receive(c.buf, s.size) || c.comm->recv(c.buf, s.size) != (int)s.size ||
+                c.comm->send(c.buf, s.size) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // OP_SEND: every message goes to the same buffer
+    size_t window = std::min((size_t)s.depth, RECV_WINDOW);
+    uint64_t posted = 0;
+    for (uint64_t i = 0; i < s.count; i++) {
+        for (; posted < s.count && posted < i + window; posted++) {
+            if (c.comm->post_receive(c.buf, s.size)) return -1;
+        }
+        if (c.comm->recv(c.buf, s.size) != (int)s.size) return -1;
+    }
+    char* ack = c.buf + c.buf_size - ACK_LEN;
+    return c.comm->send(ack, 1) < 0 ? -1 : 0;
+}
+
+// ---- statistics and output ----
+
+static double percentile_us(const std::vector<uint64_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(q * sorted.size()));
+    return sorted[i] / 1e3;
+}
+
+static Result summarize(const std::string& transport, const Spec& s, std::vector<ThreadResult>& results) {
+    Result r;
+    r.transport = transport;
+    r.op = OP_NAMES[s.op];
+    r.size = s.size;
+    r.depth = (int)s.depth;
+    r.threads = (int)s.threads;
+    r.iters = s.count;
+    r.seconds = 0;
+    std::vector<uint64_t> lat;
+    for (auto& t : results) {
+        r.seconds = std::max(r.seconds, t.seconds);
+        lat.insert(lat.end(), t.lat_ns.begin(), t.lat_ns.end());
+    }
+    std::sort(lat.begin(), lat.end());
+    double ops = (double)s.count * s.threads;
+    r.gb_per_s = r.seconds > 0 ? ops * s.size / r.seconds / 1e9 : 0;
+    r.mops = r.seconds > 0 ? ops / r.seconds / 1e6 : 0;
+    r.p50_us = percentile_us(lat, 0.50);
+    r.p99_us = percentile_us(lat, 0.99);
+    r.p999_us = percentile_us(lat, 0.999);
+    return r;
+}
+
+static void write_results(FILE* f, const std::vector<Result>& results, bool csv) {
+    if (csv) {
+        fprintf(f, "transport,op,size,depth,threads,iters,seconds,gb_per_s,mops,lat_p50_us,lat_p99_us,lat_p999_us\n");
+        for (const auto& r : results) {
+            fprintf(f, "%s,%s,%zu,%d,%d,%llu,%.6f,%.4f,%.4f,%.3f,%.3f,%.3f\n", r.transport.c_str(), r.op.c_str(),
+                    r.size, r.depth, r.threads, (unsigned long long)r.iters, r.seconds, r.gb_per_s, r.mops,
+                    r.p50_us, r.p99_us, r.p999_us);
+        }
+        return;
+    }
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(f, "  {\"transport\": \"%s\", \"op\": \"%s\", \"size\": %zu, \"depth\": %d, \"threads\": %d, "
+                   "\"iters\": %llu, \"seconds\": %.6f, \"gb_per_s\": %.4f, \"mops\": %.4f, "
+                   "\"lat_p50_us\": %.3f, \"lat_p99_us\": %.3f, \"lat_p999_us\": %.3f}%s\n",
+                r.transport.c_str(), r.op.c_str(), r.size, r.depth, r.threads, (unsigned long long)r.iters,
+                r.seconds, r.gb_per_s, r.mops, r.p50_us, r.p99_us, r.p999_us, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+// ---- roles ----
+
+static int run_server(const Options& opt) {
+    int lfd = listen_on(opt.port);
+    if (lfd < 0) die("Failed to listen");
+    fprintf(stderr, "listening on port %d\n", opt.port);
+
+    int ctl = accept(lfd, nullptr, nullptr);
+    if (ctl < 0) die("accept");
+    uint64_t hello[3];
+    if (recv_u64s(ctl, hello, 3)) die("Failed to read the client's hello");
+    TransportKind kind = (TransportKind)hello[0];
+    size_t nconns = (size_t)hello[1];
+    size_t max_size = (size_t)hello[2];
+
+    std::vector<Conn> conns(nconns);
+    for (auto& c : conns) {
+        int fd = accept(lfd, nullptr, nullptr);
+        if (fd < 0) die("accept");
+        setup_conn(c, fd, false, opt, kind, max_size);
+    }
+    if (exchange_regions(ctl, conns)) die("Failed to exchange regions");
+
+    while (true) {
+        Spec s;
+        if (recv_spec(ctl, s) || s.op == OP_QUIT) break;
+        if (s.threads > conns.size()) break;
+
+        // One-sided operations need nothing from us
+        int status = 0;
+        if (s.op == OP_PINGPONG || s.op == OP_SEND) {
+            std::vector<std::thread> threads;
+            std::vector<int> rets(s.threads, 0);
+            for (uint32_t t = 0; t < s.threads; t++) {
+                threads.emplace_back([&, t] { rets[t] = server_thread(conns[t], s); });
+            }
+            for (auto& t : threads) t.join();
+            for (int r : rets) {
+                if (r) status = -1;
+            }
+        }
+        uint64_t v = (uint64_t)(int64_t)status;
+        if (send_u64s(ctl, &v, 1)) break;
+    }
+
+    for (auto& c : conns) teardown_conn(c);
+    close(ctl);
+    close(lfd);
+    return 0;
+}
+
+static int run_spec(int ctl, std::vector<Conn>& conns, const Spec& s, std::vector<ThreadResult>& results) {
+    if (send_spec(ctl, s)) return -1;
+    StartBarrier barrier((int)s.threads);
+    results.assign(s.threads, ThreadResult());
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < s.threads; t++) {
+        threads.emplace_back([&, t] { client_thread(conns[t], s, barrier, results[t]); });
+    }
+    for (auto& t : threads) t.join();
+
+    uint64_t status;
+    if (recv_u64s(ctl, &status, 1) || status != 0) return -1;
+    for (const auto& r : results) {
+        if (r.error) return -1;
+    }
+    return 0;
+}
+
+static int run_client(const Options& opt) {
+    size_t max_size = *std::max_element(opt.sizes.begin(), opt.sizes.end());
+    int nconns = *std::max_element(opt.threads.begin(), opt.threads.end());
+
+    int ctl = connect_to(opt.host, opt.port);
+    if (ctl < 0) die("Failed to connect");
+    uint64_t hello[3] = { (uint64_t)opt.transport, (uint64_t)nconns, max_size };
+    if (send_u64s(ctl, hello, 3)) die("Failed to send hello");
+
+    std::vector<Conn> conns(nconns);
+    for (auto& c : conns) {
+        int fd = connect_to(opt.host, opt.port);
+        if (fd < 0) die("Failed to connect");
+        setup_conn(c, fd, true, opt, opt.transport, max_size);
+    }
+    if (exchange_regions(ctl, conns)) die("Failed to exchange regions");
+    std::string transport = TRANSPORT_NAMES[transport_kind(conns[0].comm.get())];
+
+    std::vector<Result> out;
+    for (int op : opt.ops) {
+        if (!supports(conns[0], op)) {
+            fprintf(stderr, "%s: %s not supported, skipped\n", transport.c_str(), OP_NAMES[op]);
+            continue;
+        }
+        for (int threads : opt.threads) {
+            for (size_t size : opt.sizes) {
+                for (int depth : opt.depths) {
+                    // A round trip has exactly one message in flight
+                    if (op == OP_PINGPONG && depth != opt.depths[0]) continue;
+
+                    Spec s;
+                    s.op = (uint32_t)op;
+                    s.threads = (uint32_t)threads;
+                    s.size = size;
+                    s.depth = op == OP_PINGPONG ? 1 : (uint32_t)depth;
+                    s.count = std::min(opt.warmup, std::max<uint64_t>(1, opt.max_bytes / size));
+
+                    std::vector<ThreadResult> results;
+                    if (s.count > 0 && run_spec(ctl, conns, s, results)) die("Warmup failed");
+                    s.count = std::min(opt.iters, std::max<uint64_t>(10, opt.max_bytes / size));
+                    if (run_spec(ctl, conns, s, results)) die("Benchmark failed");
+
+                    Result r = summarize(transport, s, results);
+                    fprintf(stderr, "%-8s %-5s size %8zu depth %3d threads %2d: %9.3f GB/s %9.4f Mops/s p50 %8.2f us p99 %8.2f us\n",
+                            r.op.c_str(), r.transport.c_str(), r.size, r.depth, r.threads, r.gb_per_s, r.mops,
+                            r.p50_us, r.p99_us);
+                    out.push_back(r);
+                }
+            }
+        }
+    }
+
+    Spec quit{};
+    quit.op = OP_QUIT;
+    send_spec(ctl, quit);
+    for (auto& c : conns) teardown_conn(c);
+    close(ctl);
+
+    FILE* f = stdout;
+    if (!opt.output.empty()) {
+        f = fopen(opt.output.c_str(), "w");
+        if (!f) die("Failed to open output file");
+    }
+    write_results(f, out, opt.csv);
+    if (f != stdout) fclose(f);
+    return 0;
+}
+
+// ---- command line ----
+
+static std::vector<std::string> split(const char* s) {
+    std::vector<std::string> out;
+    std::string cur;
+    for (const char* p = s; ; p++) {
+        if (*p == ',' || *p == '\0') {
+            if (!cur.empty()) out.push_back(cur);
+            cur.clear();
+            if (*p == '\0') break;
+        } else {
+            cur += *p;
+        }
+    }
+    return out;
+}
+
+static size_t parse_size(const std::string& s) {
+    char* end = nullptr;
+    unsigned long long v = strtoull(s.c_str(), &end, 10);
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; break;
+    case 'm': case 'M': v <<= 20; break;
+    case 'g': case 'G': v <<= 30; break;
+    case '\0': break;
+    default: die("Invalid size");
+    }
+    return (size_t)v;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: pyrdma_bench --role server|client [options]\n"
+        "  --host H            server address (client)\n"
+        "  --port P            control port, default 7480\n"
+        "  --transport T       tcp, soft, shm, rdma or auto (client), default tcp\n"
+        "  --dev D             RDMA device, e.g. mlx5_0 or rxe0\n"
+        "  --gid-index N       default 0\n"
+        "  --ops LIST          pingpong,send,write,read (default all)\n"
+        "  --sizes LIST        message sizes, K/M/G suffixes, default 8,64,512,4K,64K,1M\n"
+        "  --depths LIST       operations in flight per thread, default 1,16\n"
+        "  --threads LIST      connections driven in parallel, default 1\n"
+        "  --iters N           operations per thread, default 10000\n"
+        "  --warmup N          untimed operations before each test, default 100\n"
+        "  --max-bytes N       caps iters * size per thread, default 1G\n"
+        "  --format json|csv   default json\n"
+        "  --output FILE       default stdout\n");
+    exit(1);
+}
+
+static Options parse_args(int argc, char** argv) {
+    Options opt;
+    static const option longopts[] = {
+        { "role", required_argument, nullptr, 'r' },
+        { "host", required_argument, nullptr, 'h' },
+        { "port", required_argument, nullptr, 'p' },
+        { "transport", required_argument, nullptr, 't' },
+        { "dev", required_argument, nullptr, 'd' },
+        { "gid-index", required_argument, nullptr, 'g' },
+        { "ops", required_argument, nullptr, 'o' },
+        { "sizes", required_argument, nullptr, 's' },
+        { "depths", required_argument, nullptr, 'q' },
+        { "threads", required_argument, nullptr, 'n' },
+        { "iters", required_argument, nullptr, 'i' },
+        { "warmup", required_argument, nullptr, 'w' },
+        { "max-bytes", required_argument, nullptr, 'm' },
+        { "format", required_argument, nullptr, 'f' },
+        { "output", required_argument, nullptr, 'O' },
+        { nullptr, 0, nullptr, 0 },
+    };
+    bool have_role = false;
+    const char* ops = "pingpong,send,write,read";
+    const char* sizes = "8,64,512,4K,64K,1M";
+    const char* depths = "1,16";
+    const char* threads = "1";
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (c) {
+        case 'r':
+            have_role = true;
+            opt.server = strcmp(optarg, "server") == 0;
+            if (!opt.server && strcmp(optarg, "client") != 0) usage();
+            break;
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 't': {
+            int k = -1;
+            for (int i = 0; i < 5; i++) {
+                if (strcmp(optarg, TRANSPORT_NAMES[i]) == 0) k = i;
+            }
+            if (k < 0) usage();
+            opt.transport = (TransportKind)k;
+            break;
+        }
+        case 'd': opt.dev = optarg; break;
+        case 'g': opt.gid_index = atoi(optarg); break;
+        case 'o': ops = optarg; break;
+        case 's': sizes = optarg; break;
+        case 'q': depths = optarg; break;
+        case 'n': threads = optarg; break;
+        case 'i': opt.iters = strtoull(optarg, nullptr, 10); break;
+        case 'w': opt.warmup = strtoull(optarg, nullptr, 10); break;
+        case 'm': opt.max_bytes = parse_size(optarg); break;
+        case 'f':
+            opt.csv = strcmp(optarg, "csv") == 0;
+            if (!opt.csv && strcmp(optarg, "json") != 0) usage();
+            break;
+        case 'O': opt.output = optarg; break;
+        default: usage();
+        }
+    }
+    if (!have_role) usage();
+
+    for (const auto& s : split(ops)) {
+        int k = -1;
+        for (int i = 0; i < NUM_OPS; i++) {
+            if (s == OP_NAMES[i]) k = i;
+        }
+        if (k < 0) usage();
+        opt.ops.push_back(k);
+    }
+    for (const auto& s : split(sizes)) {
+        size_t v = parse_size(s);
+        if (v == 0) die("Sizes must be positive");
+        opt.sizes.push_back(v);
+    }
+    for (const auto& s : split(depths)) opt.depths.push_back(std::max(1, atoi(s.c_str())));
+    for (const auto& s : split(threads)) opt.threads.push_back(std::max(1, atoi(s.c_str())));
+    if (opt.ops.empty() || opt.sizes.empty() || opt.depths.empty() || opt.threads.empty()) usage();
+    if (opt.iters == 0) opt.iters = 1;
+    return opt;
+}
+
+int main(int argc, char** argv) {
+    Options opt = parse_args(argc, argv);
+    return opt.server ? run_server(opt) : run_client(opt);
+}
@@ -21,9 +21,38 @@ DEFAULT_ITERATIONS = 100
 DEFAULT_DEVICE = "mlx5_0"
 DEFAULT_GID_INDEX = 0
 DEFAULT_BUCKET_SIZE = 1024**3 # 1GB
+DEFAULT_NUM_QPS = 1
+CTRL_MSG_SIZE = 64
 
 
-def run_server(port, buffer_size, iterations, device, gid_index):
+def alloc_buffer(comm, buffer_size, use_pool):
+    """Allocate the transfer buffer, from a registered hugepage pool if requested."""
+    # The shared memory transport only exposes memory both processes map
+    if isinstance(comm, pyrdma.ShmCommunicator):
+        return None, comm.alloc_buffer(buffer_size)
+    if not use_pool:
+        return None, bytearray(buffer_size)
+    pool = pyrdma.BufferPool(comm, [(buffer_size, 1)])
+    print(f"Buffer pool created (hugetlb={pool.is_hugetlb()})")
+    return pool, memoryview(pool.acquire(buffer_size))
+
+
+def create_comm(fd, device, gid_index, num_qps, transport="rdma"):
+    """Create an RDMA communicator, striping large transfers over num_qps QPs.
+
+    The "soft" transport emulates RDMA over the TCP socket, for hosts without an HCA;
+    "shm" runs over shared memory when both processes are on the same host.
+    """
+    if transport == "soft":
+        return pyrdma.SoftRDMACommunicator(fd)
+    if transport == "shm":
+        return pyrdma.ShmCommunicator(fd)
+    config = pyrdma.QPConfig(num_qps=num_qps)
+    return pyrdma.RDMACommunicator(fd, device, gid_index, config)
+
+
+def run_server(port, buffer_size, iterations, device, gid_index, use_pool=False, num_qps=DEFAULT_NUM_QPS,
+               transport="rdma"):
     print(f"\n=== RDMA Bandwidth Test Server ===")
     print(f"Listening on port {port}")
     
@@ -39,25 +68,19 @@ def run_server(port, buffer_size, iterations, device, gid_index):
         print(f"Accepted connection from {addr}")
         
         # Create RDMA communicator
-        server_comm = pyrdma.RDMACommunicator(conn.fileno(), device, gid_index)
+        server_comm = create_comm(conn.fileno(), device, gid_index, num_qps, transport)
         print(f"Server RDMA communicator created")
         
         # Create buffer
-        buf = bytearray(buffer_size)
+        pool, buf = alloc_buffer(server_comm, buffer_size, use_pool)
         server_comm.set_buffer(buf, buffer_size)
         print(f"Buffer set with size {buffer_size} bytes")
         
-        # Exchange QP information
-        server_msg = pyrdma.WireMsg()
-        client_msg = pyrdma.WireMsg()
+        # Exchange QP information and bring the QPs up
         print("Exchanging QP information with client")
-        server_comm.exchange_qp_info(server_msg, client_msg)
-        
-        # Modify QP states
-        server_comm.modify_qp_to_init()
-        server_comm.modify_qp_to_rtr(client_msg)
-        server_comm.modify_qp_to_rts(server_msg)
-        print("QP states modified")
+        if server_comm.accept() != 0:
+            raise RuntimeError("connection setup failed")
+        print(f"Connected over {getattr(server_comm, 'num_qps', 1)} QP(s)")
         
         # Warm up
         print("Warming up...")
@@ -124,7 +147,8 @@ def run_server(port, buffer_size, iterations, device, gid_index):
         traceback.print_exc()
 
 
-def run_client(port, buffer_size, iterations, device, gid_index, server_ip):
+def run_client(port, buffer_size, iterations, device, gid_index, server_ip, use_pool=False,
+               num_qps=DEFAULT_NUM_QPS, transport="rdma"):
     print(f"\n=== RDMA Bandwidth Test Client ===")
     
     try:
@@ -134,11 +158,11 @@ def run_client(port, buffer_size, iterations, device, gid_index, server_ip):
         client_socket.connect((server_ip, port))
         
         # Create RDMA communicator
-        client_comm = pyrdma.RDMACommunicator(client_socket.fileno(), device, gid_index)
+        client_comm = create_comm(client_socket.fileno(), device, gid_index, num_qps, transport)
         print(f"Client RDMA communicator created")
         
         # Create buffer
-        buf = bytearray(buffer_size)
+        pool, buf = alloc_buffer(client_comm, buffer_size, use_pool)
         client_comm.set_buffer(buf, buffer_size)
         print(f"Buffer set with size {buffer_size} bytes")
         
@@ -146,20 +170,11 @@ def run_client(port, buffer_size, iterations, device, gid_index, server_ip):
         test_data = b"X" * buffer_size
         buf[:buffer_size] = test_data
         
-        # Exchange QP information
-        client_msg = pyrdma.WireMsg()
-        client_msg.rkey = 0
-        client_msg.vaddr = 0
-        
-        server_msg = pyrdma.WireMsg()
+        # Exchange QP information and bring the QPs up
         print("Exchanging QP information with server")
-        client_comm.exchange_qp_info(client_msg, server_msg)
-        
-        # Modify QP states
-        client_comm.modify_qp_to_init()
-        client_comm.modify_qp_to_rtr(server_msg)
-        client_comm.modify_qp_to_rts(client_msg)
-        print("QP states modified")
+        if client_comm.connect() != 0:
+            raise RuntimeError("connection setup failed")
+        print(f"Connected over {getattr(client_comm, 'num_qps', 1)} QP(s)")
         
         # Warm up
         print("Warming up...")
@@ -174,8 +189,8 @@ def run_client(port, buffer_size, iterations, device, gid_index, server_ip):
                 client_comm.send(buf, chunk_size, offset)
             
             # Receive ack
-            client_comm.post_receive(buf, 8)
-            n = client_comm.recv(buf, 8)
+            client_comm.post_receive(buf, CTRL_MSG_SIZE)
+            n = client_comm.recv(buf, CTRL_MSG_SIZE)
         
         # Bandwidth test
         print(f"Starting bandwidth test with {iterations} iterations")
@@ -192,8 +207,8 @@ def run_client(port, buffer_size, iterations, device, gid_index, server_ip):
                 client_comm.send(buf, chunk_size, offset)
             
             # Receive ack
-            client_comm.post_receive(buf, buffer_size)
-            n = client_comm.recv(buf, buffer_size)
+            client_comm.post_receive(buf, CTRL_MSG_SIZE)
+            n = client_comm.recv(buf, CTRL_MSG_SIZE)
         
         end_time = time.time()
         
@@ -208,8 +223,8 @@ def run_client(port, buffer_size, iterations, device, gid_index, server_ip):
         print(f"Bandwidth: {bandwidth_mbps:.2f} Mbps ({bandwidth_mbps/1000:.2f} Gbps)")
         
         # Receive final results from server
-        client_comm.post_receive(buf, buffer_size)
-        n = client_comm.recv(buf, buffer_size)
+        client_comm.post_receive(buf, CTRL_MSG_SIZE)
+        n = client_comm.recv(buf, CTRL_MSG_SIZE)
         result_str = bytes(buf[:n]).decode()
         
         if result_str.startswith("RESULT:"):
@@ -242,13 +257,23 @@ def main():
                         help=f"GID index (default: {DEFAULT_GID_INDEX})")
     parser.add_argument("--server-ip", default="localhost",
                         help="Server IP address (default: localhost)")
+    parser.add_argument("--use-pool", action="store_true",
+                        help="Allocate the buffer from a registered hugepage BufferPool")
+    parser.add_argument("--num-qps", type=int, default=DEFAULT_NUM_QPS,
+                        help=f"QPs to stripe large transfers over (default: {DEFAULT_NUM_QPS})")
+    parser.add_argument("--transport", choices=["rdma", "soft", "shm"], default="rdma",
+                        help="rdma, soft to emulate RDMA over the TCP socket, or shm on one host (default: rdma)")
     
     args = parser.parse_args()
+    if args.transport != "rdma" and args.use_pool:
+        parser.error("--use-pool needs the rdma transport")
     
     if args.role == "server":
-        run_server(args.port, args.buffer_size, args.iterations, args.device, args.gid_index)
+        run_server(args.port, args.buffer_size, args.iterations, args.device, args.gid_index,
+                   args.use_pool, args.num_qps, args.transport)
     else:
-        run_client(args.port, args.buffer_size, args.iterations, args.device, args.gid_index, args.server_ip)
+        run_client(args.port, args.buffer_size, args.iterations, args.device, args.gid_index, args.server_ip,
+                   args.use_pool, args.num_qps, args.transport)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+
+import sys
+import socket
+import time
+import argparse
+
+try:
+    import pyrdma
+    print("Successfully imported pyrdma module")
+except ImportError as e:
+    print(f"Failed to import pyrdma module: {e}")
+    print("Please make sure the module is built and installed correctly.")
+    sys.exit(1)
+
+# Constants for the test
+DEFAULT_PORT = 12348
+DEFAULT_MSG_SIZE = 32
+DEFAULT_ITERATIONS = 10000
+DEFAULT_WARMUP = 1000
+DEFAULT_DEVICE = "mlx5_0"
+DEFAULT_GID_INDEX = 0
+DEFAULT_INLINE_THRESHOLD = 64
+BUFFER_SIZE = 4096
+
+
+def connect_comm(sock, device, gid_index, inline_threshold):
+    """Create a communicator with the given inline threshold and bring its QP to RTS."""
+    config = pyrdma.QPConfig(inline_threshold=inline_threshold)
+    comm = pyrdma.RDMACommunicator(sock.fileno(), device, gid_index, config)
+    buf = bytearray(BUFFER_SIZE)
+    comm.set_buffer(buf, BUFFER_SIZE)
+
+    local_msg = pyrdma.WireMsg()
+    peer_msg = pyrdma.WireMsg()
+    comm.exchange_qp_info(local_msg, peer_msg)
+    comm.modify_qp_to_init()
+    comm.modify_qp_to_rtr(peer_msg)
+    comm.modify_qp_to_rts(local_msg)
+    return comm, buf
+
+
+def run_server_pass(sock, msg_size, iterations, device, gid_index, inline_threshold):
+    comm, buf = connect_comm(sock, device, gid_index, inline_threshold)
+    # The reply comes from plain, unregistered memory
+    reply = bytes(msg_size)
+    # Keep one receive posted ahead, so the client's next request never
+    # arrives before its receive (RNR retry would land in the samples)
+    comm.post_receive(buf, msg_size)
+    for i in range(iterations):
+        comm.recv(buf, msg_size)
+        if i + 1 < iterations:
+            comm.post_receive(buf, msg_size)
+        comm.send(reply, msg_size)
+
+
+def run_client_pass(sock, msg_size, iterations, device, gid_index, inline_threshold):
+    comm, buf = connect_comm(sock, device, gid_index, inline_threshold)
+    msg = b"X" * msg_size
+    samples = []
+    for i in range(iterations):
+        start = time.perf_counter_ns()
+        comm.post_receive(buf, msg_size)
+        comm.send(msg, msg_size)
+        comm.recv(buf, msg_size)
+        samples.append(time.perf_counter_ns() - start)
+    return comm.config.inline_threshold, samples
+
+
+def report(label, threshold, samples, warmup):
+    # One-way latency is half of the round trip
+    lat = sorted(s / 2000.0 for s in samples[warmup:])
+    n = len(lat)
+    avg = sum(lat) / n
+    print(f"{label:<12} inline<= {threshold:<5} avg {avg:8.2f} us  "
+          f"p50 {lat[n // 2]:8.2f} us  p99 {lat[min(n - 1, n * 99 // 100)]:8.2f} us")
+
+
+def run_server(port, msg_size, iterations, warmup, device, gid_index, inline_threshold):
+    print(f"\n=== RDMA Latency Test Server ===")
+    print(f"Listening on port {port}")
+
+    try:
+        server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server_socket.bind(("0.0.0.0", port))
+        server_socket.listen(1)
+
+        print(f"Waiting for client connection...")
+        conn, addr = server_socket.accept()
+        print(f"Accepted connection from {addr}")
+
+        # Same passes as the client: without inline sends, then with them
+        for threshold in (0, inline_threshold):
+            run_server_pass(conn, msg_size, warmup + iterations, device, gid_index, threshold)
+
+        conn.close()
+        server_socket.close()
+        print("Server test completed")
+
+    except Exception as e:
+        print(f"Server test failed: {e}")
+        import traceback
+        traceback.print_exc()
+
+
+def run_client(port, msg_size, iterations, warmup, device, gid_index, server_ip, inline_threshold):
+    print(f"\n=== RDMA Latency Test Client ===")
+
+    try:
+        client_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        print(f"Connecting to server on port {port}")
+        client_socket.connect((server_ip, port))
+
+        print(f"Ping-pong with {msg_size} byte messages, {iterations} iterations")
+        for label, threshold in (("registered", 0), ("inline", inline_threshold)):
+            actual, samples = run_client_pass(client_socket, msg_size, warmup + iterations,
+                                              device, gid_index, threshold)
+            report(label, actual, samples, warmup)
+
+        client_socket.close()
+        print("Client test completed")
+
+    except Exception as e:
+        print(f"Client test failed: {e}")
+        import traceback
+        traceback.print_exc()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RDMA Latency Test (inline vs. registered sends)")
+    parser.add_argument("--role", choices=["server", "client"], required=True,
+                        help="Role to run as: server or client")
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT,
+                        help=f"Port to listen on/connect to (default: {DEFAULT_PORT})")
+    parser.add_argument("--msg-size", type=int, default=DEFAULT_MSG_SIZE,
+                        help=f"Message size in bytes (default: {DEFAULT_MSG_SIZE})")
+    parser.add_argument("--iterations", type=int, default=DEFAULT_ITERATIONS,
+                        help=f"Number of measured iterations (default: {DEFAULT_ITERATIONS})")
+    parser.add_argument("--warmup", type=int, default=DEFAULT_WARMUP,
+                        help=f"Number of warm-up iterations (default: {DEFAULT_WARMUP})")
+    parser.add_argument("--device", default=DEFAULT_DEVICE,
+                        help=f"RDMA device name (default: {DEFAULT_DEVICE})")
+    parser.add_argument("--gid-index", type=int, default=DEFAULT_GID_INDEX,
+                        help=f"GID index (default: {DEFAULT_GID_INDEX})")
+    parser.add_argument("--inline-threshold", type=int, default=DEFAULT_INLINE_THRESHOLD,
+                        help=f"Inline threshold of the second pass (default: {DEFAULT_INLINE_THRESHOLD})")
+    parser.add_argument("--server-ip", default="localhost",
+                        help="Server IP address (default: localhost)")
+
+    args = parser.parse_args()
+    if args.msg_size <= 0 or args.msg_size > BUFFER_SIZE:
+        parser.error(f"--msg-size must be in [1, {BUFFER_SIZE}]")
+
+    if args.role == "server":
+        run_server(args.port, args.msg_size, args.iterations, args.warmup, args.device,
+                   args.gid_index, args.inline_threshold)
+    else:
+        run_client(args.port, args.msg_size, args.iterations, args.warmup, args.device,
+                   args.gid_index, args.server_ip, args.inline_threshold)
+
+
+if __name__ == "__main__":
+    main()
@@ -8,6 +8,7 @@
 #include <iostream>
 
 static const int PORT = 7473;  // Port for testing
+static const size_t MSG_LEN = 64;  // recv() waits for exactly this many bytes
 static void die(const char* msg){ perror(msg); exit(1); }
 
 int main() {
@@ -26,16 +27,16 @@ int main() {
     TCPCommunicator tcp_comm(sockfd);
     
     // Send message
-    const char* message = "Hello from TCP client";
+    char message[MSG_LEN] = "Hello from TCP client";
     std::cout << "Client sending message...\n";
-    if (tcp_comm.send(message, strlen(message) + 1) == strlen(message) + 1) {
+    if (tcp_comm.send(message, MSG_LEN) == (int)MSG_LEN) {
         std::cout << "Client sent message\n";
     } else {
         std::cout << "Client failed to send message\n";
     }
     
     // Receive response
-    char buffer[256] = {0};
+    char buffer[MSG_LEN] = {0};
     std::cout << "Client waiting to receive response...\n";
     if (tcp_comm.recv(buffer, sizeof(buffer)) > 0) {
         std::cout << "Client received: " << buffer << std::endl;
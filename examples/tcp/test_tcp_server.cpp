@@ -9,6 +9,7 @@
 #include <iostream>
 
 static const int PORT = 7473;  // Port for testing
+static const size_t MSG_LEN = 64;  // recv() waits for exactly this many bytes
 static void die(const char* msg){ perror(msg); exit(1); }
 
 int main() {
@@ -38,7 +39,7 @@ int main() {
     TCPCommunicator tcp_comm(cfd);
     
     // Receive message
-    char buffer[256] = {0};
+    char buffer[MSG_LEN] = {0};
     std::cout << "Server waiting to receive message...\n";
     if (tcp_comm.recv(buffer, sizeof(buffer)) > 0) {
         std::cout << "Server received: " << buffer << std::endl;
@@ -47,9 +48,9 @@ int main() {
     }
     
     // Send response
-    const char* response = "Hello from TCP server";
+    char response[MSG_LEN] = "Hello from TCP server";
     std::cout << "Server sending response...\n";
-    if (tcp_comm.send(response, strlen(response) + 1) == strlen(response) + 1) {
+    if (tcp_comm.send(response, MSG_LEN) == (int)MSG_LEN) {
         std::cout << "Server sent response\n";
     } else {
         std::cout << "Server failed to send response\n";
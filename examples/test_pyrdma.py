@@ -16,6 +16,10 @@ except ImportError as e:
 # 这是一个简单的测试脚本，展示如何使用pyrdma模块
 # 注意：实际使用时需要根据具体情况修改
 
+# TCP recv() 会等满指定长度，双方使用固定长度的消息
+TCP_MSG_LEN = 64
+
+
 def run_tcp_test():
     print("\n=== Testing TCP Communicator ===")
     try:
@@ -37,13 +41,14 @@ def run_tcp_test():
         print(f"Server communicator created with fd: {server_comm.get_fd()}")
 
         # 接收消息
-        buf = bytearray(1024)
+        buf = bytearray(TCP_MSG_LEN)
         n = server_comm.recv(buf, len(buf))
-        print(f"Received {n} bytes: {buf[:n].decode()}")
+        text = bytes(buf[:n]).rstrip(b"\0").decode()
+        print(f"Received {n} bytes: {text}")
 
         # 发送回复
         response = "Hello from TCP server"
-        n = server_comm.send(response.encode(), len(response))
+        n = server_comm.send(response.encode().ljust(TCP_MSG_LEN, b"\0"), TCP_MSG_LEN)
         print(f"Sent {n} bytes: {response}")
 
         # 等待客户端结束
@@ -66,13 +71,14 @@ def run_tcp_client():
 
         # 发送消息
         message = "Hello from TCP client"
-        n = client_comm.send(message.encode(), len(message))
+        n = client_comm.send(message.encode().ljust(TCP_MSG_LEN, b"\0"), TCP_MSG_LEN)
         print(f"Sent {n} bytes: {message}")
 
         # 接收回复
-        buf = bytearray(1024)
+        buf = bytearray(TCP_MSG_LEN)
         n = client_comm.recv(buf, len(buf))
-        print(f"Received {n} bytes: {buf[:n].decode()}")
+        text = bytes(buf[:n]).rstrip(b"\0").decode()
+        print(f"Received {n} bytes: {text}")
 
         client_socket.close()
     except Exception as e:
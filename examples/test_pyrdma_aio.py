@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+import sys
+import socket
+import asyncio
+
+# 尝试导入pyrdma和asyncio封装
+try:
+    import pyrdma
+    from pyrdma_aio import AsyncRDMACommunicator
+    print("Successfully imported pyrdma and pyrdma_aio modules")
+except ImportError as e:
+    print(f"Failed to import pyrdma modules: {e}")
+    print("Please make sure the module is built and installed correctly.")
+    sys.exit(1)
+
+# 这个脚本检查事件模式(event_fd/process_events/try_recv)和AsyncRDMACommunicator
+# 注意：需要RDMA硬件，设备名称和GID索引按实际情况修改
+
+PORT = 12350
+DEVICE = "mlx5_0"
+GID_INDEX = 0
+BUF_SIZE = 4096
+MSG_LEN = 64
+MSG_COUNT = 8
+# 对端单边写入的位置，在接收区之后
+WRITE_OFF = 2048
+IMM_OFF = 3072
+IMM_VALUE = 0x1234
+
+
+def connect_comm(sock):
+    """创建RDMACommunicator并把QP切换到RTS，返回通信器、缓冲区和对端信息"""
+    comm = pyrdma.RDMACommunicator(sock.fileno(), DEVICE, GID_INDEX)
+    buf = bytearray(BUF_SIZE)
+    comm.set_buffer(buf, BUF_SIZE)
+
+    local_msg = pyrdma.WireMsg()
+    peer_msg = pyrdma.WireMsg()
+    comm.exchange_qp_info(local_msg, peer_msg)
+    comm.modify_qp_to_init()
+    comm.modify_qp_to_rtr(peer_msg)
+    comm.modify_qp_to_rts(local_msg)
+    return comm, buf, peer_msg
+
+
+def pattern(i, length):
+    return bytes((i + j) & 0xff for j in range(length))
+
+
+async def serve(comm, buf, sock):
+    acomm = AsyncRDMACommunicator(comm)
+
+    # 先把所有接收都发布出去：任务运行到第一个await时已经post_receive
+    recvs = [asyncio.ensure_future(acomm.recv(buf, MSG_LEN, i * MSG_LEN)) for i in range(MSG_COUNT)]
+    imm = asyncio.ensure_future(acomm.recv_imm())
+    await asyncio.sleep(0)
+    # 通知客户端可以开始发送
+    sock.sendall(b"R")
+
+    sizes = await asyncio.gather(*recvs)
+    assert sizes == [MSG_LEN] * MSG_COUNT, f"unexpected receive sizes {sizes}"
+    for i in range(MSG_COUNT):
+        assert bytes(buf[i * MSG_LEN:(i + 1) * MSG_LEN]) == pattern(i, MSG_LEN), f"message {i} corrupted"
+    print(f"Received {MSG_COUNT} messages through the event loop")
+
+    # write_with_imm在数据可见之后才完成接收
+    length, value = await imm
+    assert value == IMM_VALUE, f"unexpected immediate {value}"
+    assert bytes(buf[WRITE_OFF:WRITE_OFF + MSG_LEN]) == pattern(100, MSG_LEN), "RDMA write data corrupted"
+    assert bytes(buf[IMM_OFF:IMM_OFF + MSG_LEN]) == pattern(200, MSG_LEN), "write_with_imm data corrupted"
+    print(f"Got immediate {value:#x}, written data verified")
+
+    acomm.close()
+
+
+async def drive(comm, buf, peer_msg):
+    acomm = AsyncRDMACommunicator(comm)
+
+    # 所有发送同时在飞，由同一个事件循环线程完成
+    for i in range(MSG_COUNT):
+        buf[i * MSG_LEN:(i + 1) * MSG_LEN] = pattern(i, MSG_LEN)
+    sizes = await asyncio.gather(*(acomm.send(buf, MSG_LEN, i * MSG_LEN) for i in range(MSG_COUNT)))
+    print(f"Sent {len(sizes)} messages concurrently")
+
+    buf[WRITE_OFF:WRITE_OFF + MSG_LEN] = pattern(100, MSG_LEN)
+    buf[IMM_OFF:IMM_OFF + MSG_LEN] = pattern(200, MSG_LEN)
+    await acomm.write(buf, MSG_LEN, peer_msg.vaddr + WRITE_OFF, peer_msg.rkey, WRITE_OFF)
+    await acomm.write_with_imm(buf, MSG_LEN, peer_msg.vaddr + IMM_OFF, peer_msg.rkey, IMM_VALUE, IMM_OFF)
+    print("Wrote data and notified the server")
+
+    acomm.close()
+
+
+def run_aio_test():
+    print("\n=== Testing RDMA event mode with asyncio ===")
+    try:
+        server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        server_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server_socket.bind(("localhost", PORT))
+        server_socket.listen(1)
+
+        # 在子进程中运行客户端
+        import subprocess
+        client_process = subprocess.Popen([sys.executable, __file__, "aio_client"])
+
+        conn, addr = server_socket.accept()
+        print(f"Accepted connection from {addr}")
+
+        comm, buf, _ = connect_comm(conn)
+        asyncio.run(serve(comm, buf, conn))
+
+        client_process.wait()
+        conn.close()
+        server_socket.close()
+        if client_process.returncode != 0:
+            raise RuntimeError("client failed")
+        print("asyncio test completed")
+    except Exception as e:
+        print(f"asyncio test failed: {e}")
+        print("Please make sure RDMA hardware is available and properly configured.")
+        sys.exit(1)
+
+
+def run_aio_client():
+    try:
+        client_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        client_socket.connect(("localhost", PORT))
+
+        comm, buf, peer_msg = connect_comm(client_socket)
+        # 等服务器发布完接收
+        if client_socket.recv(1) != b"R":
+            raise RuntimeError("server did not get ready")
+        asyncio.run(drive(comm, buf, peer_msg))
+
+        client_socket.close()
+    except Exception as e:
+        print(f"asyncio client failed: {e}")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1 and sys.argv[1] == "aio_client":
+        run_aio_client()
+    else:
+        run_aio_test()
+        print("\nTest completed.")
@@ -0,0 +1,130 @@
+"""asyncio front end for pyrdma.RDMACommunicator.
+
+The communicator's completion channel fd is registered with the event loop,
+so completions are reaped only when the fd turns readable, without a polling
+thread and without blocking the loop. Each operation posts its work request
+and returns a future that is resolved when the request completes, so many
+transfers can be in flight on one loop thread.
+"""
+
+import asyncio
+import collections
+
+
+class AsyncRDMACommunicator:
+    """Awaitable send/recv/write/read over a connected RDMACommunicator.
+
+    The communicator must not run a progress thread. Receives complete in
+    the order they were posted, so post them all through this wrapper.
+    Buffers are kept referenced until their operation completes; close()
+    keeps those of operations still posted for as long as the wrapper and
+    its communicator live, as the QP may still write into them.
+    """
+
+    def __init__(self, comm, loop=None):
+        self.comm = comm
+        self.loop = loop if loop is not None else asyncio.get_running_loop()
+        self._fd = comm.event_fd()
+        self._requests = {}                 # request handle -> (future, buffer)
+        self._recvs = collections.deque()   # (future, buffer, len, offset, with_imm), posting order
+        self._retired = []                  # buffers of operations failed by close() while posted
+        self.loop.add_reader(self._fd, self._on_readable)
+        # Completions from before the CQs were armed raise no event
+        self.loop.call_soon(self._on_readable)
+
+    def close(self, exc=None):
+        """Stop watching the fd and fail every operation still in flight.
+
+        Their work requests stay posted until the QP is drained or destroyed,
+        so their buffers stay referenced along with the communicator.
+        """
+        if self._fd is None:
+            return
+        self.loop.remove_reader(self._fd)
+        self._fd = None
+        exc = exc or ConnectionError("AsyncRDMACommunicator closed")
+        pending = [entry[0] for entry in self._requests.values()] + [entry[0] for entry in self._recvs]
+        self._retired.extend(entry[1] for entry in self._requests.values())
+        self._retired.extend(entry[1] for entry in self._recvs if entry[1] is not None)
+        self._requests.clear()
+        self._recvs.clear()
+        for fut in pending:
+            if not fut.done():
+                fut.set_exception(exc)
+
+    def _on_readable(self):
+        if self._fd is None:
+            return
+        try:
+            done = self.comm.process_events()
+        except RuntimeError as e:
+            self.close(e)
+            return
+        for req in done:
+            entry = self._requests.pop(req, None)
+            if entry is None:
+                continue    # collected by a blocking call
+            fut = entry[0]
+            # Already complete, wait() only collects the result
+            result = self.comm.wait(req)
+            if fut.done():
+                continue
+            if result < 0:
+                fut.set_exception(RuntimeError("RDMA request failed"))
+            else:
+                fut.set_result(result)
+        self._drain_recvs()
+
+    def _drain_recvs(self):
+        while self._recvs:
+            fut, buf, length, offset, with_imm = self._recvs[0]
+            try:
+                r = self.comm.try_recv(buf, length, offset)
+            except RuntimeError as e:
+                r = e
+            if r is None:
+                break
+            self._recvs.popleft()
+            if fut.done():
+                continue
+            if isinstance(r, Exception):
+                fut.set_exception(r)
+            else:
+                fut.set_result(r if with_imm else r[0])
+
+    def _track(self, req, buf):
+        if req < 0:
+            raise RuntimeError("Failed to post RDMA request")
+        fut = self.loop.create_future()
+        self._requests[req] = (fut, buf)
+        return fut
+
+    def _post_recv(self, buf, length, offset, with_imm):
+        if buf is not None and self.comm.post_receive(buf, length, offset) < 0:
+            raise RuntimeError("Failed to post receive")
+        if buf is None and self.comm.post_receive_imm() < 0:
+            raise RuntimeError("Failed to post receive")
+        fut = self.loop.create_future()
+        self._recvs.append((fut, buf, length, offset, with_imm))
+        return fut
+
+    async def send(self, buf, length, offset=0):
+        """Send length bytes of buf; returns the byte count."""
+        return await self._track(self.comm.post_send(buf, length, offset), buf)
+
+    async def recv(self, buf, length, offset=0):
+        """Post a receive into buf and wait for it; returns the byte count."""
+        return await self._post_recv(buf, length, offset, False)
+
+    async def recv_imm(self, buf=None, length=0, offset=0):
+        """Like recv(), returns (length, immediate or None); buf may be None for write_with_imm."""
+        return await self._post_recv(buf, length, offset, True)
+
+    async def write(self, buf, length, remote_addr, rkey, offset=0):
+        return await self._track(self.comm.post_write(buf, length, remote_addr, rkey, offset), buf)
+
+    async def write_with_imm(self, buf, length, remote_addr, rkey, imm, offset=0):
+        return await self._track(self.comm.post_write_with_imm(buf, length, remote_addr, rkey, imm, offset), buf)
+
+    async def read(self, buf, length, remote_addr, rkey, offset=0):
+        return await self._track(self.comm.post_read(buf, length, remote_addr, rkey, offset), buf)
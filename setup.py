@@ -24,14 +24,29 @@ def get_extensions():
             [
                 "src/pyrdma.cpp",
                 "src/tcp_communicator.cpp",
+                "src/comm_stats.cpp",
+                "src/comm_trace.cpp",
                 "src/rdma_communicator.cpp",
+                "src/mr_cache.cpp",
+                "src/buffer_pool.cpp",
+                "src/rdma_srq.cpp",
+                "src/rdma_context.cpp",
+                "src/rdma_handshake.cpp",
+                "src/multi_rail_communicator.cpp",
+                "src/soft_rdma_communicator.cpp",
+                "src/shm_communicator.cpp",
+                "src/communicator_factory.cpp",
+                "src/remote_sync.cpp",
+                "src/reduce_kernels.cpp",
+                "src/comm_group.cpp",
+                "src/registered_buffer.cpp",
             ],
             include_dirs=[
                 "src/",
                 get_pybind_include(),
                 "/usr/include/",
             ],
-            libraries=["ibverbs"],
+            libraries=["ibverbs", "rt"],
             library_dirs=["/usr/lib/x86_64-linux-gnu/"],
             cxx_std=11,
             extra_compile_args=["-Wall", "-Wextra", "-g", "-fPIC"],
@@ -54,6 +69,8 @@ setup(
     long_description_content_type="text/markdown",
     url="https://github.com/konnase/pyrdma",
     ext_modules=get_extensions(),
+    package_dir={"": "python"},
+    py_modules=["pyrdma_aio"],
     setup_requires=["pybind11"],
     cmdclass={"build_ext": build_ext},
     zip_safe=False,
@@ -0,0 +1,116 @@
+#include "buffer_pool.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstdio>
+
+static size_t align_up(size_t v, size_t a) {
+    return (v + a - 1) / a * a;
+}
+
+BufferPool::BufferPool(MRCache* cache, const std::vector<std::pair<size_t, size_t>>& class_list) :
+    cache(cache), mr(nullptr), region(nullptr), region_size(0), hugetlb(false) {
+    std::vector<std::pair<size_t, size_t>> sorted(class_list);
+    std::sort(sorted.begin(), sorted.end());
+
+    // Every class gets its own hugepage-aligned slab
+    for (const auto& c : sorted) {
+        if (c.first == 0 || c.second == 0 || c.second >= UINT32_MAX) continue;
+        std::unique_ptr<SizeClass> sc(new SizeClass());
+        sc->block_size = align_up(c.first, BLOCK_ALIGN);
+        sc->count = c.second;
+        sc->base = (char*)region_size;  // offset until the region is mapped
+        sc->head.store(0);
+        sc->next.reset(new std::atomic<uint32_t>[c.second]);
+        region_size += align_up(sc->block_size * sc->count, HUGE_PAGE_SIZE);
+        classes.push_back(std::move(sc));
+    }
+    if (region_size == 0) return;
+
+    // Explicit hugepages first, transparent hugepages as the fallback
+    void* p = mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        hugetlb = true;
+    } else {
+        p = mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("BufferPool: mmap");
+            return;
+        }
+        madvise(p, region_size, MADV_HUGEPAGE);
+    }
+    region = (char*)p;
+
+    for (auto& sc : classes) {
+        sc->base = region + (size_t)sc->base;
+        for (size_t i = sc->count; i > 0; i--) push(*sc, (uint32_t)(i - 1));
+    }
+
+    // One registration for the whole region, pinned for the pool's lifetime
+    mr = cache->pin(region, region_size, MRCache::DEFAULT_ACCESS);
+    if (!mr) fprintf(stderr, "BufferPool: failed to register %zu bytes\n", region_size);
+}
+
+BufferPool::~BufferPool() {
+    if (!region) return;
+    // Operations still in flight keep their registration until they complete
+    if (mr) {
+        cache->invalidate(region, region_size);
+        cache->unpin(mr);
+    }
+    munmap(region, region_size);
+}
+
+void* BufferPool::pop(SizeClass& sc) {
+    uint64_t old = sc.head.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t idx = (uint32_t)old;
+        if (idx == 0) return nullptr;
+        uint64_t next = sc.next[idx - 1].load(std::memory_order_relaxed);
+        uint64_t desired = (((old >> 32) + 1) << 32) | next;
+        if (sc.head.compare_exchange_weak(old, desired,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return sc.base + (size_t)(idx - 1) * sc.block_size;
+        }
+    }
+}
+
+void BufferPool::push(SizeClass& sc, uint32_t index) {
+    uint64_t old = sc.head.load(std::memory_order_relaxed);
+    uint64_t desired;
+    do {
+        sc.next[index].store((uint32_t)old, std::memory_order_relaxed);
+        desired = (((old >> 32) + 1) << 32) | (index + 1);
+    } while (!sc.head.compare_exchange_weak(old, desired,
+                std::memory_order_release, std::memory_order_relaxed));
+}
+
+void* BufferPool::acquire(size_t size) {
+    if (!mr) return nullptr;
+    // Smallest class that fits, larger ones when it is exhausted
+    for (auto& sc : classes) {
+        if (sc->block_size < size) continue;
+        void* p = pop(*sc);
+        if (p) return p;
+    }
+    return nullptr;
+}
+
+void BufferPool::release(void* ptr) {
+    char* p = (char*)ptr;
+    for (auto& sc : classes) {
+        if (p >= sc->base && p < sc->base + sc->block_size * sc->count) {
+            push(*sc, (uint32_t)((p - sc->base) / sc->block_size));
+            return;
+        }
+    }
+}
+
+size_t BufferPool::block_size(const void* ptr) const {
+    const char* p = (const char*)ptr;
+    for (const auto& sc : classes) {
+        if (p >= sc->base && p < sc->base + sc->block_size * sc->count) return sc->block_size;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "mr_cache.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Fixed-size-class allocator over one hugepage-backed region that is
+// registered once. Each size class keeps a lock-free free list, so
+// acquire/release can be called from any thread.
+class BufferPool {
+private:
+    struct SizeClass {
+        size_t block_size;
+        size_t count;
+        char* base;
+        // (ABA tag << 32) | (block index + 1), 0 when the list is empty
+        std::atomic<uint64_t> head;
+        std::unique_ptr<std::atomic<uint32_t>[]> next;
+    };
+
+    static const size_t HUGE_PAGE_SIZE = 2UL << 20;
+    static const size_t BLOCK_ALIGN = 64;
+
+    MRCache* cache;
+    ibv_mr* mr;
+    char* region;
+    size_t region_size;
+    bool hugetlb;
+    std::vector<std::unique_ptr<SizeClass>> classes;  // ascending block size
+
+    static void* pop(SizeClass& sc);
+    static void push(SizeClass& sc, uint32_t index);
+
+public:
+    // classes: (block size, block count) pairs
+    BufferPool(MRCache* cache, const std::vector<std::pair<size_t, size_t>>& classes);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Return a block of at least `size` bytes, nullptr if none is free
+    void* acquire(size_t size);
+    void release(void* ptr);
+
+    // Usable size of the block holding ptr, 0 if ptr is not from this pool
+    size_t block_size(const void* ptr) const;
+
+    bool valid() const { return mr != nullptr; }
+    bool is_hugetlb() const { return hugetlb; }
+    void* base() const { return region; }
+    size_t size() const { return region_size; }
+    uint32_t get_lkey() const { return mr ? mr->lkey : 0; }
+    uint32_t get_rkey() const { return mr ? mr->rkey : 0; }
+};
+
+#endif // BUFFER_POOL_H
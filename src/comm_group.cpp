@@ -0,0 +1,262 @@
+#include "comm_group.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static void die(const char* msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+CommGroup::CommGroup(int rank, const std::vector<Communicator*>& peers, size_t chunk_size) :
+    rank_(rank), size_((int)peers.size()), peers(peers), chunk_size(chunk_size ? chunk_size : DEFAULT_CHUNK_SIZE),
+    scratch(nullptr), full_mesh(true), sends_queued(0), sends_done(0), send_failed(false), stopping(false) {
+    if (rank < 0 || rank >= size_) die("CommGroup rank out of range");
+    for (int i = 0; i < size_; i++) {
+        if (i != rank && !peers[i]) full_mesh = false;
+    }
+    if (size_ > 1 && (!peers[mod(rank - 1)] || !peers[mod(rank + 1)])) die("CommGroup needs both ring neighbours");
+
+    void* p = nullptr;
+    size_t scratch_size = RECV_DEPTH * std::max(this->chunk_size, sizeof(float));
+    if (posix_memalign(&p, 4096, scratch_size)) die("Failed to allocate CommGroup scratch");
+    scratch = (char*)p;
+    // Every chunk to reduce lands here, so it is registered once
+    for (int i = 0; i < size_; i++) {
+        if (i != rank && peers[i] && peers[i]->pin_memory(scratch, scratch_size)) {
+            die("Failed to pin CommGroup scratch");
+        }
+    }
+
+    sender = std::thread(&CommGroup::sender_loop, this);
+}
+
+CommGroup::~CommGroup() {
+    {
+        std::lock_guard<std::mutex> lock(send_mtx);
+        stopping = true;
+    }
+    send_cv.notify_all();
+    sender.join();
+
+    // Drop the registrations of the scratch area
+    size_t scratch_size = RECV_DEPTH * std::max(chunk_size, sizeof(float));
+    for (int i = 0; i < size_; i++) {
+        if (i != rank_ && peers[i]) peers[i]->invalidate_memory(scratch, scratch_size);
+    }
+    free(scratch);
+}
+
+size_t CommGroup::chunk_bytes(size_t elem) const {
+    // Chunks never split an element, so they can be reduced on arrival
+    size_t c = chunk_size / elem * elem;
+    return c ? c : elem;
+}
+
+void CommGroup::enqueue_send(Communicator* comm, const char* buf, size_t len) {
+    std::lock_guard<std::mutex> lock(send_mtx);
+    sends.push_back(CollSend{ comm, buf, len });
+    sends_queued++;
+    send_cv.notify_all();
+}
+
+int CommGroup::flush_sends() {
+    std::unique_lock<std::mutex> lock(send_mtx);
+    send_cv.wait(lock, [this] { return sends_done == sends_queued; });
+    return send_failed ? -1 : 0;
+}
+
+void CommGroup::sender_loop() {
+    while (true) {
+        CollSend s;
+        bool skip;
+        {
+            std::unique_lock<std::mutex> lock(send_mtx);
+            send_cv.wait(lock, [this] { return stopping || !sends.empty(); });
+            if (sends.empty()) return;
+            s = sends.front();
+            sends.pop_front();
+            // After a failure the peers are out of step, drain without sending
+            skip = send_failed;
+        }
+        bool ok = skip || s.comm->send(s.buf, s.len) >= 0;
+        {
+            std::lock_guard<std::mutex> lock(send_mtx);
+            if (!ok) send_failed = true;
+            sends_done++;
+        }
+        send_cv.notify_all();
+    }
+}
+
+int CommGroup::ring_pass(char* buf, const std::vector<size_t>& offs, const std::vector<size_t>& lens, int shift,
+                         size_t elem, bool reduce, ReduceDtype dtype, ReduceOp op) {
+    Communicator* left = peers[mod(rank_ - 1)];
+    Communicator* right = peers[mod(rank_ + 1)];
+    size_t chunk = chunk_bytes(elem);
+
+    // In step s we send segment rank - s - shift and receive the one before
+    // it, which is what we send in step s + 1. Every chunk received during
+    // the pass, in arrival order:
+    struct Piece {
+        size_t off;
+        size_t len;
+        bool forward;
+    };
+    std::vector<Piece> recvs;
+    for (int s = 0; s < size_ - 1; s++) {
+        int seg = mod(rank_ - s - shift - 1);
+        for (size_t o = 0; o < lens[seg]; o += chunk) {
+            recvs.push_back(Piece{ offs[seg] + o, std::min(chunk, lens[seg] - o), s < size_ - 2 });
+        }
+    }
+
+    // Data to reduce arrives in a scratch slot, the rest in place
+    auto dest = [&](size_t i) { return reduce ? scratch + (i % RECV_DEPTH) * chunk : buf + recvs[i].off; };
+
+    int seg = mod(rank_ - shift);
+    for (size_t o = 0; o < lens[seg]; o += chunk) {
+        enqueue_send(right, buf + offs[seg] + o, std::min(chunk, lens[seg] - o));
+    }
+
+    int ret = 0;
+    size_t posted = 0;
+    for (size_t i = 0; i < recvs.size() && ret == 0; i++) {
+        // Keep RECV_DEPTH receives posted; the slot reused here was
+        // reduced in the previous iteration
+        for (; posted < recvs.size() && posted < i + RECV_DEPTH; posted++) {
+            if (left->post_receive(dest(posted), recvs[posted].len)) {
+                ret = -1;
+                break;
+            }
+        }
+        if (ret) break;
+
+        const Piece& p = recvs[i];
+        char* d = dest(i);
+        if (left->recv(d, p.len) != (int)p.len) {
+            ret = -1;
+            break;
+        }
+        if (reduce) reduce_into(buf + p.off, d, p.len / elem, dtype, op);
+        if (p.forward) enqueue_send(right, buf + p.off, p.len);
+    }
+    if (flush_sends()) ret = -1;
+    return ret;
+}
+
+int CommGroup::chain_broadcast(char* buf, size_t len, int root) {
+    Communicator* prev = peers[mod(rank_ - 1)];
+    Communicator* next = peers[mod(rank_ + 1)];
+    int vr = mod(rank_ - root);
+    size_t chunk = chunk_bytes(1);
+
+    if (vr == 0) {
+        for (size_t o = 0; o < len; o += chunk) enqueue_send(next, buf + o, std::min(chunk, len - o));
+        return flush_sends();
+    }
+
+    // Each chunk is passed on while the next one arrives
+    size_t n = (len + chunk - 1) / chunk;
+    size_t posted = 0;
+    int ret = 0;
+    for (size_t i = 0; i < n && ret == 0; i++) {
+        for (; posted < n && posted < i + RECV_DEPTH; posted++) {
+            size_t o = posted * chunk;
+            if (prev->post_receive(buf + o, std::min(chunk, len - o))) {
+                ret = -1;
+                break;
+            }
+        }
+        if (ret) break;
+
+        size_t o = i * chunk;
+        size_t l = std::min(chunk, len - o);
+        if (prev->recv(buf + o, l) != (int)l) {
+            ret = -1;
+            break;
+        }
+        if (vr < size_ - 1) enqueue_send(next, buf + o, l);
+    }
+    if (flush_sends()) ret = -1;
+    return ret;
+}
+
+int CommGroup::tree_broadcast(char* buf, size_t len, int root) {
+    int vr = mod(rank_ - root);
+
+    // Binomial tree: the parent differs in our lowest set bit ...
+    int mask = 1;
+    while (mask < size_) {
+        if (vr & mask) {
+            Communicator* parent = peers[mod(vr - mask + root)];
+            if (parent->post_receive(buf, len) || parent->recv(buf, len) != (int)len) return -1;
+            break;
+        }
+        mask <<= 1;
+    }
+    // ... and the children in the bits below it
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+        if (vr + mask < size_ && peers[mod(vr + mask + root)]->send(buf, len) < 0) return -1;
+    }
+    return 0;
+}
+
+int CommGroup::broadcast(void* buf, size_t len, int root) {
+    if (root < 0 || root >= size_) return -1;
+    if (size_ == 1 || len == 0) return 0;
+    // Small messages are latency bound, a tree takes log2(size) hops
+    if (len <= chunk_size && full_mesh) return tree_broadcast((char*)buf, len, root);
+    return chain_broadcast((char*)buf, len, root);
+}
+
+int CommGroup::allgather(void* buf, size_t len) {
+    if (size_ == 1 || len == 0) return 0;
+    std::vector<size_t> offs(size_), lens(size_, len);
+    for (int i = 0; i < size_; i++) offs[i] = (size_t)i * len;
+    return ring_pass((char*)buf, offs, lens, 0, 1, false, DTYPE_FLOAT32, REDUCE_SUM);
+}
+
+int CommGroup::reduce_scatter(void* buf, size_t count, ReduceDtype dtype, ReduceOp op) {
+    if (size_ == 1 || count == 0) return 0;
+    size_t elem = dtype_size(dtype);
+    std::vector<size_t> offs(size_), lens(size_, count * elem);
+    for (int i = 0; i < size_; i++) offs[i] = (size_t)i * count * elem;
+    return ring_pass((char*)buf, offs, lens, 1, elem, true, dtype, op);
+}
+
+int CommGroup::allreduce(void* buf, size_t count, ReduceDtype dtype, ReduceOp op) {
+    if (size_ == 1 || count == 0) return 0;
+
+    // Segments differ by at most one element when count is not a multiple
+    size_t elem = dtype_size(dtype);
+    std::vector<size_t> offs(size_), lens(size_);
+    size_t off = 0;
+    for (int i = 0; i < size_; i++) {
+        size_t n = count / size_ + ((size_t)i < count % size_ ? 1 : 0);
+        offs[i] = off;
+        lens[i] = n * elem;
+        off += lens[i];
+    }
+
+    // Afterwards rank r holds the reduced segment r, which the allgather
+    // pass starts from
+    if (ring_pass((char*)buf, offs, lens, 1, elem, true, dtype, op)) return -1;
+    return ring_pass((char*)buf, offs, lens, 0, elem, false, dtype, op);
+}
+
+int CommGroup::barrier() {
+    if (size_ == 1) return 0;
+    Communicator* left = peers[mod(rank_ - 1)];
+    Communicator* right = peers[mod(rank_ + 1)];
+
+    // A token goes around the ring twice from rank 0: once it is back,
+    // everyone has arrived, and the second round lets them go
+    for (int round = 0; round < 2; round++) {
+        if (left->post_receive(scratch, 1)) return -1;
+        if (rank_ == 0 && right->send(scratch, 1) < 0) return -1;
+        if (left->recv(scratch, 1) != 1) return -1;
+        if (rank_ != 0 && right->send(scratch, 1) < 0) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef COMM_GROUP_H
+#define COMM_GROUP_H
+
+#include "communicator.h"
+#include "reduce_kernels.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Send handed to the group's sender thread
+struct CollSend {
+    Communicator* comm;
+    const char* buf;
+    size_t len;
+};
+
+// Collective operations over one connected communicator per peer, on any
+// transport. Large operations run around the ring rank -> rank + 1 and are
+// split into chunk_size pieces that are pipelined: a chunk is forwarded as
+// soon as it has arrived (and been reduced), while the next one is still in
+// flight. Sends run on a helper thread, so a rank sends to its right
+// neighbour and receives from its left one at the same time, which also
+// keeps stream transports from deadlocking on full socket buffers.
+// Receives are posted a few chunks ahead for transports that need that.
+//
+// Every rank must call the same collectives in the same order, with the
+// same sizes. The buffers are used in place: they stay in use until the
+// call returns, and on RDMA they are registered for each transfer unless
+// pinned beforehand (pin_memory, RegisteredBuffer). A failed collective
+// leaves the group unusable.
+class CommGroup {
+private:
+    int rank_;
+    int size_;
+    std::vector<Communicator*> peers;   // not owned, peers[rank_] unused
+    size_t chunk_size;
+    char* scratch;                      // RECV_DEPTH chunks for incoming data to reduce
+    bool full_mesh;                     // connected to every rank, trees are possible
+
+    std::thread sender;
+    std::mutex send_mtx;
+    std::condition_variable send_cv;
+    std::deque<CollSend> sends;
+    size_t sends_queued;
+    size_t sends_done;
+    bool send_failed;
+    bool stopping;
+
+    static const int RECV_DEPTH = 4;
+
+    int mod(int r) const { return ((r % size_) + size_) % size_; }
+    size_t chunk_bytes(size_t elem) const;
+    void enqueue_send(Communicator* comm, const char* buf, size_t len);
+    int flush_sends();
+    void sender_loop();
+    int ring_pass(char* buf, const std::vector<size_t>& offs, const std::vector<size_t>& lens, int shift,
+                  size_t elem, bool reduce, ReduceDtype dtype, ReduceOp op);
+    int chain_broadcast(char* buf, size_t len, int root);
+    int tree_broadcast(char* buf, size_t len, int root);
+
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+
+    // peers[i] is connected to rank i, for every i != rank; entries that are
+    // nullptr (all but the ring neighbours) rule out tree broadcasts
+    CommGroup(int rank, const std::vector<Communicator*>& peers, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    ~CommGroup();
+
+    CommGroup(const CommGroup&) = delete;
+    CommGroup& operator=(const CommGroup&) = delete;
+
+    int rank() const { return rank_; }
+    int size() const { return size_; }
+
+    // All return 0 on success, -1 on failure.
+    // len bytes of root's buf end up in everyone's buf: a binomial tree for
+    // messages up to one chunk, a pipelined chain otherwise
+    int broadcast(void* buf, size_t len, int root);
+    // buf holds size() blocks of len bytes, this rank's at rank() * len; on
+    // return every block is filled in
+    int allgather(void* buf, size_t len);
+    // buf holds size() blocks of count elements and is clobbered; on return
+    // block rank() is the element-wise reduction of everyone's block rank()
+    int reduce_scatter(void* buf, size_t count, ReduceDtype dtype, ReduceOp op);
+    // Ring reduce-scatter followed by a ring allgather, in place
+    int allreduce(void* buf, size_t count, ReduceDtype dtype, ReduceOp op);
+    int barrier();
+};
+
+#endif // COMM_GROUP_H
@@ -0,0 +1,147 @@
+#include "comm_stats.h"
+#include <algorithm>
+#include <cmath>
+
+static const char* const OP_NAMES[STATS_NUM_OPS] = { "send", "recv", "write", "read", "atomic" };
+
+static std::atomic<uint64_t> next_stats_id(1);
+
+// The calling thread's shard of each CommStats it recorded into, by id. The
+// weak handle expires with the CommStats, so entries of destroyed ones can be
+// dropped; last_shard is never looked up again then, as ids are not reused.
+struct LocalShard {
+    uint64_t owner;
+    void* shard;
+};
+struct LocalEntry {
+    LocalShard key;
+    std::weak_ptr<void> alive;
+};
+static thread_local LocalShard last_shard = { 0, nullptr };
+static thread_local std::vector<LocalEntry> local_shards;
+
+const char* stats_op_name(StatsOp op) {
+    return (op >= 0 && op < STATS_NUM_OPS) ? OP_NAMES[op] : "unknown";
+}
+
+uint64_t OpStatsSnapshot::latency_count() const {
+    uint64_t n = 0;
+    for (uint64_t c : latency) n += c;
+    return n;
+}
+
+uint64_t OpStatsSnapshot::latency_percentile(double q) const {
+    uint64_t n = latency_count();
+    if (n == 0) return 0;
+    q = std::min(std::max(q, 0.0), 1.0);
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * n));
+
+    uint64_t seen = 0;
+    for (int i = 0; i < LatencyBuckets::COUNT; i++) {
+        seen += latency[i];
+        if (seen < rank) continue;
+        if (i + 1 == LatencyBuckets::COUNT) return LatencyBuckets::lower(i);
+        return (LatencyBuckets::lower(i) + LatencyBuckets::lower(i + 1)) / 2;
+    }
+    return LatencyBuckets::lower(LatencyBuckets::COUNT - 1);
+}
+
+void StatsSnapshot::merge(const StatsSnapshot& other) {
+    for (int op = 0; op < STATS_NUM_OPS; op++) {
+        ops[op].ops += other.ops[op].ops;
+        ops[op].bytes += other.ops[op].bytes;
+        ops[op].errors += other.ops[op].errors;
+        for (int i = 0; i < LatencyBuckets::COUNT; i++) ops[op].latency[i] += other.ops[op].latency[i];
+    }
+    empty_polls += other.empty_polls;
+    send_outstanding += other.send_outstanding;
+    recv_outstanding += other.recv_outstanding;
+}
+
+CommStats::Shard::Shard() {
+    for (int op = 0; op < STATS_NUM_OPS; op++) {
+        ops[op].store(0, std::memory_order_relaxed);
+        bytes[op].store(0, std::memory_order_relaxed);
+        errors[op].store(0, std::memory_order_relaxed);
+        for (int i = 0; i < LatencyBuckets::COUNT; i++) latency[op][i].store(0, std::memory_order_relaxed);
+    }
+    empty_polls.store(0, std::memory_order_relaxed);
+}
+
+CommStats::CommStats() : id(next_stats_id.fetch_add(1)) {
+}
+
+CommStats::Shard* CommStats::local() {
+    // Most threads only ever record into one communicator
+    if (last_shard.owner == id) return (Shard*)last_shard.shard;
+    for (const auto& s : local_shards) {
+        if (s.key.owner == id) {
+            last_shard = s.key;
+            return (Shard*)s.key.shard;
+        }
+    }
+    return add_shard();
+}
+
+CommStats::Shard* CommStats::add_shard() {
+    std::shared_ptr<Shard> shard = std::make_shared<Shard>();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        shards.push_back(shard);
+    }
+    // Forget the shards of communicators destroyed since
+    local_shards.erase(std::remove_if(local_shards.begin(), local_shards.end(),
+                                      [](const LocalEntry& e) { return e.alive.expired(); }),
+                       local_shards.end());
+    last_shard = LocalShard{ id, shard.get() };
+    local_shards.push_back(LocalEntry{ last_shard, shard });
+    return shard.get();
+}
+
+void CommStats::record_post(StatsOp op, uint64_t ops, uint64_t bytes) {
+    Shard* s = local();
+    bump(s->ops[op], ops);
+    bump(s->bytes[op], bytes);
+}
+
+void CommStats::record_completion(StatsOp op, uint64_t post_ns, bool ok) {
+    Shard* s = local();
+    uint64_t now = now_ns();
+    bump(s->latency[op][LatencyBuckets::index(now > post_ns ? now - post_ns : 0)], 1);
+    if (!ok) bump(s->errors[op], 1);
+}
+
+void CommStats::record_recv(uint64_t bytes, bool ok) {
+    Shard* s = local();
+    bump(s->ops[STATS_RECV], 1);
+    if (ok) {
+        bump(s->bytes[STATS_RECV], bytes);
+    } else {
+        bump(s->errors[STATS_RECV], 1);
+    }
+}
+
+void CommStats::record_error(StatsOp op) {
+    bump(local()->errors[op], 1);
+}
+
+void CommStats::record_empty_poll() {
+    bump(local()->empty_polls, 1);
+}
+
+StatsSnapshot CommStats::snapshot() {
+    StatsSnapshot snap;
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto& s : shards) {
+        for (int op = 0; op < STATS_NUM_OPS; op++) {
+            snap.ops[op].ops += s->ops[op].load(std::memory_order_relaxed);
+            snap.ops[op].bytes += s->bytes[op].load(std::memory_order_relaxed);
+            snap.ops[op].errors += s->errors[op].load(std::memory_order_relaxed);
+            for (int i = 0; i < LatencyBuckets::COUNT; i++) {
+                snap.ops[op].latency[i] += s->latency[op][i].load(std::memory_order_relaxed);
+            }
+        }
+        snap.empty_polls += s->empty_polls.load(std::memory_order_relaxed);
+    }
+    return snap;
+}
@@ -0,0 +1,126 @@
+#ifndef COMM_STATS_H
+#define COMM_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum StatsOp {
+    STATS_SEND = 0,
+    STATS_RECV = 1,
+    STATS_WRITE = 2,    // includes WRITE_WITH_IMM
+    STATS_READ = 3,
+    STATS_ATOMIC = 4,
+    STATS_NUM_OPS = 5,
+};
+
+const char* stats_op_name(StatsOp op);
+
+// Log-linear latency buckets in nanoseconds, HDR-style: values below
+// SUB_BUCKETS get a bucket each, above that every power of two is split
+// into SUB_BUCKETS buckets, so a bucket is at most 1/16 of its value wide.
+// Values beyond 2^MAX_BITS ns (about 18 minutes) land in the last bucket.
+struct LatencyBuckets {
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;
+    static const int COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static int index(uint64_t ns) {
+        if (ns < (uint64_t)SUB_BUCKETS) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= MAX_BITS) return COUNT - 1;
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int)((ns >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Smallest value of a bucket; the next bucket starts where it ends
+    static uint64_t lower(int idx) {
+        if (idx < SUB_BUCKETS) return (uint64_t)idx;
+        int shift = idx / SUB_BUCKETS - 1;
+        return (uint64_t)(SUB_BUCKETS + idx % SUB_BUCKETS) << shift;
+    }
+};
+
+// Point-in-time copy of one operation type's counters
+struct OpStatsSnapshot {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t errors;
+    std::vector<uint64_t> latency;  // LatencyBuckets::COUNT counts, post to completion
+
+    OpStatsSnapshot() : ops(0), bytes(0), errors(0), latency(LatencyBuckets::COUNT, 0) {}
+
+    uint64_t latency_count() const;
+    // Latency at quantile q in [0, 1], in ns: the midpoint of the bucket
+    // holding it, 0 without samples
+    uint64_t latency_percentile(double q) const;
+};
+
+struct StatsSnapshot {
+    OpStatsSnapshot ops[STATS_NUM_OPS];
+    uint64_t empty_polls;       // CQ polls that returned no completion
+    int64_t send_outstanding;   // send queue WRs posted and not yet completed
+    int64_t recv_outstanding;   // receive WRs posted and not yet completed
+
+    StatsSnapshot() : empty_polls(0), send_outstanding(0), recv_outstanding(0) {}
+
+    // Add another snapshot in, e.g. to sum the rails of a connection
+    void merge(const StatsSnapshot& other);
+};
+
+// Counters and latency histograms of one communicator. Every thread that
+// records gets its own shard, which only it writes, so recording is a few
+// relaxed loads and stores without locks or atomic read-modify-writes;
+// snapshot() sums the shards. Shards live as long as the CommStats; a thread
+// forgets those of destroyed ones the next time it looks up a new one.
+class CommStats {
+private:
+    struct Shard {
+        std::atomic<uint64_t> ops[STATS_NUM_OPS];
+        std::atomic<uint64_t> bytes[STATS_NUM_OPS];
+        std::atomic<uint64_t> errors[STATS_NUM_OPS];
+        std::atomic<uint64_t> latency[STATS_NUM_OPS][LatencyBuckets::COUNT];
+        std::atomic<uint64_t> empty_polls;
+
+        Shard();
+    };
+
+    uint64_t id;    // never reused, unlike the address, see local()
+    std::mutex mtx; // guards shards, taken when a thread records for the first time
+    std::vector<std::shared_ptr<Shard>> shards;
+
+    Shard* local();
+    Shard* add_shard();
+
+    // Only the owning thread writes a shard
+    static void bump(std::atomic<uint64_t>& c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+public:
+    CommStats();
+    CommStats(const CommStats&) = delete;
+    CommStats& operator=(const CommStats&) = delete;
+
+    static uint64_t now_ns() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record_post(StatsOp op, uint64_t ops, uint64_t bytes);
+    void record_completion(StatsOp op, uint64_t post_ns, bool ok);
+    // A receive completes without a post time of its own
+    void record_recv(uint64_t bytes, bool ok);
+    void record_error(StatsOp op);
+    void record_empty_poll();
+
+    // Sums every shard; the gauges are left for the owner to fill in
+    StatsSnapshot snapshot();
+};
+
+#endif // COMM_STATS_H
@@ -0,0 +1,180 @@
+#include "comm_trace.h"
+#include "comm_stats.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+std::atomic<bool> trace_on(false);
+
+// A slot is written under a sequence number: 0 while being written, pos + 1
+// once event number pos is complete. A reader copies the event and keeps it
+// only if the number was the expected one before and after.
+struct TraceSlot {
+    std::atomic<uint64_t> seq;
+    TraceEvent ev;
+};
+
+struct TraceRing {
+    size_t mask;
+    std::unique_ptr<TraceSlot[]> slots;
+    std::atomic<uint64_t> head;     // next event number
+    uint64_t start;                 // first event number of the current run
+};
+
+static std::atomic<TraceRing*> trace_ring(nullptr);
+static std::mutex trace_mtx;        // start/stop/dump and the interned names
+// Replaced rings stay allocated, a writer may still be filling a slot
+static std::vector<std::unique_ptr<TraceRing>> trace_rings;
+static std::set<std::string> trace_names;
+
+static uint32_t current_tid() {
+    static thread_local uint32_t tid = 0;
+    if (!tid) tid = (uint32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+int trace_start(size_t capacity) {
+    size_t n = 1024;
+    while (n < capacity) n <<= 1;
+
+    std::lock_guard<std::mutex> lock(trace_mtx);
+    TraceRing* r = trace_ring.load();
+    if (r && r->mask + 1 == n) {
+        // Same size: older events fall outside the run
+        r->start = r->head.load();
+    } else {
+        std::unique_ptr<TraceRing> fresh(new TraceRing());
+        fresh->mask = n - 1;
+        fresh->slots.reset(new (std::nothrow) TraceSlot[n]);
+        if (!fresh->slots) return -1;
+        for (size_t i = 0; i < n; i++) fresh->slots[i].seq.store(0, std::memory_order_relaxed);
+        fresh->head.store(0);
+        fresh->start = 0;
+        trace_ring.store(fresh.get(), std::memory_order_release);
+        trace_rings.push_back(std::move(fresh));
+    }
+    trace_on.store(true);
+    return 0;
+}
+
+void trace_stop() {
+    trace_on.store(false);
+}
+
+void trace_record(TraceEventType type, const char* name, const void* scope, uint64_t id,
+                  uint64_t bytes, uint32_t qp, int32_t arg) {
+    TraceRing* r = trace_ring.load(std::memory_order_acquire);
+    if (!r) return;
+
+    uint64_t pos = r->head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot& s = r->slots[pos & r->mask];
+    s.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.ev.ts_ns = CommStats::now_ns();
+    s.ev.id = id;
+    s.ev.bytes = bytes;
+    s.ev.scope = (uintptr_t)scope;
+    s.ev.name = name;
+    s.ev.qp = qp;
+    s.ev.tid = current_tid();
+    s.ev.arg = arg;
+    s.ev.type = (uint8_t)type;
+    s.seq.store(pos + 1, std::memory_order_release);
+}
+
+const char* trace_intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(trace_mtx);
+    return trace_names.insert(name).first->c_str();
+}
+
+static void append_escaped(std::string& out, const char* s) {
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+}
+
+static void append_event(std::string& out, const TraceEvent& ev, int pid) {
+    static const char* const PHASES[] = { "b", "e", "i", "B", "E", "i" };
+    static const char* const CATEGORIES[] = { "wr", "wr", "cq", "span", "span", "span" };
+    char buf[256];
+
+    out += "{\"name\":\"";
+    append_escaped(out, ev.name ? ev.name : "");
+    snprintf(buf, sizeof(buf), "\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%u",
+             CATEGORIES[ev.type], PHASES[ev.type], (unsigned long long)(ev.ts_ns / 1000),
+             (unsigned)(ev.ts_ns % 1000), pid, ev.tid);
+    out += buf;
+
+    switch (ev.type) {
+    case TRACE_POST:
+        snprintf(buf, sizeof(buf), ",\"id\":\"0x%llx:%llu\",\"args\":{\"wr_id\":%llu,\"bytes\":%llu,\"qp\":%u}",
+                 (unsigned long long)ev.scope, (unsigned long long)ev.id, (unsigned long long)ev.id,
+                 (unsigned long long)ev.bytes, ev.qp);
+        break;
+    case TRACE_COMPLETE:
+        snprintf(buf, sizeof(buf), ",\"id\":\"0x%llx:%llu\",\"args\":{\"wr_id\":%llu,\"bytes\":%llu,\"qp\":%u,\"status\":%d}",
+                 (unsigned long long)ev.scope, (unsigned long long)ev.id, (unsigned long long)ev.id,
+                 (unsigned long long)ev.bytes, ev.qp, ev.arg);
+        break;
+    case TRACE_POLL:
+        snprintf(buf, sizeof(buf), ",\"s\":\"t\",\"args\":{\"completions\":%d}", ev.arg);
+        break;
+    case TRACE_INSTANT:
+        snprintf(buf, sizeof(buf), ",\"s\":\"t\"");
+        break;
+    default:
+        buf[0] = '\0';
+    }
+    out += buf;
+    out += '}';
+}
+
+std::string trace_json() {
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    std::lock_guard<std::mutex> lock(trace_mtx);
+    TraceRing* r = trace_ring.load();
+    if (r) {
+        int pid = (int)getpid();
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t cap = r->mask + 1;
+        uint64_t first = std::max(r->start, head > cap ? head - cap : 0);
+        bool comma = false;
+        for (uint64_t pos = first; pos < head; pos++) {
+            TraceSlot& s = r->slots[pos & r->mask];
+            if (s.seq.load(std::memory_order_acquire) != pos + 1) continue;
+            TraceEvent ev = s.ev;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Overwritten while we copied it
+            if (s.seq.load(std::memory_order_relaxed) != pos + 1) continue;
+            if (comma) out += ',';
+            append_event(out, ev, pid);
+            comma = true;
+        }
+    }
+    out += "]}\n";
+    return out;
+}
+
+int trace_dump(const char* path) {
+    std::string json = trace_json();
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+    bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    if (fclose(f)) ok = false;
+    return ok ? 0 : -1;
+}
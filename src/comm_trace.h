@@ -0,0 +1,82 @@
+#ifndef COMM_TRACE_H
+#define COMM_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum TraceEventType {
+    TRACE_POST = 0,         // work request handed to the device
+    TRACE_COMPLETE = 1,     // its completion was reaped
+    TRACE_POLL = 2,         // a CQ poll that reaped completions
+    TRACE_BEGIN = 3,        // span opened on the calling thread
+    TRACE_END = 4,
+    TRACE_INSTANT = 5,
+};
+
+// One recorded event. name must outlive the trace: a string literal or
+// the result of trace_intern().
+struct TraceEvent {
+    uint64_t ts_ns;         // CommStats::now_ns() clock
+    uint64_t id;            // wr_id for POST/COMPLETE
+    uint64_t bytes;
+    uintptr_t scope;        // communicator, so wr_ids of different ones stay apart
+    const char* name;
+    uint32_t qp;            // QP number
+    uint32_t tid;
+    int32_t arg;            // completion status, completions polled
+    uint8_t type;
+};
+
+// About 19 MB of events
+static const size_t TRACE_DEFAULT_CAPACITY = 1 << 18;
+
+// Process-wide timeline of communication events, opt-in. Events go into a
+// fixed ring that overwrites the oldest once full: writers claim a slot
+// with one atomic increment and never block or allocate. Call sites check
+// trace_enabled() first, so a disabled trace costs one relaxed load.
+//
+// The dump is Chrome trace JSON (chrome://tracing, ui.perfetto.dev): a
+// work request is an async slice from post to completion, spans are
+// slices on their thread and polls are instant events.
+
+extern std::atomic<bool> trace_on;
+
+inline bool trace_enabled() { return trace_on.load(std::memory_order_relaxed); }
+
+// Start recording into a ring of at least capacity events; events of an
+// earlier run are dropped. Returns 0 on success, -1 on failure.
+int trace_start(size_t capacity = TRACE_DEFAULT_CAPACITY);
+// Stop recording; the events stay available to dump
+void trace_stop();
+
+void trace_record(TraceEventType type, const char* name, const void* scope, uint64_t id,
+                  uint64_t bytes, uint32_t qp, int32_t arg);
+
+// Stable copy of a name built at run time, e.g. from Python
+const char* trace_intern(const std::string& name);
+
+// Events still in the ring, oldest first, as Chrome trace JSON
+std::string trace_json();
+int trace_dump(const char* path);
+
+// Span covering the scope's lifetime, if tracing was on when it opened
+class TraceScope {
+private:
+    const char* name;
+    bool active;
+
+public:
+    explicit TraceScope(const char* name) : name(name), active(trace_enabled()) {
+        if (active) trace_record(TRACE_BEGIN, name, nullptr, 0, 0, 0, 0);
+    }
+    ~TraceScope() {
+        if (active) trace_record(TRACE_END, name, nullptr, 0, 0, 0, 0);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#endif // COMM_TRACE_H
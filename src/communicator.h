@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <sys/uio.h>
 
 // Base communicator class
 class Communicator {
@@ -16,6 +17,40 @@ public:
     // Pure virtual functions for RDMA operations
     virtual int write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) = 0;
     virtual int read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) = 0;
+    
+    // Vectored variants, the iovec segments are gathered/scattered in one operation
+    virtual int sendv(const struct iovec* iov, int iovcnt) = 0;
+    virtual int recvv(const struct iovec* iov, int iovcnt) = 0;
+    virtual int writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) = 0;
+    virtual int readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) = 0;
+
+    // Hand buf to the next recv() ahead of time; transports that need a
+    // receive posted before the peer sends override it, for the others the
+    // buffer passed to recv() is enough
+    virtual int post_receive(void* /*buf*/, size_t /*len*/, size_t /*offset*/ = 0) { return 0; }
+    // Receives posted ahead whose buffers the transport may still fill;
+    // they complete in posting order
+    virtual size_t posted_receives() { return 0; }
+    // Keep memory used for many operations registered until
+    // invalidate_memory(); transports without registrations ignore it
+    virtual int pin_memory(void* /*addr*/, size_t /*len*/) { return 0; }
+    // Drop registrations before memory is freed or remapped
+    virtual void invalidate_memory(void* /*addr*/, size_t /*len*/) {}
+
+    // Memory the peer may access with write/read, and its remote key;
+    // transports without one-sided operations keep these defaults
+    virtual int set_buffer(void* /*buffer*/, size_t /*size*/) { return -1; }
+    virtual uint32_t get_rkey() { return 0; }
+
+    // 64-bit atomics on 8-byte aligned remote memory; *old receives the value
+    // before the operation. Transports without remote atomics return -1.
+    virtual int fetch_add(uint64_t /*remote_addr*/, uint32_t /*rkey*/, uint64_t /*add*/, uint64_t* /*old*/) {
+        return -1;
+    }
+    virtual int compare_swap(uint64_t /*remote_addr*/, uint32_t /*rkey*/, uint64_t /*compare*/, uint64_t /*swap*/,
+                             uint64_t* /*old*/) {
+        return -1;
+    }
 };
 
 #endif // COMMUNICATOR_H
\ No newline at end of file
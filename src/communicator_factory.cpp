@@ -0,0 +1,81 @@
+#include "communicator_factory.h"
+#include "rdma_context.h"
+#include "shm_communicator.h"
+#include "soft_rdma_communicator.h"
+#include "tcp_communicator.h"
+#include <unistd.h>
+#include <cerrno>
+
+// Tell the peer whether we can, learn whether it can; true if both can
+static int agree(int fd, bool can, bool* both) {
+    uint8_t mine = can ? 1 : 0;
+    uint8_t theirs = 0;
+    ssize_t k;
+    do {
+        k = ::write(fd, &mine, 1);
+    } while (k < 0 && errno == EINTR);
+    if (k != 1) return -1;
+    do {
+        k = ::read(fd, &theirs, 1);
+    } while (k < 0 && errno == EINTR);
+    if (k != 1) return -1;
+    *both = mine && theirs;
+    return 0;
+}
+
+std::unique_ptr<Communicator> create_communicator(int fd, bool initiator, TransportKind kind,
+                                                  const char* dev_name, int gid_index, const QPConfig& config) {
+    std::shared_ptr<RDMAContext> context;
+
+    if (kind == TRANSPORT_AUTO) {
+        int local = ShmCommunicator::peer_is_local(fd);
+        if (local < 0) return nullptr;
+        if (local) {
+            kind = TRANSPORT_SHM;
+        } else {
+            // RDMA only if the devices open on both ends
+            if (dev_name) {
+                context = std::make_shared<RDMAContext>(dev_name);
+                if (!context->valid()) context.reset();
+            }
+            bool both;
+            if (agree(fd, context != nullptr, &both)) return nullptr;
+            kind = both ? TRANSPORT_RDMA : TRANSPORT_SOFT;
+        }
+    }
+
+    switch (kind) {
+    case TRANSPORT_TCP:
+        return std::unique_ptr<Communicator>(new TCPCommunicator(fd));
+    case TRANSPORT_SOFT: {
+        std::unique_ptr<SoftRDMACommunicator> comm(new SoftRDMACommunicator(fd));
+        if (comm->connect()) return nullptr;
+        return std::unique_ptr<Communicator>(comm.release());
+    }
+    case TRANSPORT_SHM: {
+        std::unique_ptr<ShmCommunicator> comm(new ShmCommunicator(fd));
+        if (comm->connect()) return nullptr;
+        return std::unique_ptr<Communicator>(comm.release());
+    }
+    case TRANSPORT_RDMA: {
+        if (!context) {
+            if (!dev_name) return nullptr;
+            context = std::make_shared<RDMAContext>(dev_name);
+            if (!context->valid()) return nullptr;
+        }
+        std::unique_ptr<RDMACommunicator> comm(new RDMACommunicator(fd, context, gid_index, config));
+        if (initiator ? comm->connect() : comm->accept()) return nullptr;
+        return std::unique_ptr<Communicator>(comm.release());
+    }
+    default:
+        return nullptr;
+    }
+}
+
+TransportKind transport_kind(Communicator* comm) {
+    if (dynamic_cast<ShmCommunicator*>(comm)) return TRANSPORT_SHM;
+    if (dynamic_cast<RDMACommunicator*>(comm)) return TRANSPORT_RDMA;
+    if (dynamic_cast<SoftRDMACommunicator*>(comm)) return TRANSPORT_SOFT;
+    if (dynamic_cast<TCPCommunicator*>(comm)) return TRANSPORT_TCP;
+    return TRANSPORT_AUTO;
+}
@@ -0,0 +1,27 @@
+#ifndef COMMUNICATOR_FACTORY_H
+#define COMMUNICATOR_FACTORY_H
+
+#include "communicator.h"
+#include "rdma_communicator.h"
+#include <memory>
+
+enum TransportKind {
+    TRANSPORT_AUTO = 0,     // shared memory if the peer is local, else RDMA if both sides can, else soft
+    TRANSPORT_TCP = 1,      // plain TCPCommunicator, two-sided only
+    TRANSPORT_SOFT = 2,     // SoftRDMACommunicator
+    TRANSPORT_RDMA = 3,     // RDMACommunicator on dev_name
+    TRANSPORT_SHM = 4,      // ShmCommunicator
+};
+
+// Create a connected communicator over a connected socket. Both sides call
+// it with the same kind; with TRANSPORT_AUTO they agree on one over the
+// socket first. initiator picks RDMA's connect() over accept() and must be
+// set on exactly one side. Returns nullptr on failure.
+std::unique_ptr<Communicator> create_communicator(int fd, bool initiator, TransportKind kind = TRANSPORT_AUTO,
+                                                  const char* dev_name = nullptr, int gid_index = 0,
+                                                  const QPConfig& config = QPConfig());
+
+// The transport behind a communicator from create_communicator()
+TransportKind transport_kind(Communicator* comm);
+
+#endif // COMMUNICATOR_FACTORY_H
@@ -0,0 +1,199 @@
+#include "mr_cache.h"
+#include <unistd.h>
+#include <cstdint>
+
+static uintptr_t page_size() {
+    static const uintptr_t ps = (uintptr_t)sysconf(_SC_PAGESIZE);
+    return ps;
+}
+
+MRCache::MRCache(ibv_pd* pd, size_t max_entries, size_t max_bytes) :
+    pd(pd), max_entries(max_entries), max_bytes(max_bytes), idle_entries(0), idle_bytes(0), max_len(0) {
+}
+
+MRCache::~MRCache() {
+    for (auto& e : entries) {
+        ibv_dereg_mr(e.mr);
+    }
+}
+
+MRCache::EntryIter MRCache::find(uintptr_t start, uintptr_t end, int access) {
+    // Candidates start at or before `start`; none starting before
+    // end - max_len can be long enough to cover the range
+    auto it = index.upper_bound(Range(start, UINTPTR_MAX));
+    while (it != index.begin()) {
+        --it;
+        if (it->first.first + max_len < end) break;
+        EntryIter e = it->second;
+        if (e->end >= end && (e->access & access) == access) {
+            entries.splice(entries.begin(), entries, e);
+            return e;
+        }
+    }
+    return entries.end();
+}
+
+MRCache::EntryIter MRCache::insert(uintptr_t start, uintptr_t end, int access) {
+    uintptr_t ps = page_size();
+    start &= ~(ps - 1);
+    end = (end + ps - 1) & ~(ps - 1);
+
+    int granted = ATOMIC_ACCESS;
+    ibv_mr* mr = ibv_reg_mr(pd, (void*)start, end - start, granted);
+    if (!mr) {
+        // The device may not do atomics
+        granted = DEFAULT_ACCESS;
+        mr = ibv_reg_mr(pd, (void*)start, end - start, granted);
+    }
+    if (!mr) {
+        // Read-only memory (e.g. Python bytes) can still be a send source
+        granted = 0;
+        mr = ibv_reg_mr(pd, (void*)start, end - start, granted);
+    }
+    if (!mr) return entries.end();
+    if ((granted & access) != access) {
+        ibv_dereg_mr(mr);
+        return entries.end();
+    }
+
+    // A region of the same range with less access gives up its slot
+    auto ix = index.find(Range(start, end));
+    if (ix != index.end()) {
+        EntryIter old = ix->second;
+        if (idle(*old)) erase(old);
+        else unindex(old);
+    }
+
+    Entry e;
+    e.start = start;
+    e.end = end;
+    e.mr = mr;
+    e.access = granted;
+    e.pins = 0;
+    e.users = 0;
+    e.indexed = true;
+    entries.push_front(e);
+    index[Range(start, end)] = entries.begin();
+    by_mr[mr] = entries.begin();
+    if (end - start > max_len) max_len = end - start;
+    // Idle until the caller takes it
+    idle_entries++;
+    idle_bytes += end - start;
+    return entries.begin();
+}
+
+void MRCache::take(EntryIter it) {
+    // An idle cached region is about to be used again
+    if (it->indexed && idle(*it)) {
+        idle_entries--;
+        idle_bytes -= it->end - it->start;
+    }
+}
+
+void MRCache::unindex(EntryIter it) {
+    if (!it->indexed) return;
+    take(it);
+    it->indexed = false;
+    auto ix = index.find(Range(it->start, it->end));
+    if (ix != index.end() && ix->second == it) index.erase(ix);
+}
+
+void MRCache::erase(EntryIter it) {
+    unindex(it);
+    by_mr.erase(it->mr);
+    ibv_dereg_mr(it->mr);
+    entries.erase(it);
+}
+
+void MRCache::put(EntryIter it) {
+    if (!idle(*it)) return;
+    // Invalidated memory goes as soon as nothing holds it any more
+    if (!it->indexed) {
+        erase(it);
+        return;
+    }
+    idle_entries++;
+    idle_bytes += it->end - it->start;
+    entries.splice(entries.begin(), entries, it);
+    evict();
+}
+
+void MRCache::evict() {
+    // Walk from the least recently used end; regions pinned or in use stay
+    auto it = entries.end();
+    while (it != entries.begin() &&
+           (idle_entries > max_entries || (max_bytes && idle_bytes > max_bytes))) {
+        --it;
+        if (!it->indexed || !idle(*it)) continue;
+        EntryIter victim = it++;
+        erase(victim);
+    }
+}
+
+ibv_mr* MRCache::pin(const void* addr, size_t len, int access) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + (len ? len : 1);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    EntryIter e = find(start, end, access);
+    if (e == entries.end()) {
+        e = insert(start, end, access);
+        if (e == entries.end()) return nullptr;
+    }
+    take(e);
+    e->pins++;
+    return e->mr;
+}
+
+void MRCache::unpin(ibv_mr* mr) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = by_mr.find(mr);
+    if (it == by_mr.end() || it->second->pins == 0) return;
+    it->second->pins--;
+    put(it->second);
+}
+
+ibv_mr* MRCache::acquire(const void* addr, size_t len, int access) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + (len ? len : 1);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    EntryIter e = find(start, end, access);
+    if (e == entries.end()) {
+        e = insert(start, end, access);
+        if (e == entries.end()) return nullptr;
+    }
+    take(e);
+    e->users++;
+    return e->mr;
+}
+
+void MRCache::release(ibv_mr* mr) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = by_mr.find(mr);
+    if (it == by_mr.end() || it->second->users == 0) return;
+    it->second->users--;
+    put(it->second);
+}
+
+void MRCache::invalidate(const void* addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + (len ? len : 1);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    uintptr_t lo = start > max_len ? start - max_len : 0;
+    auto it = index.lower_bound(Range(lo, 0));
+    while (it != index.end() && it->first.first < end) {
+        EntryIter e = it->second;
+        ++it;
+        if (e->end <= start) continue;
+        // Regions still pinned or in use go with their last unpin/release
+        if (idle(*e)) erase(e);
+        else unindex(e);
+    }
+}
+
+size_t MRCache::size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return entries.size();
+}
@@ -0,0 +1,89 @@
+#ifndef MR_CACHE_H
+#define MR_CACHE_H
+
+#include <infiniband/verbs.h>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Registrations of one protection domain, keyed by address range.
+// Memory declared long-lived with pin() stays registered until unpin():
+// set_buffer(), expose_memory(), RegisteredBuffer and BufferPool memory.
+// Work requests take their registrations with acquire() and hand them back
+// with release() once they completed; released regions stay cached for the
+// next operation on the same memory and are evicted in LRU order once the
+// entry or byte limits are exceeded.
+//
+// A registration is never deregistered while it is pinned or acquired by a
+// work request in flight. invalidate() must be called before memory is freed
+// or remapped: it deregisters idle regions overlapping it at once and the
+// others with their last unpin()/release().
+class MRCache {
+private:
+    struct Entry {
+        uintptr_t start;
+        uintptr_t end;
+        ibv_mr* mr;
+        int access;
+        int pins;       // pin() calls not yet undone by unpin()
+        int users;      // work requests in flight, see acquire()
+        bool indexed;   // found by lookups
+    };
+
+    typedef std::list<Entry>::iterator EntryIter;
+    typedef std::pair<uintptr_t, uintptr_t> Range;
+
+    ibv_pd* pd;
+    size_t max_entries;     // of idle regions, neither pinned nor in use
+    size_t max_bytes;       // 0 means unlimited
+    size_t idle_entries;
+    size_t idle_bytes;
+    size_t max_len;         // longest indexed region, bounds the interval scan
+    std::list<Entry> entries;                       // most recently used first
+    std::map<Range, EntryIter> index;
+    std::unordered_map<ibv_mr*, EntryIter> by_mr;   // every live registration
+    std::mutex mtx;
+
+    static bool idle(const Entry& e) { return e.pins == 0 && e.users == 0; }
+
+    EntryIter find(uintptr_t start, uintptr_t end, int access);
+    EntryIter insert(uintptr_t start, uintptr_t end, int access);
+    void take(EntryIter it);
+    void unindex(EntryIter it);
+    void erase(EntryIter it);
+    void put(EntryIter it);
+    void evict();
+
+public:
+    static const int DEFAULT_ACCESS = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ;
+    // Tried first, so registered memory can also be the target of atomics
+    static const int ATOMIC_ACCESS = DEFAULT_ACCESS | IBV_ACCESS_REMOTE_ATOMIC;
+
+    MRCache(ibv_pd* pd, size_t max_entries = 64, size_t max_bytes = 0);
+    ~MRCache();
+
+    // Register [addr, addr + len) for reuse, or share a cached region
+    // covering it with at least the given access flags; it stays registered
+    // until unpin(). nullptr on failure.
+    ibv_mr* pin(const void* addr, size_t len, int access = 0);
+    void unpin(ibv_mr* mr);
+
+    // MR for one work request, cached or registered on a miss. Hand it back
+    // with release() once the WR completed or failed to post. nullptr on
+    // failure.
+    ibv_mr* acquire(const void* addr, size_t len, int access = 0);
+    void release(ibv_mr* mr);
+
+    // Stop handing out regions overlapping [addr, addr + len); call before
+    // the memory is freed or remapped
+    void invalidate(const void* addr, size_t len);
+
+    // Live registrations, cached, pinned or in use
+    size_t size();
+};
+
+#endif // MR_CACHE_H
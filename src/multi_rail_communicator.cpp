@@ -0,0 +1,331 @@
+#include "multi_rail_communicator.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+// NUMA node backing addr, -1 if unknown
+static int buffer_node(const void* addr) {
+    int node = -1;
+    // get_mempolicy(MPOL_F_NODE | MPOL_F_ADDR), without a libnuma dependency
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, 3) != 0) return -1;
+    return node;
+}
+
+MultiRailCommunicator::MultiRailCommunicator(int fd, const std::vector<std::pair<std::string, int>>& rail_list,
+                                             int gid_index, const QPConfig& config) :
+    socket_fd(fd), numa_aware(true), next_rail(0), posted_recvs(0) {
+    std::vector<std::pair<std::string, int>> specs = rail_list.empty() ? discover_rails() : rail_list;
+    if (specs.empty()) die("No active RDMA ports");
+
+    for (const auto& spec : specs) {
+        Rail rail;
+        rail.context = std::make_shared<RDMAContext>(spec.first.c_str(), spec.second);
+        if (!rail.context->valid()) die("Failed to open rail");
+        rail.comm.reset(new RDMACommunicator(fd, rail.context, gid_index, config));
+        double gbps = rail.context->get_link_gbps();
+        rail.weight = gbps > 0 ? gbps : 1.0;
+        rail.healthy = true;
+        rails.push_back(std::move(rail));
+    }
+}
+
+std::vector<std::pair<std::string, int>> MultiRailCommunicator::discover_rails() {
+    std::vector<std::pair<std::string, int>> out;
+    int num;
+    ibv_device** dev_list = ibv_get_device_list(&num);
+    if (!dev_list) return out;
+
+    for (int i = 0; i < num; i++) {
+        ibv_context* ctx = ibv_open_device(dev_list[i]);
+        if (!ctx) continue;
+        ibv_device_attr dev_attr{};
+        if (ibv_query_device(ctx, &dev_attr) == 0) {
+            for (int port = 1; port <= dev_attr.phys_port_cnt; port++) {
+                ibv_port_attr port_attr{};
+                if (ibv_query_port(ctx, port, &port_attr) == 0 && port_attr.state == IBV_PORT_ACTIVE) {
+                    out.push_back(std::make_pair(std::string(ibv_get_device_name(dev_list[i])), port));
+                }
+            }
+        }
+        ibv_close_device(ctx);
+    }
+    ibv_free_device_list(dev_list);
+    return out;
+}
+
+int MultiRailCommunicator::connect() {
+    for (auto& rail : rails) {
+        if (rail.comm->connect()) return -1;
+    }
+    return 0;
+}
+
+int MultiRailCommunicator::accept() {
+    for (auto& rail : rails) {
+        if (rail.comm->accept()) return -1;
+    }
+    return 0;
+}
+
+int MultiRailCommunicator::set_buffer(void* buffer, size_t size) {
+    for (auto& rail : rails) {
+        if (rail.comm->set_buffer(buffer, size)) return -1;
+    }
+    return 0;
+}
+
+int MultiRailCommunicator::expose_memory(void* addr, size_t len) {
+    for (auto& rail : rails) {
+        if (rail.comm->expose_memory(addr, len)) return -1;
+    }
+    return 0;
+}
+
+int MultiRailCommunicator::control_rail() {
+    for (size_t r = 0; r < rails.size(); r++) {
+        if (rails[r].healthy) return (int)r;
+    }
+    return -1;
+}
+
+void MultiRailCommunicator::fail_rail(size_t r) {
+    rails[r].healthy = false;
+}
+
+RDMACommunicator* MultiRailCommunicator::message_rail() {
+    // Messages never move to another rail, see the class comment
+    return rails[0].healthy ? rails[0].comm.get() : nullptr;
+}
+
+int MultiRailCommunicator::post_receive(void* buf, size_t len, size_t offset) {
+    RDMACommunicator* comm = message_rail();
+    if (!comm) return -1;
+    if (comm->post_receive(buf, len, offset)) {
+        fail_rail(0);
+        return -1;
+    }
+    posted_recvs++;
+    return 0;
+}
+
+int MultiRailCommunicator::pin_memory(void* addr, size_t len) {
+    for (auto& r : rails) {
+        if (r.comm->pin_memory(addr, len)) return -1;
+    }
+    return 0;
+}
+
+void MultiRailCommunicator::invalidate_memory(void* addr, size_t len) {
+    // Every rail has a registration cache of its own
+    for (auto& r : rails) r.comm->invalidate_memory(addr, len);
+}
+
+int MultiRailCommunicator::send(const void* buf, size_t len, size_t offset) {
+    RDMACommunicator* comm = message_rail();
+    if (!comm) return -1;
+    int ret = comm->send(buf, len, offset);
+    if (ret < 0) fail_rail(0);
+    return ret;
+}
+
+int MultiRailCommunicator::recv(void* buf, size_t len, size_t offset) {
+    RDMACommunicator* comm = message_rail();
+    if (!comm || posted_recvs == 0) return -1;
+    int ret = comm->recv(buf, len, offset);
+    if (ret < 0) {
+        fail_rail(0);
+        return -1;
+    }
+    posted_recvs--;
+    return ret;
+}
+
+int MultiRailCommunicator::sendv(const struct iovec* iov, int iovcnt) {
+    RDMACommunicator* comm = message_rail();
+    if (!comm) return -1;
+    int ret = comm->sendv(iov, iovcnt);
+    if (ret < 0) fail_rail(0);
+    return ret;
+}
+
+int MultiRailCommunicator::recvv(const struct iovec* iov, int iovcnt) {
+    // Post and complete in one call; earlier receives are completed first
+    RDMACommunicator* comm = message_rail();
+    if (!comm || posted_recvs > 0) return -1;
+    int ret = comm->post_receivev(iov, iovcnt);
+    if (ret == 0) ret = comm->recvv(iov, iovcnt);
+    if (ret < 0) fail_rail(0);
+    return ret;
+}
+
+bool MultiRailCommunicator::resolve_rkey(size_t r, uint64_t remote_addr, size_t len, uint32_t rkey, uint32_t* out) {
+    for (const auto& d : rails[r].comm->get_peer_regions()) {
+        if (d.addr <= remote_addr && remote_addr + len <= d.addr + d.len) {
+            *out = d.rkey;
+            return true;
+        }
+    }
+    // Ranges the peer did not advertise are only reachable with the caller's rkey
+    if (r == 0) {
+        *out = rkey;
+        return true;
+    }
+    return false;
+}
+
+int MultiRailCommunicator::atomic_op(bool cas, uint64_t remote_addr, uint32_t rkey, uint64_t compare_add,
+                                     uint64_t swap, uint64_t* old) {
+    // Caller errors must not take the rail out of service
+    if (remote_addr % 8) return -1;
+    int c = control_rail();
+    uint32_t key;
+    if (c < 0 || !resolve_rkey(c, remote_addr, sizeof(uint64_t), rkey, &key)) return -1;
+    RDMACommunicator* comm = rails[c].comm.get();
+    int ret = cas ? comm->compare_swap(remote_addr, key, compare_add, swap, old)
+                  : comm->fetch_add(remote_addr, key, compare_add, old);
+    if (ret < 0 && comm->atomics_supported()) fail_rail(c);
+    return ret;
+}
+
+int MultiRailCommunicator::fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) {
+    return atomic_op(false, remote_addr, rkey, add, 0, old);
+}
+
+int MultiRailCommunicator::compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap,
+                                        uint64_t* old) {
+    return atomic_op(true, remote_addr, rkey, compare, swap, old);
+}
+
+int MultiRailCommunicator::transfer(bool is_read, char* local, size_t len, uint64_t remote_addr, uint32_t rkey) {
+    struct Piece {
+        size_t off;
+        size_t len;
+    };
+    struct Posted {
+        size_t rail;
+        int64_t req;
+        Piece piece;
+    };
+
+    int node = numa_aware ? buffer_node(local) : -1;
+    std::vector<uint32_t> keys(rails.size());
+    std::vector<Piece> work(1, Piece{ 0, len });
+
+    while (!work.empty()) {
+        // Healthy rails that reach the remote range, NUMA-local ones if any
+        std::vector<size_t> use;
+        bool have_local = false;
+        for (size_t r = 0; r < rails.size(); r++) {
+            if (!rails[r].healthy || !resolve_rkey(r, remote_addr, len, rkey, &keys[r])) continue;
+            use.push_back(r);
+            if (node >= 0 && rails[r].context->get_numa_node() == node) have_local = true;
+        }
+        if (have_local) {
+            use.erase(std::remove_if(use.begin(), use.end(), [&](size_t r) {
+                return rails[r].context->get_numa_node() != node;
+            }), use.end());
+        }
+        if (use.empty()) return -1;
+
+        double total_weight = 0;
+        for (size_t r : use) total_weight += rails[r].weight;
+
+        // Split each piece by link rate; pieces too small to split take one rail
+        std::vector<Posted> posted;
+        std::vector<Piece> retry;
+        for (const Piece& piece : work) {
+            std::vector<std::pair<size_t, Piece>> parts;
+            if (piece.len < MIN_RAIL_CHUNK * use.size()) {
+                parts.push_back(std::make_pair(use[next_rail++ % use.size()], piece));
+            } else {
+                size_t pos = 0;
+                for (size_t i = 0; i < use.size() && pos < piece.len; i++) {
+                    size_t share = piece.len - pos;
+                    if (i + 1 < use.size()) {
+                        share = (size_t)(piece.len * (rails[use[i]].weight / total_weight));
+                        share = std::min(share / RAIL_ALIGN * RAIL_ALIGN, piece.len - pos);
+                    }
+                    if (share == 0) continue;
+                    parts.push_back(std::make_pair(use[i], Piece{ piece.off + pos, share }));
+                    pos += share;
+                }
+            }
+
+            for (const auto& part : parts) {
+                size_t r = part.first;
+                const Piece& p = part.second;
+                int64_t req = is_read ?
+                    rails[r].comm->post_read(local + p.off, p.len, remote_addr + p.off, keys[r]) :
+                    rails[r].comm->post_write(local + p.off, p.len, remote_addr + p.off, keys[r]);
+                if (req < 0) {
+                    fail_rail(r);
+                    retry.push_back(p);
+                    continue;
+                }
+                posted.push_back(Posted{ r, req, p });
+            }
+        }
+
+        // Failed shares go around again on the rails that are left
+        for (const Posted& p : posted) {
+            if (rails[p.rail].comm->wait(p.req) < 0) {
+                fail_rail(p.rail);
+                retry.push_back(p.piece);
+            }
+        }
+        work.swap(retry);
+    }
+    return 0;
+}
+
+int MultiRailCommunicator::write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    return transfer(false, (char*)local_buf + offset, len, remote_addr + offset, rkey);
+}
+
+int MultiRailCommunicator::read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    return transfer(true, (char*)local_buf + offset, len, remote_addr + offset, rkey);
+}
+
+int MultiRailCommunicator::writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    // Segments land back to back at remote_addr
+    for (int i = 0; i < iovcnt; i++) {
+        if (transfer(false, (char*)iov[i].iov_base, iov[i].iov_len, remote_addr, rkey)) return -1;
+        remote_addr += iov[i].iov_len;
+    }
+    return 0;
+}
+
+int MultiRailCommunicator::readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    for (int i = 0; i < iovcnt; i++) {
+        if (transfer(true, (char*)iov[i].iov_base, iov[i].iov_len, remote_addr, rkey)) return -1;
+        remote_addr += iov[i].iov_len;
+    }
+    return 0;
+}
+
+std::vector<RailStatus> MultiRailCommunicator::get_rail_status() {
+    std::vector<RailStatus> out;
+    for (const auto& rail : rails) {
+        RailStatus st;
+        st.device = rail.context->get_device_name();
+        st.port = rail.context->get_port();
+        st.gbps = rail.context->get_link_gbps();
+        st.numa_node = rail.context->get_numa_node();
+        st.healthy = rail.healthy;
+        out.push_back(st);
+    }
+    return out;
+}
+
+StatsSnapshot MultiRailCommunicator::get_stats() {
+    StatsSnapshot out;
+    for (const auto& rail : rails) out.merge(rail.comm->get_stats());
+    return out;
+}
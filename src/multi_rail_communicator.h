@@ -0,0 +1,111 @@
+#ifndef MULTI_RAIL_COMMUNICATOR_H
+#define MULTI_RAIL_COMMUNICATOR_H
+
+#include "communicator.h"
+#include "rdma_communicator.h"
+#include "rdma_context.h"
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One device port and the connection to the peer over it
+struct Rail {
+    std::shared_ptr<RDMAContext> context;
+    std::unique_ptr<RDMACommunicator> comm;
+    double weight;      // link rate in Gb/s
+    bool healthy;       // cleared once an operation on the rail failed
+};
+
+// State of a rail as reported to callers
+struct RailStatus {
+    std::string device;
+    int port;
+    double gbps;
+    int numa_node;
+    bool healthy;
+};
+
+// Communicator over several HCAs/ports to the same peer. RDMA WRITE/READ
+// are striped across the rails in proportion to their link rates,
+// preferring rails on the NUMA node of the local buffer. A rail whose
+// operation fails is taken out of service and its WRITE/READ share is
+// redone on the remaining rails.
+//
+// SEND/RECV stay on the first rail so messages keep their order, and do not
+// fail over: the peer cannot tell which messages of a failed rail arrived or
+// which receives it still has posted there. Once SEND/RECV fail, every
+// later one fails as well and the connection must be rebuilt.
+//
+// Both sides must open the same number of rails: the connections are set
+// up rail by rail, in order, over the one socket.
+class MultiRailCommunicator : public Communicator {
+private:
+    int socket_fd;
+    std::vector<Rail> rails;
+    bool numa_aware;
+    size_t next_rail;   // spreads transfers too small to split
+    size_t posted_recvs;    // receives posted on the message rail, not yet completed
+
+    static const size_t MIN_RAIL_CHUNK = 64 * 1024;
+    static const size_t RAIL_ALIGN = 4096;
+
+    int control_rail();
+    void fail_rail(size_t r);
+    RDMACommunicator* message_rail();
+    bool resolve_rkey(size_t r, uint64_t remote_addr, size_t len, uint32_t rkey, uint32_t* out);
+    int atomic_op(bool cas, uint64_t remote_addr, uint32_t rkey, uint64_t compare_add, uint64_t swap, uint64_t* old);
+    int transfer(bool is_read, char* local, size_t len, uint64_t remote_addr, uint32_t rkey);
+
+public:
+    // rails: (device, port) pairs; empty to use every active port
+    MultiRailCommunicator(int fd, const std::vector<std::pair<std::string, int>>& rails,
+                          int gid_index = 0, const QPConfig& config = QPConfig());
+    ~MultiRailCommunicator() = default;
+
+    // Every (device, port) pair with an active port
+    static std::vector<std::pair<std::string, int>> discover_rails();
+
+    // Connect every rail in order, see RDMACommunicator::connect()/accept()
+    int connect();
+    int accept();
+
+    // Register memory on every rail, so the peer can reach it over any of them
+    int set_buffer(void* buffer, size_t size) override;
+    int expose_memory(void* addr, size_t len);
+
+    // Receives go to the message rail, the first one
+    int post_receive(void* buf, size_t len, size_t offset = 0) override;
+    size_t posted_receives() override { return posted_recvs; }
+    int pin_memory(void* addr, size_t len) override;
+    void invalidate_memory(void* addr, size_t len) override;
+
+    int send(const void* buf, size_t len, size_t offset = 0) override;
+    int recv(void* buf, size_t len, size_t offset = 0) override;
+
+    // rkey may be that of any rail: each rail uses the rkey the peer
+    // advertised for the range on that rail
+    int write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
+    int read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
+
+    int sendv(const struct iovec* iov, int iovcnt) override;
+    int recvv(const struct iovec* iov, int iovcnt) override;
+    int writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+    int readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+
+    // Atomics go to the control rail only: an HCA serializes atomics it
+    // executes itself, not those arriving through another device. A failed
+    // atomic may have executed, so it is not repeated on another rail.
+    int fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) override;
+    int compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap, uint64_t* old) override;
+
+    void set_numa_aware(bool on) { numa_aware = on; }
+    std::vector<RailStatus> get_rail_status();
+    // Counters of every rail added up, see RDMACommunicator::get_stats()
+    StatsSnapshot get_stats();
+    size_t get_num_rails() { return rails.size(); }
+    uint32_t get_rkey() override { return rails.empty() ? 0 : rails[0].comm->get_rkey(); }
+    int get_fd() { return socket_fd; }
+};
+
+#endif // MULTI_RAIL_COMMUNICATOR_H
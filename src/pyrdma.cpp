@@ -3,65 +3,1201 @@
 #include "communicator.h"
 #include "tcp_communicator.h"
 #include "rdma_communicator.h"
+#include "multi_rail_communicator.h"
+#include "soft_rdma_communicator.h"
+#include "shm_communicator.h"
+#include "communicator_factory.h"
+#include "buffer_pool.h"
+#include "remote_sync.h"
+#include "comm_group.h"
+#include "comm_trace.h"
+#include "registered_buffer.h"
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 namespace py = pybind11;
 
+// (local_offset, remote_addr, len) tuples from Python
+typedef std::vector<std::tuple<size_t, uint64_t, size_t>> BatchList;
+
+static std::vector<RDMABatchEntry> to_batch(const BatchList& list) {
+    std::vector<RDMABatchEntry> entries;
+    entries.reserve(list.size());
+    for (const auto& t : list) {
+        RDMABatchEntry e;
+        e.local_offset = std::get<0>(t);
+        e.remote_addr = std::get<1>(t);
+        e.len = std::get<2>(t);
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+// Minimal DLPack ABI (dlpack.h), enough to borrow a CPU tensor
+struct DLDevice {
+    int32_t device_type;
+    int32_t device_id;
+};
+
+struct DLDataType {
+    uint8_t code;
+    uint8_t bits;
+    uint16_t lanes;
+};
+
+struct DLTensor {
+    void* data;
+    DLDevice device;
+    int32_t ndim;
+    DLDataType dtype;
+    int64_t* shape;
+    int64_t* strides;   // in elements, nullptr for compact row-major
+    uint64_t byte_offset;
+};
+
+struct DLManagedTensor {
+    DLTensor dl_tensor;
+    void* manager_ctx;
+    void (*deleter)(DLManagedTensor* self);
+};
+
+static const int32_t DL_CPU = 1;
+static const int32_t DL_CUDA_HOST = 3;
+
+// Memory of a Python object for the length of one call: a RegisteredBuffer,
+// any C-contiguous buffer-protocol object (bytearray, memoryview, NumPy
+// array) or a CPU tensor exporting __dlpack__. Must be destroyed with the
+// GIL held, so declare it before any gil_scoped_release.
+class BufferRef {
+private:
+    Py_buffer view;
+    bool has_view;
+    py::object keep;    // registered buffer or DLPack capsule
+
+    void from_dlpack(const py::handle& obj);
+
+public:
+    void* ptr;
+    size_t size;
+
+    BufferRef(const py::handle& obj, bool writable);
+    ~BufferRef() {
+        if (has_view) PyBuffer_Release(&view);
+    }
+
+    BufferRef(const BufferRef&) = delete;
+    BufferRef& operator=(const BufferRef&) = delete;
+
+    // Reject [offset, offset + len) if it runs past the end
+    void check(size_t offset, size_t len) const {
+        if (offset > size || len > size - offset) {
+            throw py::index_error("Range [" + std::to_string(offset) + ", +" + std::to_string(len) +
+                                  ") is outside a buffer of " + std::to_string(size) + " bytes");
+        }
+    }
+    void check(const BatchList& entries) const {
+        for (const auto& t : entries) check(std::get<0>(t), std::get<2>(t));
+    }
+};
+
+// pyrdma.RegisteredBuffer: the memory of a Python object pinned in the MR
+// cache until released, with its pointer and length resolved once
+struct PyRegisteredBuffer {
+    // Destroyed bottom up: unpin, then unexport, then let the cache go
+    py::object owner;                   // communicator or context of the cache
+    std::unique_ptr<BufferRef> source;  // keeps the memory exported
+    std::unique_ptr<RegisteredBuffer> buf;
+    bool readonly;
+
+    void release() {
+        buf.reset();
+        source.reset();
+        owner = py::none();
+    }
+};
+
+BufferRef::BufferRef(const py::handle& obj, bool writable) : has_view(false), ptr(nullptr), size(0) {
+    if (py::isinstance<PyRegisteredBuffer>(obj)) {
+        PyRegisteredBuffer& rb = obj.cast<PyRegisteredBuffer&>();
+        if (!rb.buf) throw py::value_error("RegisteredBuffer already released");
+        if (writable && rb.readonly) throw py::value_error("RegisteredBuffer is read-only");
+        keep = py::reinterpret_borrow<py::object>(obj);
+        ptr = rb.buf->data();
+        size = rb.buf->size();
+        return;
+    }
+    if (!PyObject_CheckBuffer(obj.ptr()) && py::hasattr(obj, "__dlpack__")) {
+        from_dlpack(obj);
+        return;
+    }
+    int flags = PyBUF_C_CONTIGUOUS | (writable ? PyBUF_WRITABLE : 0);
+    if (PyObject_GetBuffer(obj.ptr(), &view, flags) != 0) throw py::error_already_set();
+    has_view = true;
+    ptr = view.buf;
+    size = (size_t)view.len;
+}
+
+void BufferRef::from_dlpack(const py::handle& obj) {
+    // Borrow without consuming: the capsule keeps its name, so its own
+    // destructor still frees the tensor once we drop it
+    py::object capsule = obj.attr("__dlpack__")();
+    DLManagedTensor* mt = (DLManagedTensor*)PyCapsule_GetPointer(capsule.ptr(), "dltensor");
+    if (!mt) throw py::error_already_set();
+    const DLTensor& t = mt->dl_tensor;
+    if (t.device.device_type != DL_CPU && t.device.device_type != DL_CUDA_HOST) {
+        throw py::value_error("DLPack tensor is not in host memory");
+    }
+
+    size_t elem = ((size_t)t.dtype.bits * t.dtype.lanes + 7) / 8;
+    size_t count = 1;
+    for (int32_t i = 0; i < t.ndim; i++) count *= (size_t)t.shape[i];
+    if (t.strides && count > 1) {
+        int64_t expect = 1;
+        for (int32_t i = t.ndim - 1; i >= 0; i--) {
+            if (t.shape[i] != 1 && t.strides[i] != expect) throw py::value_error("DLPack tensor is not contiguous");
+            expect *= t.shape[i];
+        }
+    }
+    keep = capsule;
+    ptr = (char*)t.data + t.byte_offset;
+    size = count * elem;
+}
+
+// Build iovecs over a list of Python buffers; refs keep the buffers exported
+static std::vector<struct iovec> to_iov(const std::vector<py::object>& bufs,
+                                        std::vector<std::unique_ptr<BufferRef>>& refs, bool writable) {
+    std::vector<struct iovec> iov;
+    refs.reserve(bufs.size());
+    iov.reserve(bufs.size());
+    for (const auto& b : bufs) {
+        refs.emplace_back(new BufferRef(b, writable));
+        struct iovec v;
+        v.iov_base = refs.back()->ptr;
+        v.iov_len = refs.back()->size;
+        iov.push_back(v);
+    }
+    return iov;
+}
+
+typedef std::vector<std::unique_ptr<BufferRef>> BufferRefs;
+
+static BufferRefs one_ref(const py::handle& obj, bool writable) {
+    BufferRefs refs;
+    refs.emplace_back(new BufferRef(obj, writable));
+    return refs;
+}
+
+// Buffers of operations a communicator still has posted, so Python cannot
+// free them under the transport: requests by handle until wait(), test() or
+// process_events() sees them complete, receives in posting order until the
+// transport stops counting them. An entry goes away with its Python
+// communicator, after the C++ destructor tore the connection down. Only
+// touched with the GIL held; never freed, as BufferRefs need the interpreter.
+struct HeldBuffers {
+    std::unordered_map<int64_t, BufferRefs> requests;
+    std::deque<BufferRefs> receives;
+};
+static std::unordered_map<const Communicator*, HeldBuffers>& held_buffers =
+    *new std::unordered_map<const Communicator*, HeldBuffers>();
+
+static HeldBuffers& held_for(Communicator& comm) {
+    const Communicator* key = &comm;
+    auto it = held_buffers.find(key);
+    if (it != held_buffers.end()) return it->second;
+    // Like py::keep_alive, the weakref stays alive until its callback ran
+    py::cpp_function drop([key](py::handle wr) {
+        held_buffers.erase(key);
+        wr.dec_ref();
+    });
+    py::weakref wr(py::cast(&comm, py::return_value_policy::reference), drop);
+    (void)wr.release();
+    return held_buffers[key];
+}
+
+// Post with the GIL released; the buffers are held until the request completes
+template <typename F>
+static int64_t post_held(Communicator& comm, BufferRefs refs, F post) {
+    int64_t req;
+    {
+        py::gil_scoped_release release;
+        req = post();
+    }
+    if (req > 0) held_for(comm).requests[req] = std::move(refs);
+    return req;
+}
+
+// Receives are posted with the GIL held, which keeps the held buffers in
+// posting order; posting never blocks
+template <typename F>
+static int post_receive_held(Communicator& comm, BufferRefs refs, F post) {
+    size_t before = comm.posted_receives();
+    int ret = post();
+    // A receive that failed part way may still have chunks posted
+    if (ret == 0 || comm.posted_receives() > before) held_for(comm).receives.push_back(std::move(refs));
+    return ret;
+}
+
+static void release_request(Communicator& comm, int64_t req) {
+    auto it = held_buffers.find(&comm);
+    if (it != held_buffers.end()) it->second.requests.erase(req);
+}
+
+// Drop the requests test() no longer reports pending
+template <typename C>
+static void release_completed(C& comm) {
+    auto it = held_buffers.find(&comm);
+    if (it == held_buffers.end()) return;
+    auto& requests = it->second.requests;
+    for (auto r = requests.begin(); r != requests.end();) {
+        if (comm.test(r->first) != 0) r = requests.erase(r);
+        else ++r;
+    }
+}
+
+// Receives complete in posting order, so the oldest held ones beyond what the
+// transport still has posted are done
+static void release_receives(Communicator& comm) {
+    auto it = held_buffers.find(&comm);
+    if (it == held_buffers.end()) return;
+    size_t posted = comm.posted_receives();
+    auto& receives = it->second.receives;
+    while (receives.size() > posted) receives.pop_front();
+}
+
+// Block handed out by BufferPool, returned to the pool when released or collected
+struct PoolBuffer {
+    BufferPool* pool;
+    void* ptr;
+    size_t size;
+    
+    ~PoolBuffer() { release(); }
+    void release() {
+        if (ptr) pool->release(ptr);
+        ptr = nullptr;
+    }
+};
+
+// Counters as a dict of dicts, one per operation type, for metrics scrapers.
+// The histogram lists the non-empty buckets as (lower_ns, upper_ns, count).
+static py::dict stats_to_dict(const StatsSnapshot& snap) {
+    py::dict out;
+    for (int op = 0; op < STATS_NUM_OPS; op++) {
+        const OpStatsSnapshot& o = snap.ops[op];
+        py::dict latency;
+        latency["count"] = o.latency_count();
+        latency["p50"] = o.latency_percentile(0.5);
+        latency["p90"] = o.latency_percentile(0.9);
+        latency["p99"] = o.latency_percentile(0.99);
+        latency["p999"] = o.latency_percentile(0.999);
+        latency["max"] = o.latency_percentile(1.0);
+        py::list hist;
+        for (int i = 0; i < LatencyBuckets::COUNT; i++) {
+            if (!o.latency[i]) continue;
+            uint64_t upper = (i + 1 < LatencyBuckets::COUNT) ? LatencyBuckets::lower(i + 1) : UINT64_MAX;
+            hist.append(py::make_tuple(LatencyBuckets::lower(i), upper, o.latency[i]));
+        }
+        py::dict d;
+        d["ops"] = o.ops;
+        d["bytes"] = o.bytes;
+        d["errors"] = o.errors;
+        d["latency_ns"] = latency;
+        d["histogram"] = hist;
+        out[stats_op_name((StatsOp)op)] = d;
+    }
+    out["empty_polls"] = snap.empty_polls;
+    out["send_outstanding"] = snap.send_outstanding;
+    out["recv_outstanding"] = snap.recv_outstanding;
+    return out;
+}
+
+// Span opened by `with pyrdma.TraceSpan(name):`
+struct PyTraceSpan {
+    const char* name;
+    bool active;
+};
+
 // 封装 Communicator 类及其派生类
 PYBIND11_MODULE(pyrdma, m) {
     m.doc() = "PyRDMA: Python bindings for RDMA and TCP communication libraries";
 
     // 基类 Communicator 的绑定（抽象类，不提供构造函数）
     py::class_<Communicator>(m, "Communicator")
-        .def("send", [](Communicator& self, py::buffer buf, size_t len, size_t offset = 0) {
-            py::buffer_info info = buf.request();
-            return self.send(info.ptr, len, offset);
+        .def("send", [](Communicator& self, py::object buf, size_t len, size_t offset = 0) {
+            BufferRef ref(buf, false);
+            ref.check(offset, len);
+            py::gil_scoped_release release;
+            TraceScope span("Communicator.send");
+            return self.send(ref.ptr, len, offset);
         }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Send data")
-        .def("recv", [](Communicator& self, py::buffer buf, size_t len, size_t offset = 0) {
-            py::buffer_info info = buf.request();
-            return self.recv(info.ptr, len, offset);
+        .def("recv", [](Communicator& self, py::object buf, size_t len, size_t offset = 0) {
+            BufferRef ref(buf, true);
+            ref.check(offset, len);
+            int ret;
+            {
+                py::gil_scoped_release release;
+                TraceScope span("Communicator.recv");
+                ret = self.recv(ref.ptr, len, offset);
+            }
+            release_receives(self);
+            return ret;
         }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Receive data")
-        .def("write", [](Communicator& self, py::buffer buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) {
-            py::buffer_info info = buf.request();
-            return self.write(info.ptr, len, remote_addr, rkey, offset);
+        .def("write", [](Communicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) {
+            BufferRef ref(buf, false);
+            ref.check(offset, len);
+            py::gil_scoped_release release;
+            TraceScope span("Communicator.write");
+            return self.write(ref.ptr, len, remote_addr, rkey, offset);
         }, "RDMA write operation")
-        .def("read", [](Communicator& self, py::buffer buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) {
-            py::buffer_info info = buf.request();
-            return self.read(info.ptr, len, remote_addr, rkey, offset);
-        }, "RDMA read operation");
+        .def("read", [](Communicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) {
+            BufferRef ref(buf, true);
+            ref.check(offset, len);
+            py::gil_scoped_release release;
+            TraceScope span("Communicator.read");
+            return self.read(ref.ptr, len, remote_addr, rkey, offset);
+        }, "RDMA read operation")
+        .def("sendv", [](Communicator& self, const std::vector<py::object>& bufs) {
+            std::vector<std::unique_ptr<BufferRef>> refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, false);
+            py::gil_scoped_release release;
+            return self.sendv(iov.data(), (int)iov.size());
+        }, py::arg("bufs"), "Send a list of buffers as one message")
+        .def("recvv", [](Communicator& self, const std::vector<py::object>& bufs) {
+            std::vector<std::unique_ptr<BufferRef>> refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, true);
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.recvv(iov.data(), (int)iov.size());
+            }
+            release_receives(self);
+            return ret;
+        }, py::arg("bufs"), "Receive one message into a list of buffers")
+        .def("writev", [](Communicator& self, const std::vector<py::object>& bufs, uint64_t remote_addr, uint32_t rkey) {
+            std::vector<std::unique_ptr<BufferRef>> refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, false);
+            py::gil_scoped_release release;
+            return self.writev(iov.data(), (int)iov.size(), remote_addr, rkey);
+        }, py::arg("bufs"), py::arg("remote_addr"), py::arg("rkey"), "Gather RDMA write")
+        .def("readv", [](Communicator& self, const std::vector<py::object>& bufs, uint64_t remote_addr, uint32_t rkey) {
+            std::vector<std::unique_ptr<BufferRef>> refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, true);
+            py::gil_scoped_release release;
+            return self.readv(iov.data(), (int)iov.size(), remote_addr, rkey);
+        }, py::arg("bufs"), py::arg("remote_addr"), py::arg("rkey"), "Scatter RDMA read")
+        .def("fetch_add", [](Communicator& self, uint64_t remote_addr, uint32_t rkey, uint64_t add) {
+            uint64_t old;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.fetch_add(remote_addr, rkey, add, &old);
+            }
+            if (ret < 0) throw std::runtime_error("fetch_add failed");
+            return old;
+        }, py::arg("remote_addr"), py::arg("rkey"), py::arg("add"),
+           "Remote 64-bit fetch-and-add, returns the old value")
+        .def("compare_swap", [](Communicator& self, uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap) {
+            uint64_t old;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.compare_swap(remote_addr, rkey, compare, swap, &old);
+            }
+            if (ret < 0) throw std::runtime_error("compare_swap failed");
+            return old;
+        }, py::arg("remote_addr"), py::arg("rkey"), py::arg("compare"), py::arg("swap"),
+           "Remote 64-bit compare-and-swap, returns the old value");
+
+    // TCPConfig 结构体的绑定
+    py::class_<TCPConfig>(m, "TCPConfig")
+        .def(py::init([](bool nodelay, int sndbuf, int rcvbuf, size_t zerocopy_threshold) {
+            TCPConfig c;
+            c.nodelay = nodelay;
+            c.sndbuf = sndbuf;
+            c.rcvbuf = rcvbuf;
+            c.zerocopy_threshold = zerocopy_threshold;
+            return c;
+        }),
+             py::arg("nodelay") = true, py::arg("sndbuf") = 0, py::arg("rcvbuf") = 0, py::arg("zerocopy_threshold") = 0,
+             "Socket settings; sends of at least zerocopy_threshold bytes use MSG_ZEROCOPY, 0 disables")
+        .def_readwrite("nodelay", &TCPConfig::nodelay)
+        .def_readwrite("sndbuf", &TCPConfig::sndbuf)
+        .def_readwrite("rcvbuf", &TCPConfig::rcvbuf)
+        .def_readwrite("zerocopy_threshold", &TCPConfig::zerocopy_threshold);
+
+    // QPConfig 结构体的绑定
+    py::class_<QPConfig>(m, "QPConfig")
+        .def(py::init([](int max_send_wr, int max_recv_wr, int max_inline_data, int inline_threshold,
+                         int send_cq_depth, int recv_cq_depth, int poll_batch,
+                         int path_mtu, int max_rd_atomic,
+                         int timeout, int retry_cnt, int rnr_retry, int min_rnr_timer,
+                         int num_qps, size_t stripe_size) {
+            QPConfig c;
+            c.max_send_wr = max_send_wr;
+            c.max_recv_wr = max_recv_wr;
+            c.max_inline_data = max_inline_data;
+            c.inline_threshold = inline_threshold;
+            c.send_cq_depth = send_cq_depth;
+            c.recv_cq_depth = recv_cq_depth;
+            c.poll_batch = poll_batch;
+            c.path_mtu = path_mtu;
+            c.max_rd_atomic = max_rd_atomic;
+            c.timeout = timeout;
+            c.retry_cnt = retry_cnt;
+            c.rnr_retry = rnr_retry;
+            c.min_rnr_timer = min_rnr_timer;
+            c.num_qps = num_qps;
+            c.stripe_size = stripe_size;
+            return c;
+        }),
+             py::arg("max_send_wr") = 128, py::arg("max_recv_wr") = 64, py::arg("max_inline_data") = 0,
+             py::arg("inline_threshold") = 64,
+             py::arg("send_cq_depth") = 256, py::arg("recv_cq_depth") = 256, py::arg("poll_batch") = 16,
+             py::arg("path_mtu") = 0, py::arg("max_rd_atomic") = 0,
+             py::arg("timeout") = 14, py::arg("retry_cnt") = 7, py::arg("rnr_retry") = 7,
+             py::arg("min_rnr_timer") = 12, py::arg("num_qps") = 1, py::arg("stripe_size") = (size_t)1 << 20,
+             "QP settings; path_mtu is an ibv_mtu value (1=256 .. 5=4096), 0 to negotiate")
+        .def_readwrite("max_send_wr", &QPConfig::max_send_wr)
+        .def_readwrite("max_recv_wr", &QPConfig::max_recv_wr)
+        .def_readwrite("max_inline_data", &QPConfig::max_inline_data)
+        .def_readwrite("inline_threshold", &QPConfig::inline_threshold)
+        .def_readwrite("send_cq_depth", &QPConfig::send_cq_depth)
+        .def_readwrite("recv_cq_depth", &QPConfig::recv_cq_depth)
+        .def_readwrite("poll_batch", &QPConfig::poll_batch)
+        .def_readwrite("path_mtu", &QPConfig::path_mtu)
+        .def_readwrite("max_rd_atomic", &QPConfig::max_rd_atomic)
+        .def_readwrite("timeout", &QPConfig::timeout)
+        .def_readwrite("retry_cnt", &QPConfig::retry_cnt)
+        .def_readwrite("rnr_retry", &QPConfig::rnr_retry)
+        .def_readwrite("min_rnr_timer", &QPConfig::min_rnr_timer)
+        .def_readwrite("num_qps", &QPConfig::num_qps)
+        .def_readwrite("stripe_size", &QPConfig::stripe_size);
 
     // TCPCommunicator 的绑定
     py::class_<TCPCommunicator, Communicator>(m, "TCPCommunicator")
-        .def(py::init<int>(), "Initialize with socket file descriptor")
+        .def(py::init<int, const TCPConfig&>(), py::arg("fd"), py::arg("config") = TCPConfig(),
+             "Initialize with socket file descriptor")
+        .def("post_send", [](TCPCommunicator& self, py::object buf, size_t len, size_t offset = 0) {
+            BufferRefs refs = one_ref(buf, false);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] { return self.post_send(ptr, len, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0,
+           "Send without waiting for zerocopy completion, return request handle")
+        .def("wait", [](TCPCommunicator& self, int64_t req) {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.wait(req);
+            }
+            // The kernel may still hold the pages of a failed wait
+            if (ret == 0) release_request(self, req);
+            return ret;
+        }, py::arg("req"), "Wait until the kernel is done with the buffer of a request")
+        .def("zerocopy_enabled", &TCPCommunicator::zerocopy_enabled, "Whether large sends use MSG_ZEROCOPY")
         .def("get_fd", &TCPCommunicator::get_fd, "Get socket file descriptor");
 
     // RDMACommunicator 的绑定
     py::class_<RDMACommunicator, Communicator>(m, "RDMACommunicator")
-        .def(py::init<int, char*, int>(),
-             py::arg("fd"), py::arg("dev_name"), py::arg("gid_index") = 0,
+        .def(py::init<int, char*, int, const QPConfig&>(),
+             py::arg("fd"), py::arg("dev_name"), py::arg("gid_index") = 0, py::arg("config") = QPConfig(),
              "Initialize with socket file descriptor, device name, GID index")
-        .def("post_receive", [](RDMACommunicator& self, py::buffer buf, size_t len, size_t offset = 0) {
-            py::buffer_info info = buf.request();
-            return self.post_receive(info.ptr, len, offset);
+        .def(py::init<int, std::shared_ptr<RDMAContext>, int, const QPConfig&>(),
+             py::arg("fd"), py::arg("context"), py::arg("gid_index") = 0, py::arg("config") = QPConfig(),
+             "Initialize on a device context shared with other communicators")
+        .def(py::init<int, RDMASharedRecvQueue*, int, const QPConfig&>(),
+             py::arg("fd"), py::arg("srq"), py::arg("gid_index") = 0, py::arg("config") = QPConfig(),
+             py::keep_alive<1, 3>(),
+             "Initialize on a shared receive queue")
+        .def_property_readonly("config", &RDMACommunicator::get_config)
+        .def("recv_view", [](RDMACommunicator& self) {
+            RDMARecvView view;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.recv_view(view);
+            }
+            if (ret < 0) throw std::runtime_error("recv_view failed");
+            return py::memoryview::from_memory(view.data, (ssize_t)view.len);
+        }, "Receive from the shared receive queue without copying; valid until the next recv_view")
+        .def("release_view", &RDMACommunicator::release_view, py::call_guard<py::gil_scoped_release>(),
+             "Return the last recv_view slot to the SRQ")
+        .def("post_receive", [](RDMACommunicator& self, py::object buf, size_t len, size_t offset = 0) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_receive_held(self, std::move(refs), [&] { return self.post_receive(ptr, len, offset); });
         }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Post receive buffer")
+        .def("post_receive_imm", [](RDMACommunicator& self) {
+            // Held empty, to keep the receives in posting order
+            return post_receive_held(self, BufferRefs(), [&] { return self.post_receive(nullptr, 0); });
+        }, "Post a zero-length receive for a write_with_imm")
+        .def("recv_imm", [](RDMACommunicator& self, py::object buf, size_t len, size_t offset) {
+            // buf may be None when only notifications are expected
+            std::unique_ptr<BufferRef> ref;
+            void* ptr = nullptr;
+            if (!buf.is_none()) {
+                ref.reset(new BufferRef(buf, true));
+                ref->check(offset, len);
+                ptr = ref->ptr;
+            }
+            RDMAImmRecv r;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.recv_imm(r, ptr, len, offset);
+            }
+            release_receives(self);
+            if (ret < 0) throw std::runtime_error("recv_imm failed");
+            return py::make_tuple(r.len, r.with_imm ? py::object(py::int_(r.imm)) : py::object(py::none()));
+        }, py::arg("buf") = py::none(), py::arg("len") = 0, py::arg("offset") = 0,
+           "Complete the next receive, return (length, immediate or None)")
+        .def("post_receivev", [](RDMACommunicator& self, const std::vector<py::object>& bufs) {
+            BufferRefs refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, true);
+            return post_receive_held(self, std::move(refs), [&] { return self.post_receivev(iov.data(), (int)iov.size()); });
+        }, py::arg("bufs"), "Post one receive scattering into a list of buffers")
+        .def("post_sendv", [](RDMACommunicator& self, const std::vector<py::object>& bufs) {
+            BufferRefs refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, false);
+            return post_held(self, std::move(refs), [&] { return self.post_sendv(iov.data(), (int)iov.size()); });
+        }, py::arg("bufs"), "Post gather send, return request handle")
+        .def("post_writev", [](RDMACommunicator& self, const std::vector<py::object>& bufs, uint64_t remote_addr, uint32_t rkey) {
+            BufferRefs refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, false);
+            return post_held(self, std::move(refs), [&] { return self.post_writev(iov.data(), (int)iov.size(), remote_addr, rkey); });
+        }, py::arg("bufs"), py::arg("remote_addr"), py::arg("rkey"), "Post gather RDMA write, return request handle")
+        .def("post_readv", [](RDMACommunicator& self, const std::vector<py::object>& bufs, uint64_t remote_addr, uint32_t rkey) {
+            BufferRefs refs;
+            std::vector<struct iovec> iov = to_iov(bufs, refs, true);
+            return post_held(self, std::move(refs), [&] { return self.post_readv(iov.data(), (int)iov.size(), remote_addr, rkey); });
+        }, py::arg("bufs"), py::arg("remote_addr"), py::arg("rkey"), "Post scatter RDMA read, return request handle")
+        .def("post_send", [](RDMACommunicator& self, py::object buf, size_t len, size_t offset = 0) {
+            BufferRefs refs = one_ref(buf, false);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] { return self.post_send(ptr, len, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Post RDMA send, return request handle")
+        .def("post_write", [](RDMACommunicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) {
+            BufferRefs refs = one_ref(buf, false);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] { return self.post_write(ptr, len, remote_addr, rkey, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("remote_addr"), py::arg("rkey"), py::arg("offset") = 0,
+           "Post RDMA write, return request handle")
+        .def("write_with_imm", [](RDMACommunicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey,
+                                  uint32_t imm, size_t offset) {
+            BufferRef ref(buf, false);
+            ref.check(offset, len);
+            py::gil_scoped_release release;
+            return self.write_with_imm(ref.ptr, len, remote_addr, rkey, imm, offset);
+        }, py::arg("buf"), py::arg("len"), py::arg("remote_addr"), py::arg("rkey"), py::arg("imm"), py::arg("offset") = 0,
+           "RDMA write that completes the peer's next receive with imm")
+        .def("post_write_with_imm", [](RDMACommunicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey,
+                                       uint32_t imm, size_t offset) {
+            BufferRefs refs = one_ref(buf, false);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] {
+                return self.post_write_with_imm(ptr, len, remote_addr, rkey, imm, offset);
+            });
+        }, py::arg("buf"), py::arg("len"), py::arg("remote_addr"), py::arg("rkey"), py::arg("imm"), py::arg("offset") = 0,
+           "Post RDMA write with immediate, return request handle")
+        .def("post_read", [](RDMACommunicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] { return self.post_read(ptr, len, remote_addr, rkey, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("remote_addr"), py::arg("rkey"), py::arg("offset") = 0,
+           "Post RDMA read, return request handle")
+        .def("post_write_batch", [](RDMACommunicator& self, py::object buf, const BatchList& entries, uint32_t rkey, int signal_every) {
+            BufferRefs refs = one_ref(buf, false);
+            refs[0]->check(entries);
+            void* ptr = refs[0]->ptr;
+            std::vector<RDMABatchEntry> batch = to_batch(entries);
+            return post_held(self, std::move(refs), [&] { return self.post_write_batch(ptr, batch, rkey, signal_every); });
+        }, py::arg("buf"), py::arg("entries"), py::arg("rkey"), py::arg("signal_every") = 16,
+           "Post a batch of (local_offset, remote_addr, len) RDMA writes, return request handle")
+        .def("post_read_batch", [](RDMACommunicator& self, py::object buf, const BatchList& entries, uint32_t rkey, int signal_every) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(entries);
+            void* ptr = refs[0]->ptr;
+            std::vector<RDMABatchEntry> batch = to_batch(entries);
+            return post_held(self, std::move(refs), [&] { return self.post_read_batch(ptr, batch, rkey, signal_every); });
+        }, py::arg("buf"), py::arg("entries"), py::arg("rkey"), py::arg("signal_every") = 16,
+           "Post a batch of (local_offset, remote_addr, len) RDMA reads, return request handle")
+        .def("write_batch", [](RDMACommunicator& self, py::object buf, const BatchList& entries, uint32_t rkey, int signal_every) {
+            BufferRef ref(buf, false);
+            ref.check(entries);
+            py::gil_scoped_release release;
+            return self.write_batch(ref.ptr, to_batch(entries), rkey, signal_every);
+        }, py::arg("buf"), py::arg("entries"), py::arg("rkey"), py::arg("signal_every") = 16,
+           "Batched RDMA write")
+        .def("read_batch", [](RDMACommunicator& self, py::object buf, const BatchList& entries, uint32_t rkey, int signal_every) {
+            BufferRef ref(buf, true);
+            ref.check(entries);
+            py::gil_scoped_release release;
+            return self.read_batch(ref.ptr, to_batch(entries), rkey, signal_every);
+        }, py::arg("buf"), py::arg("entries"), py::arg("rkey"), py::arg("signal_every") = 16,
+           "Batched RDMA read")
+        .def("test", [](RDMACommunicator& self, int64_t req) {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.test(req);
+            }
+            if (ret != 0) release_request(self, req);
+            return ret;
+        }, py::arg("req"), "Check whether a request has completed")
+        .def("wait", [](RDMACommunicator& self, int64_t req) {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                TraceScope span("RDMACommunicator.wait");
+                ret = self.wait(req);
+            }
+            // A failed wait may leave the request posted
+            if (ret >= 0 || self.test(req) != 0) release_request(self, req);
+            return ret;
+        }, py::arg("req"), "Wait for a request to complete")
+        .def("wait_all", [](RDMACommunicator& self) {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                TraceScope span("RDMACommunicator.wait_all");
+                ret = self.wait_all();
+            }
+            release_completed(self);
+            return ret;
+        }, "Wait for all outstanding requests")
+        .def("atomics_supported", &RDMACommunicator::atomics_supported,
+             "Whether the device executes remote atomics")
+        .def("start_progress_thread", &RDMACommunicator::start_progress_thread, py::arg("spin_count") = 1024,
+             py::call_guard<py::gil_scoped_release>(),
+             "Reap completions on a background thread instead of the calling thread")
+        .def("stop_progress_thread", &RDMACommunicator::stop_progress_thread, py::call_guard<py::gil_scoped_release>(),
+             "Stop the background progress thread")
+        .def("event_fd", [](RDMACommunicator& self) {
+            int fd = self.get_event_fd();
+            if (fd < 0) throw std::runtime_error("Failed to enable completion events");
+            return fd;
+        }, "Completion channel fd for an event loop, readable when process_events() has work")
+        .def("process_events", [](RDMACommunicator& self) {
+            std::vector<int64_t> done;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.process_events(done);
+            }
+            for (int64_t req : done) release_request(self, req);
+            if (ret < 0) throw std::runtime_error("process_events failed");
+            return done;
+        }, "Reap completions without blocking, return the handles of the requests that completed")
+        .def("try_recv", [](RDMACommunicator& self, py::object buf, size_t len, size_t offset) -> py::object {
+            std::unique_ptr<BufferRef> ref;
+            void* ptr = nullptr;
+            if (!buf.is_none()) {
+                ref.reset(new BufferRef(buf, true));
+                ref->check(offset, len);
+                ptr = ref->ptr;
+            }
+            RDMAImmRecv r;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.try_recv(r, ptr, len, offset);
+            }
+            if (ret != 0) release_receives(self);
+            if (ret < 0) throw std::runtime_error("try_recv failed");
+            if (ret == 0) return py::none();
+            return py::make_tuple(r.len, r.with_imm ? py::object(py::int_(r.imm)) : py::object(py::none()));
+        }, py::arg("buf") = py::none(), py::arg("len") = 0, py::arg("offset") = 0,
+           "recv_imm() that returns None instead of waiting")
         .def("exchange_qp_info", [](RDMACommunicator& self, WireMsg& local, WireMsg& peer) {
             return self.exchange_qp_info(local, peer);
-        }, "Exchange QP information with peer")
+        }, py::call_guard<py::gil_scoped_release>(), "Exchange QP information with peer")
         .def("modify_qp_to_init", [](RDMACommunicator& self) {
             return self.modify_qp_to_init();
-        }, "Modify QP state to INIT")
+        }, py::call_guard<py::gil_scoped_release>(), "Modify QP state to INIT")
         .def("modify_qp_to_rtr", [](RDMACommunicator& self, WireMsg& peer) {
             return self.modify_qp_to_rtr(peer);
-        }, "Modify QP state to RTR")
+        }, py::call_guard<py::gil_scoped_release>(), "Modify QP state to RTR")
         .def("modify_qp_to_rts", [](RDMACommunicator& self, WireMsg& local) {
             return self.modify_qp_to_rts(local);
-        }, "Modify QP state to RTS")
+        }, py::call_guard<py::gil_scoped_release>(), "Modify QP state to RTS")
+        .def("connect", &RDMACommunicator::connect, py::call_guard<py::gil_scoped_release>(),
+             "Bring the connection up as the connecting side")
+        .def("accept", &RDMACommunicator::accept, py::call_guard<py::gil_scoped_release>(),
+             "Bring the connection up as the accepting side")
+        .def("expose_memory", [](RDMACommunicator& self, py::object buf) {
+            BufferRef ref(buf, true);
+            py::gil_scoped_release release;
+            return self.expose_memory(ref.ptr, ref.size);
+        }, py::arg("buf"), py::keep_alive<1, 2>(), "Advertise a buffer to the peer on connect/accept")
+        .def("peer_regions", [](RDMACommunicator& self) {
+            py::list out;
+            for (const auto& d : self.get_peer_regions()) out.append(py::make_tuple(d.addr, d.len, d.rkey));
+            return out;
+        }, "(addr, len, rkey) of every region the peer advertised")
+        .def_property_readonly("peer_caps", &RDMACommunicator::get_peer_caps)
+        .def_property_readonly("peer_version", &RDMACommunicator::get_peer_version)
+        .def_property_readonly("num_qps", &RDMACommunicator::get_num_qps)
+        .def("stats", [](RDMACommunicator& self) {
+            StatsSnapshot snap;
+            {
+                py::gil_scoped_release release;
+                snap = self.get_stats();
+            }
+            return stats_to_dict(snap);
+        }, "Per-operation counters, latency histograms and outstanding work requests")
         .def("get_fd", &RDMACommunicator::get_fd, "Get socket file descriptor")
-        .def("set_buffer", [](RDMACommunicator& self, py::buffer buf, size_t size) {
-            py::buffer_info info = buf.request();
-            return self.set_buffer(info.ptr, size);
+        .def("set_buffer", [](RDMACommunicator& self, py::object buf, size_t size) {
+            BufferRef ref(buf, true);
+            ref.check(0, size);
+            py::gil_scoped_release release;
+            return self.set_buffer(ref.ptr, size);
         }, "Set external buffer")
+        .def("invalidate_buffer", [](RDMACommunicator& self, py::object buf) {
+            BufferRef ref(buf, false);
+            py::gil_scoped_release release;
+            self.invalidate_memory(ref.ptr, ref.size);
+        }, py::arg("buf"), "Drop cached registrations of a buffer before it is freed")
         .def("get_rkey", &RDMACommunicator::get_rkey, "Get remote key");
 
+    // 通信时间线追踪（Chrome trace JSON）
+    m.def("trace_start", &trace_start, py::arg("capacity") = (size_t)TRACE_DEFAULT_CAPACITY,
+          "Record posts, completions, polls and spans into a ring of capacity events");
+    m.def("trace_stop", &trace_stop, "Stop recording; events stay available to dump");
+    m.def("trace_enabled", &trace_enabled, "Whether events are being recorded");
+    m.def("trace_json", &trace_json, py::call_guard<py::gil_scoped_release>(),
+          "Recorded events as Chrome trace JSON");
+    m.def("trace_dump", [](const std::string& path) {
+        py::gil_scoped_release release;
+        return trace_dump(path.c_str());
+    }, py::arg("path"), "Write the events as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev");
+    m.def("trace_instant", [](const std::string& name) {
+        if (trace_enabled()) trace_record(TRACE_INSTANT, trace_intern(name), nullptr, 0, 0, 0, 0);
+    }, py::arg("name"), "Mark a point in time on the calling thread");
+    py::class_<PyTraceSpan>(m, "TraceSpan")
+        .def(py::init([](const std::string& name) {
+            return PyTraceSpan{ trace_intern(name), false };
+        }), py::arg("name"), "Slice on the calling thread's timeline, used as a context manager")
+        .def("__enter__", [](PyTraceSpan& self) -> PyTraceSpan& {
+            self.active = trace_enabled();
+            if (self.active) trace_record(TRACE_BEGIN, self.name, nullptr, 0, 0, 0, 0);
+            return self;
+        }, py::return_value_policy::reference_internal)
+        .def("__exit__", [](PyTraceSpan& self, const py::object&, const py::object&, const py::object&) {
+            if (self.active) trace_record(TRACE_END, self.name, nullptr, 0, 0, 0, 0);
+            self.active = false;
+            return false;
+        });
+
+    // 握手能力标志
+    m.attr("HS_CAP_INLINE") = HS_CAP_INLINE;
+    m.attr("HS_CAP_SRQ") = HS_CAP_SRQ;
+
+    // RDMAContext 的绑定
+    py::class_<RDMAContext, std::shared_ptr<RDMAContext>>(m, "RDMAContext")
+        .def(py::init([](const char* dev_name, int port, size_t mr_cache_entries) {
+            auto ctx = std::make_shared<RDMAContext>(dev_name, port, mr_cache_entries);
+            if (!ctx->valid()) throw std::runtime_error("Failed to open RDMA device");
+            return ctx;
+        }), py::arg("dev_name"), py::arg("port") = (int)RDMAContext::DEFAULT_PORT,
+            py::arg("mr_cache_entries") = (size_t)RDMAContext::MR_CACHE_ENTRIES,
+            "Open a device and protection domain shared by many communicators")
+        .def("get_device_name", &RDMAContext::get_device_name, "Get device name")
+        .def("get_port", &RDMAContext::get_port, "Get port number")
+        .def("get_numa_node", &RDMAContext::get_numa_node, "NUMA node of the device, -1 if unknown")
+        .def("get_link_gbps", &RDMAContext::get_link_gbps, "Active link rate in Gb/s");
+
+    // MultiRailCommunicator 的绑定
+    py::class_<MultiRailCommunicator, Communicator>(m, "MultiRailCommunicator")
+        .def(py::init<int, const std::vector<std::pair<std::string, int>>&, int, const QPConfig&>(),
+             py::arg("fd"), py::arg("rails") = std::vector<std::pair<std::string, int>>(),
+             py::arg("gid_index") = 0, py::arg("config") = QPConfig(),
+             "Initialize over (device, port) rails, every active port if empty")
+        .def_static("discover_rails", &MultiRailCommunicator::discover_rails,
+                    "List (device, port) pairs with an active port")
+        .def("connect", &MultiRailCommunicator::connect, py::call_guard<py::gil_scoped_release>(),
+             "Bring every rail up as the connecting side")
+        .def("accept", &MultiRailCommunicator::accept, py::call_guard<py::gil_scoped_release>(),
+             "Bring every rail up as the accepting side")
+        .def("set_buffer", [](MultiRailCommunicator& self, py::object buf, size_t size) {
+            BufferRef ref(buf, true);
+            ref.check(0, size);
+            py::gil_scoped_release release;
+            return self.set_buffer(ref.ptr, size);
+        }, py::arg("buf"), py::arg("size"), "Register a buffer on every rail")
+        .def("expose_memory", [](MultiRailCommunicator& self, py::object buf) {
+            BufferRef ref(buf, true);
+            py::gil_scoped_release release;
+            return self.expose_memory(ref.ptr, ref.size);
+        }, py::arg("buf"), py::keep_alive<1, 2>(), "Advertise a buffer to the peer on every rail")
+        .def("post_receive", [](MultiRailCommunicator& self, py::object buf, size_t len, size_t offset) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_receive_held(self, std::move(refs), [&] { return self.post_receive(ptr, len, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Post a receive on the control rail")
+        .def("set_numa_aware", &MultiRailCommunicator::set_numa_aware, py::arg("on"),
+             "Prefer rails on the NUMA node of the local buffer")
+        .def("rail_status", [](MultiRailCommunicator& self) {
+            py::list out;
+            for (const auto& st : self.get_rail_status()) {
+                out.append(py::make_tuple(st.device, st.port, st.gbps, st.numa_node, st.healthy));
+            }
+            return out;
+        }, "(device, port, gbps, numa_node, healthy) of every rail")
+        .def("stats", [](MultiRailCommunicator& self) {
+            StatsSnapshot snap;
+            {
+                py::gil_scoped_release release;
+                snap = self.get_stats();
+            }
+            return stats_to_dict(snap);
+        }, "Counters of every rail added up, see RDMACommunicator.stats()")
+        .def("get_num_rails", &MultiRailCommunicator::get_num_rails, "Number of rails")
+        .def("get_rkey", &MultiRailCommunicator::get_rkey, "Remote key on the first rail")
+        .def("get_fd", &MultiRailCommunicator::get_fd, "Get socket file descriptor");
+
+    // SoftRDMACommunicator 的绑定
+    py::class_<SoftRDMACommunicator, Communicator>(m, "SoftRDMACommunicator")
+        .def(py::init<int, const TCPConfig&>(), py::arg("fd"), py::arg("config") = TCPConfig(),
+             "RDMA semantics emulated over a TCP socket, for hosts without an HCA")
+        .def("connect", &SoftRDMACommunicator::connect, py::call_guard<py::gil_scoped_release>(),
+             "Exchange registered regions as the connecting side")
+        .def("accept", &SoftRDMACommunicator::accept, py::call_guard<py::gil_scoped_release>(),
+             "Exchange registered regions as the accepting side")
+        .def("set_buffer", [](SoftRDMACommunicator& self, py::object buf, size_t size) {
+            BufferRef ref(buf, true);
+            ref.check(0, size);
+            py::gil_scoped_release release;
+            return self.set_buffer(ref.ptr, size);
+        }, py::arg("buf"), py::arg("size"), "Register a buffer the peer may access")
+        .def("expose_memory", [](SoftRDMACommunicator& self, py::object buf) {
+            BufferRef ref(buf, true);
+            py::gil_scoped_release release;
+            return self.expose_memory(ref.ptr, ref.size);
+        }, py::arg("buf"), py::keep_alive<1, 2>(), "Advertise a buffer to the peer")
+        .def("peer_regions", [](SoftRDMACommunicator& self) {
+            py::list out;
+            for (const auto& d : self.get_peer_regions()) out.append(py::make_tuple(d.addr, d.len, d.rkey));
+            return out;
+        }, "(addr, len, rkey) of every region the peer advertised")
+        .def("post_receive", [](SoftRDMACommunicator& self, py::object buf, size_t len, size_t offset) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_receive_held(self, std::move(refs), [&] { return self.post_receive(ptr, len, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Post receive buffer")
+        .def("post_write", [](SoftRDMACommunicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+            BufferRefs refs = one_ref(buf, false);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] { return self.post_write(ptr, len, remote_addr, rkey, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("remote_addr"), py::arg("rkey"), py::arg("offset") = 0,
+           "Post emulated RDMA write, return request handle")
+        .def("post_read", [](SoftRDMACommunicator& self, py::object buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_held(self, std::move(refs), [&] { return self.post_read(ptr, len, remote_addr, rkey, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("remote_addr"), py::arg("rkey"), py::arg("offset") = 0,
+           "Post emulated RDMA read, return request handle")
+        .def("test", [](SoftRDMACommunicator& self, int64_t req) {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.test(req);
+            }
+            if (ret != 0) release_request(self, req);
+            return ret;
+        }, py::arg("req"), "Check whether a request has completed")
+        .def("wait", [](SoftRDMACommunicator& self, int64_t req) {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.wait(req);
+            }
+            if (ret >= 0 || self.test(req) != 0) release_request(self, req);
+            return ret;
+        }, py::arg("req"), "Wait for a request to complete")
+        .def("get_rkey", &SoftRDMACommunicator::get_rkey, "Remote key of the set_buffer region")
+        .def("get_fd", &SoftRDMACommunicator::get_fd, "Get socket file descriptor");
+
+    // ShmCommunicator 的绑定
+    py::class_<ShmCommunicator, Communicator>(m, "ShmCommunicator")
+        .def(py::init<int, size_t>(), py::arg("fd"), py::arg("ring_size") = (size_t)ShmCommunicator::DEFAULT_RING_SIZE,
+             "Shared-memory communicator for a peer on the same host")
+        .def_static("peer_is_local", &ShmCommunicator::peer_is_local, py::arg("fd"),
+                    py::call_guard<py::gil_scoped_release>(),
+                    "1 if the peer shares our /dev/shm and its memory is reachable, 0 if not, -1 on error; both sides call it")
+        .def("connect", &ShmCommunicator::connect, py::call_guard<py::gil_scoped_release>(),
+             "Exchange control segments as the connecting side")
+        .def("accept", &ShmCommunicator::accept, py::call_guard<py::gil_scoped_release>(),
+             "Exchange control segments as the accepting side")
+        .def("alloc_buffer", [](ShmCommunicator& self, size_t size) {
+            void* p = self.alloc_buffer(size);
+            if (!p) throw std::runtime_error("alloc_buffer failed");
+            return py::memoryview::from_memory(p, (ssize_t)size);
+        }, py::arg("size"), "Shared buffer the peer reaches with memcpy; valid while the communicator lives")
+        .def("set_buffer", [](ShmCommunicator& self, py::object buf, size_t size) {
+            BufferRef ref(buf, true);
+            ref.check(0, size);
+            py::gil_scoped_release release;
+            return self.set_buffer(ref.ptr, size);
+        }, py::arg("buf"), py::arg("size"), "Register alloc_buffer() memory the peer may access")
+        .def("expose_memory", [](ShmCommunicator& self, py::object buf) {
+            BufferRef ref(buf, true);
+            py::gil_scoped_release release;
+            return self.expose_memory(ref.ptr, ref.size);
+        }, py::arg("buf"), py::keep_alive<1, 2>(), "Advertise a buffer to the peer")
+        .def("post_receive", [](ShmCommunicator& self, py::object buf, size_t len, size_t offset) {
+            BufferRefs refs = one_ref(buf, true);
+            refs[0]->check(offset, len);
+            void* ptr = refs[0]->ptr;
+            return post_receive_held(self, std::move(refs), [&] { return self.post_receive(ptr, len, offset); });
+        }, py::arg("buf"), py::arg("len"), py::arg("offset") = 0, "Post receive buffer")
+        .def("get_rkey", &ShmCommunicator::get_rkey, "Remote key of the set_buffer region")
+        .def("get_fd", &ShmCommunicator::get_fd, "Get socket file descriptor");
+
+    // 传输方式自动选择
+    py::enum_<TransportKind>(m, "TransportKind")
+        .value("AUTO", TRANSPORT_AUTO)
+        .value("TCP", TRANSPORT_TCP)
+        .value("SOFT", TRANSPORT_SOFT)
+        .value("RDMA", TRANSPORT_RDMA)
+        .value("SHM", TRANSPORT_SHM);
+
+    m.def("create_communicator", [](int fd, bool initiator, TransportKind kind, const char* dev_name,
+                                    int gid_index, const QPConfig& config) {
+        std::unique_ptr<Communicator> comm;
+        {
+            py::gil_scoped_release release;
+            comm = create_communicator(fd, initiator, kind, dev_name, gid_index, config);
+        }
+        if (!comm) throw std::runtime_error("create_communicator failed");
+        return comm;
+    }, py::arg("fd"), py::arg("initiator"), py::arg("kind") = TRANSPORT_AUTO, py::arg("dev_name") = nullptr,
+       py::arg("gid_index") = 0, py::arg("config") = QPConfig(),
+       "Connected communicator over the best transport both sides support");
+    m.def("transport_kind", &transport_kind, py::arg("comm"), "Transport behind a communicator");
+
+    // 远程原子计数器与自旋锁
+    py::class_<RemoteCounter>(m, "RemoteCounter")
+        .def(py::init<Communicator*, uint64_t, uint32_t>(), py::keep_alive<1, 2>(),
+             py::arg("comm"), py::arg("remote_addr"), py::arg("rkey"))
+        .def("fetch_add", [](RemoteCounter& self, int64_t delta) {
+            uint64_t old;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.fetch_add(delta, &old);
+            }
+            if (ret < 0) throw std::runtime_error("fetch_add failed");
+            return old;
+        }, py::arg("delta") = 1, "Add delta, returns the old value")
+        .def("next", [](RemoteCounter& self) {
+            uint64_t value;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.next(&value);
+            }
+            if (ret < 0) throw std::runtime_error("fetch_add failed");
+            return value;
+        }, "Increment, returns the new value")
+        .def("get", [](RemoteCounter& self) {
+            uint64_t value;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.get(&value);
+            }
+            if (ret < 0) throw std::runtime_error("fetch_add failed");
+            return value;
+        })
+        .def("reset", &RemoteCounter::reset, py::arg("value") = 0, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<RemoteSpinLock>(m, "RemoteSpinLock")
+        .def(py::init<Communicator*, uint64_t, uint32_t, uint64_t>(), py::keep_alive<1, 2>(),
+             py::arg("comm"), py::arg("remote_addr"), py::arg("rkey"), py::arg("owner_id") = 0)
+        .def("try_lock", &RemoteSpinLock::try_lock, py::call_guard<py::gil_scoped_release>(),
+             "1 if acquired, 0 if held elsewhere, -1 on failure")
+        .def("lock", &RemoteSpinLock::lock, py::arg("timeout_ms") = -1, py::call_guard<py::gil_scoped_release>(),
+             "1 once acquired, 0 on timeout, -1 on failure")
+        .def("unlock", &RemoteSpinLock::unlock, py::call_guard<py::gil_scoped_release>())
+        .def("holder", [](RemoteSpinLock& self) {
+            uint64_t owner;
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.holder(&owner);
+            }
+            if (ret < 0) throw std::runtime_error("compare_swap failed");
+            return owner;
+        }, "Owner id of the holder, 0 if free")
+        .def_property_readonly("owner", &RemoteSpinLock::get_owner)
+        .def("__enter__", [](RemoteSpinLock& self) -> RemoteSpinLock& {
+            int ret;
+            {
+                py::gil_scoped_release release;
+                ret = self.lock();
+            }
+            if (ret != 1) throw std::runtime_error("lock failed");
+            return self;
+        }, py::return_value_policy::reference)
+        .def("__exit__", [](RemoteSpinLock& self, const py::object&, const py::object&, const py::object&) {
+            py::gil_scoped_release release;
+            self.unlock();
+        });
+
+    // 集合通信的绑定
+    py::enum_<ReduceDtype>(m, "DType")
+        .value("FLOAT32", DTYPE_FLOAT32)
+        .value("FLOAT16", DTYPE_FLOAT16)
+        .value("BFLOAT16", DTYPE_BFLOAT16);
+
+    py::enum_<ReduceOp>(m, "ReduceOp")
+        .value("SUM", REDUCE_SUM)
+        .value("MAX", REDUCE_MAX);
+
+    py::class_<CommGroup>(m, "CommGroup")
+        .def(py::init<int, const std::vector<Communicator*>&, size_t>(), py::keep_alive<1, 3>(),
+             py::arg("rank"), py::arg("peers"), py::arg("chunk_size") = (size_t)CommGroup::DEFAULT_CHUNK_SIZE,
+             "peers[i] is connected to rank i; None for this rank")
+        .def_property_readonly("rank", &CommGroup::rank)
+        .def_property_readonly("size", &CommGroup::size)
+        .def("broadcast", [](CommGroup& self, py::object buf, int root) {
+            BufferRef ref(buf, true);
+            py::gil_scoped_release release;
+            return self.broadcast(ref.ptr, ref.size, root);
+        }, py::arg("buf"), py::arg("root"), "Copy root's buffer to every rank")
+        .def("allgather", [](CommGroup& self, py::object buf) {
+            BufferRef ref(buf, true);
+            size_t total = ref.size;
+            if (total % self.size()) throw py::value_error("Buffer size is not a multiple of the group size");
+            py::gil_scoped_release release;
+            return self.allgather(ref.ptr, total / self.size());
+        }, py::arg("buf"), "Fill every rank's block of buf, this rank's block is the input")
+        .def("reduce_scatter", [](CommGroup& self, py::object buf, ReduceDtype dtype, ReduceOp op) {
+            BufferRef ref(buf, true);
+            size_t total = ref.size;
+            size_t block = dtype_size(dtype) * self.size();
+            if (total % block) throw py::value_error("Buffer size is not a multiple of size * element size");
+            py::gil_scoped_release release;
+            return self.reduce_scatter(ref.ptr, total / block, dtype, op);
+        }, py::arg("buf"), py::arg("dtype") = DTYPE_FLOAT32, py::arg("op") = REDUCE_SUM,
+           "Reduce block i of every rank into rank i's block i; buf is clobbered")
+        .def("allreduce", [](CommGroup& self, py::object buf, ReduceDtype dtype, ReduceOp op) {
+            BufferRef ref(buf, true);
+            size_t total = ref.size;
+            if (total % dtype_size(dtype)) throw py::value_error("Buffer size is not a multiple of the element size");
+            py::gil_scoped_release release;
+            return self.allreduce(ref.ptr, total / dtype_size(dtype), dtype, op);
+        }, py::arg("buf"), py::arg("dtype") = DTYPE_FLOAT32, py::arg("op") = REDUCE_SUM,
+           "Element-wise reduction across ranks, in place")
+        .def("barrier", &CommGroup::barrier, py::call_guard<py::gil_scoped_release>());
+
+    // RDMASharedRecvQueue 的绑定
+    py::class_<RDMASharedRecvQueue>(m, "SharedRecvQueue")
+        .def(py::init<std::shared_ptr<RDMAContext>, size_t, size_t, size_t>(),
+             py::arg("context"), py::arg("num_buffers") = 256, py::arg("buffer_size") = 4096,
+             py::arg("refill_batch") = 16,
+             "Create a shared receive queue on a device context")
+        .def(py::init<const char*, size_t, size_t, size_t>(),
+             py::arg("dev_name"), py::arg("num_buffers") = 256, py::arg("buffer_size") = 4096,
+             py::arg("refill_batch") = 16,
+             "Create a shared receive queue with a ring of pre-posted buffers")
+        .def("replenish", &RDMASharedRecvQueue::replenish, py::call_guard<py::gil_scoped_release>(), "Re-post every released buffer now")
+        .def("get_buffer_size", &RDMASharedRecvQueue::get_buffer_size, "Size of each receive buffer")
+        .def("get_num_buffers", &RDMASharedRecvQueue::get_num_buffers, "Number of receive buffers");
+
+    // BufferPool 的绑定
+    py::class_<BufferPool>(m, "BufferPool")
+        .def(py::init([](RDMACommunicator& comm, const std::vector<std::pair<size_t, size_t>>& classes) {
+            BufferPool* pool = new BufferPool(comm.get_mr_cache(), classes);
+            if (!pool->valid()) {
+                delete pool;
+                throw std::runtime_error("Failed to create buffer pool");
+            }
+            return pool;
+        }), py::arg("comm"), py::arg("classes"), py::keep_alive<1, 2>(),
+            "Create a registered pool from (block_size, count) size classes")
+        .def(py::init([](std::shared_ptr<RDMAContext> ctx, const std::vector<std::pair<size_t, size_t>>& classes) {
+            BufferPool* pool = new BufferPool(ctx->get_mr_cache(), classes);
+            if (!pool->valid()) {
+                delete pool;
+                throw std::runtime_error("Failed to create buffer pool");
+            }
+            return pool;
+        }), py::arg("context"), py::arg("classes"), py::keep_alive<1, 2>(),
+            "Create a registered pool usable by every communicator of a context")
+        .def("acquire", [](BufferPool& self, size_t size) {
+            void* p = self.acquire(size);
+            if (!p) throw std::runtime_error("Buffer pool exhausted");
+            return new PoolBuffer{&self, p, size};
+        }, py::arg("size"), py::keep_alive<0, 1>(), "Acquire a buffer of at least size bytes")
+        .def("is_hugetlb", &BufferPool::is_hugetlb, "Whether the pool is backed by explicit hugepages")
+        .def("size", &BufferPool::size, "Size of the registered region")
+        .def("get_rkey", &BufferPool::get_rkey, "Get remote key of the pool region");
+
+    py::class_<PoolBuffer>(m, "PoolBuffer", py::buffer_protocol())
+        .def_buffer([](PoolBuffer& b) -> py::buffer_info {
+            if (!b.ptr) throw std::runtime_error("Buffer already released");
+            return py::buffer_info(b.ptr, 1, py::format_descriptor<uint8_t>::format(), 1,
+                                   {b.size}, {(size_t)1});
+        })
+        .def("release", &PoolBuffer::release, "Return the buffer to its pool")
+        .def("__len__", [](const PoolBuffer& b) { return b.ptr ? b.size : 0; })
+        .def_property_readonly("addr", [](const PoolBuffer& b) { return (uint64_t)(uintptr_t)b.ptr; });
+
+    // RegisteredBuffer 的绑定
+    py::class_<PyRegisteredBuffer>(m, "RegisteredBuffer", py::buffer_protocol())
+        .def(py::init([](py::object comm, py::object obj) {
+            MRCache* cache = nullptr;
+            if (py::isinstance<RDMACommunicator>(comm)) {
+                cache = comm.cast<RDMACommunicator&>().get_mr_cache();
+            } else if (py::isinstance<RDMAContext>(comm)) {
+                cache = comm.cast<std::shared_ptr<RDMAContext>>()->get_mr_cache();
+            }
+
+            std::unique_ptr<PyRegisteredBuffer> rb(new PyRegisteredBuffer());
+            rb->readonly = false;
+            try {
+                rb->source.reset(new BufferRef(obj, true));
+            } catch (py::error_already_set&) {
+                // bytes and other read-only memory can still be sent from
+                rb->source.reset(new BufferRef(obj, false));
+                rb->readonly = true;
+            }
+            {
+                py::gil_scoped_release release;
+                rb->buf.reset(new RegisteredBuffer(cache, rb->source->ptr, rb->source->size));
+            }
+            if (!rb->buf->valid()) throw std::runtime_error("Failed to register buffer");
+            rb->owner = comm;
+            return rb.release();
+        }), py::arg("comm"), py::arg("obj"),
+            "Pin the memory of obj (buffer protocol or DLPack) in the MR cache of an RDMACommunicator "
+            "or RDMAContext; with any other communicator or None only the bounds are recorded")
+        .def_buffer([](PyRegisteredBuffer& b) -> py::buffer_info {
+            if (!b.buf) throw std::runtime_error("Buffer already released");
+            return py::buffer_info(b.buf->data(), 1, py::format_descriptor<uint8_t>::format(), 1,
+                                   {(ssize_t)b.buf->size()}, {(ssize_t)1}, b.readonly);
+        })
+        .def("release", &PyRegisteredBuffer::release,
+             "Unpin the registration and drop the reference to the memory; no operation may still use it")
+        .def("__len__", [](const PyRegisteredBuffer& b) { return b.buf ? b.buf->size() : 0; })
+        .def_property_readonly("addr", [](const PyRegisteredBuffer& b) {
+            return b.buf ? (uint64_t)(uintptr_t)b.buf->data() : 0;
+        })
+        .def_property_readonly("lkey", [](const PyRegisteredBuffer& b) { return b.buf ? b.buf->get_lkey() : 0; })
+        .def_property_readonly("rkey", [](const PyRegisteredBuffer& b) { return b.buf ? b.buf->get_rkey() : 0; })
+        .def_property_readonly("readonly", [](const PyRegisteredBuffer& b) { return b.readonly; });
+
     // WireMsg 结构体的绑定
     py::class_<WireMsg>(m, "WireMsg")
         .def(py::init<>())
@@ -80,5 +1216,7 @@ PYBIND11_MODULE(pyrdma, m) {
             }
         }, "Set GID from bytes")
         .def_readwrite("rkey", &WireMsg::rkey)
-        .def_readwrite("vaddr", &WireMsg::vaddr);
+        .def_readwrite("vaddr", &WireMsg::vaddr)
+        .def_readwrite("active_mtu", &WireMsg::active_mtu)
+        .def_readwrite("rd_atomic", &WireMsg::rd_atomic);
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "rdma_communicator.h"
+#include "comm_trace.h"
+#include <arpa/inet.h>
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
@@ -6,6 +9,10 @@
 #include <unistd.h>
 #include <cerrno>
 #include <cstdio>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unordered_set>
 
 static void die(const char* msg) { 
     perror(msg); 
@@ -32,29 +39,71 @@ void RDMACommunicator::writen(int fd, const void* p, size_t n) {
     }
 }
 
-RDMACommunicator::RDMACommunicator(int fd, char* device_name, int gid_index) : 
-    socket_fd(fd), device_name(device_name), gid_index(gid_index), buf(nullptr), buf_size(0) {
+RDMACommunicator::RDMACommunicator(int fd, char* device_name, int gid_index, const QPConfig& config) : 
+    RDMACommunicator(fd, std::make_shared<RDMAContext>(device_name), gid_index, config) {
+}
+
+RDMACommunicator::RDMACommunicator(int fd, std::shared_ptr<RDMAContext> context, int gid_index,
+                                   const QPConfig& config) :
+    socket_fd(fd), gid_index(gid_index), context(context), port(context->get_port()),
+    ctx(context->get_context()), pd(context->get_pd()), channel(nullptr), send_cq(nullptr), recv_cq(nullptr), mr(nullptr),
+    mr_cache(context->get_mr_cache()), buf(nullptr), buf_size(0),
+    srq(nullptr), held_slot(-1), peer_info(), peer_caps(0), peer_version(0),
+    config(config), peer_rd_atomic(1), atomics(false), atomic_slots(nullptr), atomic_mr(nullptr),
+    next_wr_id(1), next_recv_id(0), send_outstanding(0),
+    next_rdma_qp(0), max_sge(1), max_sge_rd(1),
+    progress_running(false), progress_stop(false), progress_failed(false), progress_spin(0), wake_fd(-1),
+    event_mode(false) {
     // Initialize RDMA resources without buffer
     if (init_rdma() != 0) {
         die("Failed to initialize RDMA");
     }
 }
 
+RDMACommunicator::RDMACommunicator(int fd, RDMASharedRecvQueue* srq, int gid_index,
+                                   const QPConfig& config) :
+    socket_fd(fd), gid_index(gid_index), context(srq->get_rdma_context()), port(context->get_port()),
+    ctx(context->get_context()), pd(context->get_pd()), channel(nullptr), send_cq(nullptr), recv_cq(nullptr), mr(nullptr),
+    mr_cache(context->get_mr_cache()), buf(nullptr), buf_size(0),
+    srq(srq), held_slot(-1), peer_info(), peer_caps(0), peer_version(0),
+    config(config), peer_rd_atomic(1), atomics(false), atomic_slots(nullptr), atomic_mr(nullptr),
+    next_wr_id(1), next_recv_id(0), send_outstanding(0),
+    next_rdma_qp(0), max_sge(1), max_sge_rd(1),
+    progress_running(false), progress_stop(false), progress_failed(false), progress_spin(0), wake_fd(-1),
+    event_mode(false) {
+    if (init_rdma() != 0) {
+        die("Failed to initialize RDMA");
+    }
+}
+
 RDMACommunicator::~RDMACommunicator() {
-    if (mr) ibv_dereg_mr(mr);
+    stop_progress_thread();
+    // Pinned regions shared with other communicators of the context stay
+    if (mr) mr_cache->unpin(mr);
+    for (ibv_mr* r : regions) mr_cache->unpin(r);
+    for (ibv_mr* r : pinned) mr_cache->unpin(r);
+    if (atomic_mr) {
+        mr_cache->invalidate(atomic_slots, ATOMIC_SLOTS * sizeof(uint64_t));
+        mr_cache->unpin(atomic_mr);
+    }
     // Do not free buf as it's managed externally
-    if (qp) ibv_destroy_qp(qp);
-    if (cq) ibv_destroy_cq(cq);
-    if (pd) ibv_dealloc_pd(pd);
-    if (ctx) ibv_close_device(ctx);
+    for (ibv_qp* q : qps) ibv_destroy_qp(q);
+    // Nothing is in flight any more
+    for (auto& kv : requests) release_mrs(kv.second.mrs);
+    for (auto& g : recv_groups) release_mrs(g.mrs);
+    free(atomic_slots);
+    if (send_cq) ibv_destroy_cq(send_cq);
+    if (recv_cq) ibv_destroy_cq(recv_cq);
+    if (channel) ibv_destroy_comp_channel(channel);
+    if (wake_fd >= 0) close(wake_fd);
 }
 
 int RDMACommunicator::set_buffer(void* buffer, size_t size) {
     // Check if buffer is already set
     if (buf != nullptr) {
-        // Deregister existing memory region
+        // Release the old registration
         if (mr) {
-            ibv_dereg_mr(mr);
+            mr_cache->unpin(mr);
             mr = nullptr;
         }
         buf = nullptr;
@@ -65,68 +114,111 @@ int RDMACommunicator::set_buffer(void* buffer, size_t size) {
     buf = buffer;
     buf_size = size;
     
-    // Register buffer if it's not null
+    // Register buffer if it's not null; its rkey is handed to the peer, so
+    // the registration is pinned in the cache
     if (buf != nullptr) {
-        mr = ibv_reg_mr(pd, buf, buf_size,
-            IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ);
+        mr = mr_cache->pin(buf, buf_size, MRCache::DEFAULT_ACCESS);
         if (!mr) return -1;
     }
     
     return 0;
 }
 
-int RDMACommunicator::init_rdma() {
-    // Get device list
-    int num;
-    ibv_device **dev_list = ibv_get_device_list(&num);
-    if (!dev_list || num == 0) return -1;
-
-    printf("RDMACommunicator: device_name=%s\n", device_name);
-    for (int i = 0; i < num; i++) {
-        const char* name = ibv_get_device_name(dev_list[i]);
-        printf("RDMACommunicator: name=%s, device_name=%s\n", name, device_name);
-        if (strcmp(name, device_name) == 0) {
-            printf("RDMACommunicator: find device %s\n", device_name);
-            ctx = ibv_open_device(dev_list[i]);
-            if (!ctx) {
-                fprintf(stderr, "Could not open device %s\n", device_name);
-            }
-            break;
-        }
-    }
+int RDMACommunicator::pin_memory(void* addr, size_t len) {
+    ibv_mr* r = mr_cache->pin(addr, len, IBV_ACCESS_LOCAL_WRITE);
+    if (!r) return -1;
+    pinned.push_back(r);
+    return 0;
+}
 
-    if (!ctx) {
-        fprintf(stderr, "Could not find device %s\n", device_name);
-        return -1;
-    }
+void RDMACommunicator::invalidate_memory(void* addr, size_t len) {
+    mr_cache->invalidate(addr, len);
     
-    // Free device list
-    ibv_free_device_list(dev_list);
+    // Our pins on the range go too; operations in flight keep their
+    // registrations until they complete
+    uintptr_t start = (uintptr_t)addr;
+    if (mr && (uintptr_t)buf < start + len && start < (uintptr_t)buf + buf_size) {
+        mr_cache->unpin(mr);
+        mr = nullptr;
+    }
+    auto drop = [&](ibv_mr* r) {
+        if ((uintptr_t)r->addr >= start + len || start >= (uintptr_t)r->addr + r->length) return false;
+        mr_cache->unpin(r);
+        return true;
+    };
+    regions.erase(std::remove_if(regions.begin(), regions.end(), drop), regions.end());
+    pinned.erase(std::remove_if(pinned.begin(), pinned.end(), drop), pinned.end());
+}
+
+int RDMACommunicator::lookup_lkey(const void* addr, size_t len, int access, uint32_t* lkey,
+                                  std::vector<ibv_mr*>& held) {
+    // Held until the work request using it completed
+    ibv_mr* m = mr_cache->acquire(addr, len, access);
+    if (!m) return -1;
+    held.push_back(m);
+    *lkey = m->lkey;
+    return 0;
+}
+
+void RDMACommunicator::release_mrs(std::vector<ibv_mr*>& mrs) {
+    for (ibv_mr* m : mrs) mr_cache->release(m);
+    mrs.clear();
+}
+
+int RDMACommunicator::init_rdma() {
+    // Device, PD and MR cache come from the shared context
+    if (!context->valid()) return -1;
     
-    // Query port
-    ibv_port_attr port_attr{};
-    if (ibv_query_port(ctx, IB_PORT, &port_attr)) return -1;
+    // Query device limits
+    const ibv_device_attr& dev_attr = context->get_device_attr();
+    max_sge = std::min((int)MAX_SGE, dev_attr.max_sge);
+    max_sge_rd = std::min(max_sge, dev_attr.max_sge_rd > 0 ? dev_attr.max_sge_rd : dev_attr.max_sge);
     
-    // Allocate protection domain
-    pd = ibv_alloc_pd(ctx);
-    if (!pd) return -1;
+    if (validate_config(dev_attr)) return -1;
     
-    // Create completion queue
-    cq = ibv_create_cq(ctx, CQE, nullptr, nullptr, 0);
-    if (!cq) return -1;
+    // Separate send and receive CQs, sharing one channel so both can be waited on
+    channel = ibv_create_comp_channel(ctx);
+    if (!channel) return -1;
+    send_cq = ibv_create_cq(ctx, config.send_cq_depth, nullptr, channel, 0);
+    if (!send_cq) return -1;
+    recv_cq = ibv_create_cq(ctx, config.recv_cq_depth, nullptr, channel, 0);
+    if (!recv_cq) return -1;
     
-    // Create queue pair
+    // Create the queue pairs, all on the same CQs
     ibv_qp_init_attr qia{};
-    qia.send_cq = cq;
-    qia.recv_cq = cq;
+    qia.send_cq = send_cq;
+    qia.recv_cq = recv_cq;
     qia.qp_type = IBV_QPT_RC;
-    qia.cap.max_send_wr = 8;
-    qia.cap.max_recv_wr = 8;
-    qia.cap.max_send_sge = 1;
-    qia.cap.max_recv_sge = 1;
+    qia.cap.max_send_wr = config.max_send_wr;
+    qia.cap.max_recv_wr = config.max_recv_wr;
+    qia.cap.max_send_sge = max_sge;
+    qia.cap.max_recv_sge = max_sge;
+    qia.cap.max_inline_data = std::max(config.max_inline_data, config.inline_threshold);
+    if (srq) {
+        // Receives come from the shared queue
+        qia.srq = srq->get_srq();
+        qia.cap.max_recv_wr = 0;
+        qia.cap.max_recv_sge = 0;
+    }
     
-    qp = ibv_create_qp(pd, &qia);
+    ibv_qp* qp = ibv_create_qp(pd, &qia);
+    if (!qp && qia.cap.max_inline_data > 0 && config.max_inline_data == 0) {
+        // The device has no room for the default inline size, go without
+        qia.cap.max_inline_data = 0;
+        qp = ibv_create_qp(pd, &qia);
+    }
     if (!qp) return -1;
+    qps.push_back(qp);
+    // The provider may round the inline size up
+    config.max_inline_data = qia.cap.max_inline_data;
+    config.inline_threshold = std::min(config.inline_threshold, config.max_inline_data);
+    
+    while ((int)qps.size() < config.num_qps) {
+        qp = ibv_create_qp(pd, &qia);
+        if (!qp) return -1;
+        qps.push_back(qp);
+    }
+    qp_outstanding.assign(qps.size(), 0);
     
     // Do not allocate buffer here, it will be set externally
     // Initialize buf and buf_size to 0/nullptr
@@ -134,8 +226,85 @@ int RDMACommunicator::init_rdma() {
     buf_size = 0;
     mr = nullptr;
     
+    return init_atomics(dev_attr);
+}
+
+int RDMACommunicator::init_atomics(const ibv_device_attr& dev_attr) {
+    // Without device support atomics fail, everything else still works
+    atomics = dev_attr.atomic_cap != IBV_ATOMIC_NONE;
+    if (!atomics) return 0;
+    
+    // A page of its own, so the registration does not cover unrelated heap
+    size_t size = std::max((size_t)sysconf(_SC_PAGESIZE), ATOMIC_SLOTS * sizeof(uint64_t));
+    void* p = nullptr;
+    if (posix_memalign(&p, size, size)) return -1;
+    atomic_slots = (uint64_t*)p;
+    atomic_mr = mr_cache->pin(atomic_slots, ATOMIC_SLOTS * sizeof(uint64_t), IBV_ACCESS_LOCAL_WRITE);
+    if (!atomic_mr) return -1;
+    for (int i = 0; i < ATOMIC_SLOTS; i++) atomic_free.push_back(i);
     return 0;
+}
+
+int RDMACommunicator::validate_config(const ibv_device_attr& dev_attr) {
+    // Every signaled WR needs a CQ slot, so the CQs may not be shallower
+    // than the work queues feeding them
+    int recv_wr = srq ? (int)srq->get_num_buffers() : config.max_recv_wr;
+    if (config.max_send_wr <= 0 || config.max_send_wr > dev_attr.max_qp_wr ||
+        (!srq && (config.max_recv_wr <= 0 || config.max_recv_wr > dev_attr.max_qp_wr))) {
+        fprintf(stderr, "Work queue depth must be in [1, %d]\n", dev_attr.max_qp_wr);
+        return -1;
+    }
+    if (config.send_cq_depth < config.max_send_wr || config.recv_cq_depth < recv_wr ||
+        config.send_cq_depth > dev_attr.max_cqe || config.recv_cq_depth > dev_attr.max_cqe) {
+        fprintf(stderr, "CQ depth must be in [%d, %d] (send) and [%d, %d] (recv)\n",
+                config.max_send_wr, dev_attr.max_cqe, recv_wr, dev_attr.max_cqe);
+        return -1;
+    }
+    if (config.max_inline_data < 0) return -1;
+    if (config.inline_threshold < 0) config.inline_threshold = 0;
+    if (config.path_mtu != 0 && (config.path_mtu < IBV_MTU_256 || config.path_mtu > IBV_MTU_4096)) {
+        fprintf(stderr, "Invalid path MTU %d\n", config.path_mtu);
+        return -1;
+    }
+    
+    // RDMA READ depth: 0 picks the most both directions of the device allow
+    int rd_max = std::min(dev_attr.max_qp_rd_atom, dev_attr.max_qp_init_rd_atom);
+    if (config.max_rd_atomic == 0) config.max_rd_atomic = rd_max;
+    if (config.max_rd_atomic < 0 || config.max_rd_atomic > rd_max) {
+        fprintf(stderr, "max_rd_atomic must be in [1, %d]\n", rd_max);
+        return -1;
+    }
+    
+    if (config.timeout < 0 || config.timeout > 31 || config.retry_cnt < 0 || config.retry_cnt > 7 ||
+        config.rnr_retry < 0 || config.rnr_retry > 7 || config.min_rnr_timer < 0 || config.min_rnr_timer > 31) {
+        fprintf(stderr, "Invalid QP timeout/retry settings\n");
+        return -1;
+    }
+    config.poll_batch = std::max(1, std::min(config.poll_batch, (int)MAX_POLL_BATCH));
     
+    // Receive order across QPs cannot be recovered from a shared ring
+    if (config.num_qps < 1 || config.num_qps > dev_attr.max_qp || (srq && config.num_qps > 1) ||
+        config.stripe_size == 0) {
+        fprintf(stderr, "Invalid num_qps/stripe_size (SRQ mode needs a single QP)\n");
+        return -1;
+    }
+    // Each split message piece gathers up to one chunk per round
+    if (config.num_qps > 1 && max_sge < STRIPE_ROUNDS) {
+        fprintf(stderr, "Striping over several QPs needs %d SGEs per WR\n", (int)STRIPE_ROUNDS);
+        return -1;
+    }
+    // The CQs are shared by every QP
+    int cq_min = std::min(config.num_qps * config.max_send_wr, dev_attr.max_cqe);
+    config.send_cq_depth = std::max(config.send_cq_depth, cq_min);
+    cq_min = std::min(config.num_qps * recv_wr, dev_attr.max_cqe);
+    config.recv_cq_depth = std::max(config.recv_cq_depth, cq_min);
+    return 0;
+}
+
+int RDMACommunicator::modify_qp(ibv_qp_attr& attr, int mask) {
+    for (ibv_qp* q : qps) {
+        if (ibv_modify_qp(q, &attr, mask)) return -1;
+    }
     return 0;
 }
 
@@ -143,70 +312,93 @@ int RDMACommunicator::modify_qp_to_init() {
     ibv_qp_attr attr{};
     attr.qp_state = IBV_QPS_INIT;
     attr.pkey_index = 0;
-    attr.port_num = IB_PORT;
+    attr.port_num = port;
     attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_LOCAL_WRITE;
+    if (atomics) attr.qp_access_flags |= IBV_ACCESS_REMOTE_ATOMIC;
     
-    return ibv_modify_qp(qp, &attr,
+    return modify_qp(attr,
         IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS);
 }
 
 int RDMACommunicator::modify_qp_to_rtr(WireMsg& peer) {
     ibv_qp_attr attr{};
     attr.qp_state = IBV_QPS_RTR;
-    attr.path_mtu = IBV_MTU_1024;
+    // Use the configured MTU, or the smaller of both active port MTUs
+    int mtu = config.path_mtu;
+    if (mtu == 0) {
+        mtu = context->get_port_attr().active_mtu;
+        if (peer.active_mtu >= IBV_MTU_256 && peer.active_mtu < mtu) mtu = peer.active_mtu;
+    }
+    attr.path_mtu = (ibv_mtu)mtu;
     attr.dest_qp_num = peer.qpn;
     attr.rq_psn = peer.psn;
-    attr.max_dest_rd_atomic = 1;
-    attr.min_rnr_timer = 12;
+    attr.max_dest_rd_atomic = config.max_rd_atomic;
+    attr.min_rnr_timer = config.min_rnr_timer;
+    // Our initiator depth may not exceed the peer's responder resources
+    if (peer.rd_atomic > 0) peer_rd_atomic = peer.rd_atomic;
     attr.ah_attr.is_global = (peer.lid == 0); // RoCE path if no LID
     attr.ah_attr.sl = 0;
     attr.ah_attr.src_path_bits = 0;
-    attr.ah_attr.port_num = IB_PORT;
+    attr.ah_attr.port_num = port;
     
     if (attr.ah_attr.is_global) {
         memcpy(&attr.ah_attr.grh.dgid, peer.gid, 16);
         attr.ah_attr.grh.hop_limit = 1;
-        attr.ah_attr.grh.sgid_index = DEFAULT_GID_INDEX;
+        attr.ah_attr.grh.sgid_index = gid_index;
         attr.ah_attr.dlid = 0;
     } else {
         attr.ah_attr.dlid = peer.lid;
     }
     
-    return ibv_modify_qp(qp, &attr,
-        IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
-        IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
-        IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER);
+    // QP i connects to the peer's QP i
+    if (peer_qpns.size() + 1 != qps.size()) {
+        fprintf(stderr, "Peer has %zu QPs, expected %zu\n", peer_qpns.size() + 1, qps.size());
+        return -1;
+    }
+    for (size_t i = 0; i < qps.size(); i++) {
+        attr.dest_qp_num = (i == 0) ? peer.qpn : peer_qpns[i - 1];
+        if (ibv_modify_qp(qps[i], &attr,
+                IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+                IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) return -1;
+    }
+    return 0;
 }
 
 int RDMACommunicator::modify_qp_to_rts(WireMsg& self) {
     ibv_qp_attr attr{};
     attr.qp_state = IBV_QPS_RTS;
-    attr.timeout = 14;
-    attr.retry_cnt = 7;
-    attr.rnr_retry = 7;
+    attr.timeout = config.timeout;
+    attr.retry_cnt = config.retry_cnt;
+    attr.rnr_retry = config.rnr_retry;
     attr.sq_psn = self.psn;
-    attr.max_rd_atomic = 1;
+    attr.max_rd_atomic = std::min(config.max_rd_atomic, peer_rd_atomic);
     
-    return ibv_modify_qp(qp, &attr,
+    return modify_qp(attr,
         IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
         IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC);
 }
 
 int RDMACommunicator::exchange_qp_info(WireMsg& self, WireMsg& peer) {
+    // WireMsg has room for one QP; use connect()/accept() for several
+    if (qps.size() > 1) return -1;
+    
     // Query local GID
     ibv_gid gid{};
-    if (ibv_query_gid(ctx, IB_PORT, DEFAULT_GID_INDEX, &gid)) return -1;
+    if (ibv_query_gid(ctx, port, gid_index, &gid)) return -1;
     
     // Fill self information
-    self.qpn = qp->qp_num;
+    self.qpn = qps[0]->qp_num;
     self.psn = rand() & 0xffffff;
     
     // Query port attributes to get LID
     ibv_port_attr port_attr{};
-    if (ibv_query_port(ctx, IB_PORT, &port_attr)) return -1;
+    if (ibv_query_port(ctx, port, &port_attr)) return -1;
     self.lid = port_attr.lid;
     
     memcpy(self.gid, &gid, 16);
+    self.active_mtu = port_attr.active_mtu;
+    self.rd_atomic = (uint8_t)std::min(config.max_rd_atomic, 255);
     
     // Only set rkey and vaddr if buffer is set
     if (mr) {
@@ -224,139 +416,1261 @@ int RDMACommunicator::exchange_qp_info(WireMsg& self, WireMsg& peer) {
     return 0;
 }
 
-int RDMACommunicator::send(const void* buf, size_t len, size_t offset) {
-    // Use RDMA SEND to send data
-    ibv_sge sge{};
-    sge.addr = (uintptr_t)buf + offset;
-    sge.length = len;
-    sge.lkey = mr->lkey;
+int RDMACommunicator::expose_memory(void* addr, size_t len) {
+    ibv_mr* r = mr_cache->pin(addr, len, MRCache::DEFAULT_ACCESS);
+    if (!r) return -1;
+    regions.push_back(r);
+    return 0;
+}
+
+int RDMACommunicator::fill_handshake(HandshakeMsg& msg, WireMsg& self) {
+    ibv_gid gid{};
+    if (ibv_query_gid(ctx, port, gid_index, &gid)) return -1;
+    const ibv_port_attr& port_attr = context->get_port_attr();
     
-    ibv_send_wr wr{};
-    wr.wr_id = 3;
-    wr.opcode = IBV_WR_SEND;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.send_flags = IBV_SEND_SIGNALED;
+    self = WireMsg();
+    self.qpn = qps[0]->qp_num;
+    self.psn = rand() & 0xffffff;
+    self.lid = port_attr.lid;
+    memcpy(self.gid, &gid, 16);
+    self.active_mtu = port_attr.active_mtu;
+    self.rd_atomic = (uint8_t)std::min(config.max_rd_atomic, 255);
+    if (mr) {
+        self.rkey = mr->rkey;
+        self.vaddr = (uint64_t)(uintptr_t)buf;
+    }
     
-    ibv_send_wr* bad = nullptr;
-    if (ibv_post_send(qp, &wr, &bad)) return -1;
+    msg.version = HS_VERSION;
+    msg.flags = (config.inline_threshold > 0 ? HS_CAP_INLINE : 0) | (srq ? HS_CAP_SRQ : 0);
+    msg.qpn = self.qpn;
+    msg.psn = self.psn;
+    msg.lid = self.lid;
+    memcpy(msg.gid, self.gid, 16);
+    msg.active_mtu = self.active_mtu;
+    msg.rd_atomic = self.rd_atomic;
+    msg.max_send_wr = config.max_send_wr;
+    msg.max_recv_wr = srq ? srq->get_num_buffers() : config.max_recv_wr;
+    msg.max_inline_data = config.max_inline_data;
+    msg.extra_qpns.clear();
+    for (size_t i = 1; i < qps.size(); i++) msg.extra_qpns.push_back(qps[i]->qp_num);
     
-    // Poll completion
-    ibv_wc wc{};
-    int np;
-    do { 
-        np = ibv_poll_cq(cq, 1, &wc); 
-    } while (np == 0);
+    // The set_buffer region comes first, then every exposed region
+    msg.mrs.clear();
+    if (mr) msg.mrs.push_back(MRDescriptor{ (uint64_t)(uintptr_t)buf, buf_size, mr->rkey });
+    for (ibv_mr* r : regions) {
+        msg.mrs.push_back(MRDescriptor{ (uint64_t)(uintptr_t)r->addr, r->length, r->rkey });
+    }
+    return 0;
+}
+
+int RDMACommunicator::apply_handshake(const HandshakeMsg& peer, WireMsg& self) {
+    peer_version = std::min(peer.version, HS_VERSION);
+    peer_caps = peer.flags;
+    peer_regions = peer.mrs;
+    peer_qpns = peer.extra_qpns;
     
-    if (np < 0 || wc.status != IBV_WC_SUCCESS) {
-        return -1;
+    peer_info = WireMsg();
+    peer_info.qpn = peer.qpn;
+    peer_info.psn = peer.psn;
+    peer_info.lid = peer.lid;
+    memcpy(peer_info.gid, peer.gid, 16);
+    peer_info.active_mtu = peer.active_mtu;
+    peer_info.rd_atomic = peer.rd_atomic;
+    if (!peer.mrs.empty()) {
+        peer_info.rkey = peer.mrs[0].rkey;
+        peer_info.vaddr = peer.mrs[0].addr;
     }
     
-    // we set wr.wr_id = 3, 
-    // so we return wc.byte_len if wr.wr_id == 3
-    if (wc.wr_id == 3) {
-        return wc.byte_len;
+    if (modify_qp_to_rtr(peer_info)) return -1;
+    return modify_qp_to_rts(self);
+}
+
+int RDMACommunicator::connect() {
+    HandshakeMsg local, peer;
+    WireMsg self;
+    if (modify_qp_to_init() || fill_handshake(local, self)) return -1;
+    if (send_handshake(socket_fd, local) || recv_handshake(socket_fd, peer)) return -1;
+    return apply_handshake(peer, self);
+}
+
+int RDMACommunicator::accept() {
+    HandshakeMsg local, peer;
+    WireMsg self;
+    if (modify_qp_to_init() || fill_handshake(local, self)) return -1;
+    if (recv_handshake(socket_fd, peer)) return -1;
+    // Reply only once the QP is ready, so the peer may send right away
+    if (apply_handshake(peer, self)) return -1;
+    return send_handshake(socket_fd, local);
+}
+
+static StatsOp stats_op_of(ibv_wr_opcode opcode) {
+    switch (opcode) {
+    case IBV_WR_SEND: return STATS_SEND;
+    case IBV_WR_RDMA_READ: return STATS_READ;
+    case IBV_WR_ATOMIC_FETCH_AND_ADD:
+    case IBV_WR_ATOMIC_CMP_AND_SWP: return STATS_ATOMIC;
+    default: return STATS_WRITE;
     }
-    return -1;
 }
 
-int RDMACommunicator::post_receive(void* buf, size_t len, size_t offset) {
-    ibv_sge sge{};
-    sge.addr = (uintptr_t)buf + offset;
-    sge.length = len;
-    sge.lkey = mr->lkey;
+// Bytes covered by the SGEs of a send or receive WR
+template <typename WR>
+static uint64_t wr_bytes(const WR& wr) {
+    uint64_t n = 0;
+    for (int i = 0; i < wr.num_sge; i++) n += wr.sg_list[i].length;
+    return n;
+}
+
+int64_t RDMACommunicator::post_send_wr(ibv_send_wr& wr, int qp_idx, uint64_t parent, std::vector<ibv_mr*>* mrs) {
+    // Takes over the registrations in mrs, even if the WR is not posted
+    std::vector<ibv_mr*> held;
+    if (mrs) held.swap(*mrs);
+    std::unique_lock<std::mutex> lock(mtx);
+    // One-sided ops without a fixed QP are spread round-robin
+    if (qp_idx < 0) qp_idx = (int)(next_rdma_qp++ % qps.size());
     
-    ibv_recv_wr wr{};
-    wr.wr_id = 2;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
+    // Keep the send queue from overflowing by reaping completions first
+    while (qp_outstanding[qp_idx] >= config.max_send_wr) {
+        if (progress(lock, send_cq) < 0) {
+            release_mrs(held);
+            return -1;
+        }
+    }
+    
+    uint64_t id = next_wr_id++;
+    wr.wr_id = id;
+    wr.send_flags |= IBV_SEND_SIGNALED;
+    
+    StatsOp op = stats_op_of(wr.opcode);
+    uint64_t post_ns = CommStats::now_ns();
+    ibv_send_wr* bad = nullptr;
+    if (ibv_post_send(qps[qp_idx], &wr, &bad)) {
+        op_stats.record_error(op);
+        release_mrs(held);
+        return -1;
+    }
+    op_stats.record_post(op, 1, wr_bytes(wr));
+    if (trace_enabled()) {
+        trace_record(TRACE_POST, stats_op_name(op), this, id, wr_bytes(wr), qps[qp_idx]->qp_num, 0);
+    }
     
-    ibv_recv_wr* bad = nullptr;
-    return ibv_post_recv(qp, &wr, &bad);
+    RDMARequest& req = requests[id];
+    req.state = REQ_PENDING;
+    req.result = 0;
+    req.wr_count = 1;
+    req.detached = parent != 0;
+    req.qp = qp_idx;
+    req.parent = parent;
+    req.children = 0;
+    req.failed = false;
+    req.stats_op = op;
+    req.post_ns = post_ns;
+    req.mrs.swap(held);
+    send_outstanding++;
+    qp_outstanding[qp_idx]++;
+    return (int64_t)id;
 }
 
-int RDMACommunicator::recv(void* buf, size_t len, size_t offset) {
-    // Poll completion queue for received data
-    ibv_wc wc{};
-    int np;
-    do { 
-        np = ibv_poll_cq(cq, 1, &wc); 
-    } while (np == 0);
+uint64_t RDMACommunicator::new_parent(int children, std::vector<ibv_mr*>* mrs) {
+    // The registrations in mrs cover every child and go with the parent
+    std::lock_guard<std::mutex> lock(mtx);
+    uint64_t id = next_wr_id++;
+    RDMARequest& req = requests[id];
+    req.state = REQ_PENDING;
+    req.result = 0;
+    req.wr_count = 0;
+    req.detached = false;
+    req.qp = 0;
+    req.parent = 0;
+    req.children = children;
+    req.failed = false;
+    req.stats_op = STATS_NUM_OPS;
+    req.post_ns = 0;
+    if (mrs) req.mrs.swap(*mrs);
+    return id;
+}
+
+void RDMACommunicator::abort_children(uint64_t parent, int unposted) {
+    // Children that were never posted will not complete; the parent is
+    // dropped once the posted ones have
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = requests.find(parent);
+    if (it == requests.end()) return;
+    it->second.detached = true;
+    it->second.children -= unposted - 1;
+    complete_child(parent, false, 0);
+}
+
+void RDMACommunicator::complete_child(uint64_t parent, bool ok, int result) {
+    auto it = requests.find(parent);
+    if (it == requests.end()) return;
+    RDMARequest& req = it->second;
+    if (!ok) req.failed = true;
+    req.result += result;
+    if (--req.children > 0) return;
     
-    if (np < 0 || wc.status != IBV_WC_SUCCESS) {
-        return -1;
+    release_mrs(req.mrs);
+    if (req.detached) {
+        requests.erase(it);
+        return;
+    }
+    req.state = req.failed ? REQ_ERROR : REQ_DONE;
+    if (event_mode) event_done.push_back((int64_t)parent);
+}
+
+int64_t RDMACommunicator::post_striped(ibv_wr_opcode opcode, const void* local_buf, size_t len,
+                                       uint64_t remote_addr, uint32_t rkey) {
+    // One registration lookup covers every chunk
+    uint32_t lkey;
+    std::vector<ibv_mr*> held;
+    int access = (opcode == IBV_WR_RDMA_READ) ? IBV_ACCESS_LOCAL_WRITE : 0;
+    if (lookup_lkey(local_buf, len, access, &lkey, held)) return -1;
+    
+    size_t chunk = config.stripe_size;
+    int n = (int)((len + chunk - 1) / chunk);
+    uint64_t parent = new_parent(n, &held);
+    
+    for (int i = 0; i < n; i++) {
+        size_t off = (size_t)i * chunk;
+        ibv_sge sge{};
+        sge.addr = (uintptr_t)local_buf + off;
+        sge.length = std::min(chunk, len - off);
+        sge.lkey = lkey;
+        
+        ibv_send_wr wr{};
+        wr.opcode = opcode;
+        wr.sg_list = &sge;
+        wr.num_sge = 1;
+        wr.wr.rdma.remote_addr = remote_addr + off;
+        wr.wr.rdma.rkey = rkey;
+        
+        if (post_send_wr(wr, -1, parent) < 0) {
+            abort_children(parent, n - i);
+            return -1;
+        }
+    }
+    return (int64_t)parent;
+}
+
+int RDMACommunicator::split_message(const ibv_sge* sges, int nsge, std::vector<std::vector<ibv_sge>>& pieces) {
+    // Chunk c of the message goes to piece c % K for the first STRIPE_ROUNDS
+    // rounds, everything after to the last piece. What a piece carries only
+    // grows with the message length, and at the message's own offsets, so a
+    // longer receive split the same way has room for every piece in place.
+    size_t k = qps.size();
+    uint64_t chunk = config.stripe_size;
+    uint64_t last_chunk = (uint64_t)k * STRIPE_ROUNDS - 1;
+    pieces.assign(k, std::vector<ibv_sge>());
+    uint64_t pos = 0;
+    for (int i = 0; i < nsge; i++) {
+        uint64_t addr = sges[i].addr;
+        uint64_t left = sges[i].length;
+        while (left > 0) {
+            uint64_t c = std::min(pos / chunk, last_chunk);
+            uint64_t n = (c < last_chunk) ? std::min(left, (c + 1) * chunk - pos) : left;
+            std::vector<ibv_sge>& piece = pieces[c % k];
+            if (!piece.empty() && piece.back().addr + piece.back().length == addr &&
+                piece.back().lkey == sges[i].lkey && piece.back().length + n <= UINT32_MAX) {
+                piece.back().length += (uint32_t)n;
+            } else {
+                if ((int)piece.size() == max_sge) return -1;
+                ibv_sge sge{};
+                sge.addr = addr;
+                sge.length = (uint32_t)n;
+                sge.lkey = sges[i].lkey;
+                piece.push_back(sge);
+            }
+            addr += n;
+            left -= n;
+            pos += n;
+        }
     }
+    return 0;
+}
+
+int64_t RDMACommunicator::post_message(ibv_send_wr& wr, std::vector<ibv_mr*>& held) {
+    // Called with send_order_mtx held. With one QP the message is one WR
+    if (qps.size() == 1) return post_send_wr(wr, 0, 0, &held);
     
-    // For RECV operations, the data is already in the buffer
-    // We just need to return the number of bytes received
-    // The wr_id for RECV operations should be 2
-    if (wc.wr_id == 2) {
-        return wc.byte_len;
+    // Otherwise one WR per QP, matching the receives of post_recv_message();
+    // a write_with_imm goes whole on the first QP, the others carry nothing
+    std::vector<std::vector<ibv_sge>> pieces;
+    if (wr.opcode == IBV_WR_SEND) {
+        if (split_message(wr.sg_list, wr.num_sge, pieces)) {
+            release_mrs(held);
+            return -1;
+        }
+    } else {
+        pieces.resize(qps.size());
+        pieces[0].assign(wr.sg_list, wr.sg_list + wr.num_sge);
     }
     
-    return -1;
+    int n = (int)pieces.size();
+    uint64_t parent = new_parent(n, &held);
+    for (int i = 0; i < n; i++) {
+        ibv_send_wr piece{};
+        piece.opcode = (i == 0) ? wr.opcode : IBV_WR_SEND;
+        piece.sg_list = pieces[i].data();
+        piece.num_sge = (int)pieces[i].size();
+        if (piece.num_sge > 0) piece.send_flags = wr.send_flags;
+        if (i == 0) {
+            piece.imm_data = wr.imm_data;
+            piece.wr.rdma = wr.wr.rdma;
+        }
+        if (post_send_wr(piece, i, parent) < 0) {
+            abort_children(parent, n - i);
+            return -1;
+        }
+    }
+    return (int64_t)parent;
 }
 
-int RDMACommunicator::write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+int64_t RDMACommunicator::post_rdma(ibv_wr_opcode opcode, const void* local_buf, size_t len,
+                                    uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    if (qps.size() > 1 && len > config.stripe_size) {
+        return post_striped(opcode, (const char*)local_buf + offset, len, remote_addr + offset, rkey);
+    }
+    
     ibv_sge sge{};
     sge.addr = (uintptr_t)local_buf + offset;
     sge.length = len;
-    sge.lkey = mr->lkey;
-    
     ibv_send_wr wr{};
-    wr.wr_id = 1;
-    wr.opcode = IBV_WR_RDMA_WRITE;
+    std::vector<ibv_mr*> held;
+    if (opcode == IBV_WR_RDMA_WRITE && len <= (size_t)config.inline_threshold) {
+        // Copied into the WQE by the CPU, so no registration is needed
+        wr.send_flags = IBV_SEND_INLINE;
+    } else {
+        int access = (opcode == IBV_WR_RDMA_READ) ? IBV_ACCESS_LOCAL_WRITE : 0;
+        if (lookup_lkey((void*)sge.addr, len, access, &sge.lkey, held)) return -1;
+    }
+    
+    wr.opcode = opcode;
     wr.sg_list = &sge;
     wr.num_sge = 1;
-    wr.send_flags = IBV_SEND_SIGNALED;
     wr.wr.rdma.remote_addr = remote_addr + offset;
     wr.wr.rdma.rkey = rkey;
     
-    ibv_send_wr* bad = nullptr;
-    if (ibv_post_send(qp, &wr, &bad)) return -1;
+    return post_send_wr(wr, -1, 0, &held);
+}
+
+int64_t RDMACommunicator::post_atomic(ibv_wr_opcode opcode, uint64_t remote_addr, uint32_t rkey,
+                                      uint64_t compare_add, uint64_t swap, uint64_t* result) {
+    // The HCA would fail these with a remote error, catch them here
+    if (!atomics || remote_addr % 8 || (uintptr_t)result % 8) return -1;
     
-    // Poll completion
-    ibv_wc wc{};
-    int np;
-    do { 
-        np = ibv_poll_cq(cq, 1, &wc); 
-    } while (np == 0);
+    ibv_sge sge{};
+    sge.addr = (uintptr_t)result;
+    sge.length = sizeof(uint64_t);
+    std::vector<ibv_mr*> held;
+    if (lookup_lkey(result, sizeof(uint64_t), IBV_ACCESS_LOCAL_WRITE, &sge.lkey, held)) return -1;
+    
+    ibv_send_wr wr{};
+    wr.opcode = opcode;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.wr.atomic.remote_addr = remote_addr;
+    wr.wr.atomic.rkey = rkey;
+    wr.wr.atomic.compare_add = compare_add;
+    wr.wr.atomic.swap = swap;
+    
+    return post_send_wr(wr, -1, 0, &held);
+}
+
+int64_t RDMACommunicator::post_fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* result) {
+    return post_atomic(IBV_WR_ATOMIC_FETCH_AND_ADD, remote_addr, rkey, add, 0, result);
+}
+
+int64_t RDMACommunicator::post_compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap,
+                                            uint64_t* result) {
+    return post_atomic(IBV_WR_ATOMIC_CMP_AND_SWP, remote_addr, rkey, compare, swap, result);
+}
+
+int RDMACommunicator::atomic_op(ibv_wr_opcode opcode, uint64_t remote_addr, uint32_t rkey,
+                                uint64_t compare_add, uint64_t swap, uint64_t* old) {
+    if (!atomics) return -1;
+    
+    // Borrow a registered result slot, so callers need not register anything
+    int slot;
+    {
+        std::unique_lock<std::mutex> lock(atomic_mtx);
+        atomic_cv.wait(lock, [this] { return !atomic_free.empty(); });
+        slot = atomic_free.back();
+        atomic_free.pop_back();
+    }
+    
+    int64_t req = post_atomic(opcode, remote_addr, rkey, compare_add, swap, &atomic_slots[slot]);
+    int ret = (req < 0) ? -1 : wait(req);
+    if (ret == 0) *old = atomic_slots[slot];
+    
+    {
+        std::lock_guard<std::mutex> lock(atomic_mtx);
+        atomic_free.push_back(slot);
+    }
+    atomic_cv.notify_one();
+    return ret;
+}
+
+int RDMACommunicator::fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) {
+    return atomic_op(IBV_WR_ATOMIC_FETCH_AND_ADD, remote_addr, rkey, add, 0, old);
+}
+
+int RDMACommunicator::compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap,
+                                   uint64_t* old) {
+    return atomic_op(IBV_WR_ATOMIC_CMP_AND_SWP, remote_addr, rkey, compare, swap, old);
+}
+
+int RDMACommunicator::fill_sges(const struct iovec* iov, int iovcnt, int limit, int access, ibv_sge* sges,
+                                std::vector<ibv_mr*>& held) {
+    if (iovcnt <= 0 || iovcnt > limit) return -1;
+    for (int i = 0; i < iovcnt; i++) {
+        sges[i].addr = (uintptr_t)iov[i].iov_base;
+        sges[i].length = iov[i].iov_len;
+        if (lookup_lkey(iov[i].iov_base, iov[i].iov_len, access, &sges[i].lkey, held)) {
+            release_mrs(held);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int RDMACommunicator::fill_inline_sges(const struct iovec* iov, int iovcnt, ibv_sge* sges) {
+    // Returns 1 if the segments are small enough to be sent inline
+    if (iovcnt <= 0 || iovcnt > max_sge) return 0;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (total > (size_t)config.inline_threshold) return 0;
     
-    if (np < 0 || wc.status != IBV_WC_SUCCESS) {
+    for (int i = 0; i < iovcnt; i++) {
+        sges[i].addr = (uintptr_t)iov[i].iov_base;
+        sges[i].length = iov[i].iov_len;
+        sges[i].lkey = 0;
+    }
+    return 1;
+}
+
+int64_t RDMACommunicator::post_rdmav(ibv_wr_opcode opcode, const struct iovec* iov, int iovcnt,
+                                     uint64_t remote_addr, uint32_t rkey) {
+    ibv_sge sges[MAX_SGE];
+    bool is_read = (opcode == IBV_WR_RDMA_READ);
+    ibv_send_wr wr{};
+    std::vector<ibv_mr*> held;
+    if (!is_read && fill_inline_sges(iov, iovcnt, sges)) {
+        wr.send_flags = IBV_SEND_INLINE;
+    } else if (fill_sges(iov, iovcnt, is_read ? max_sge_rd : max_sge,
+                         is_read ? IBV_ACCESS_LOCAL_WRITE : 0, sges, held)) {
         return -1;
     }
     
+    wr.opcode = opcode;
+    wr.sg_list = sges;
+    wr.num_sge = iovcnt;
+    wr.wr.rdma.remote_addr = remote_addr;
+    wr.wr.rdma.rkey = rkey;
+    
+    return post_send_wr(wr, -1, 0, &held);
+}
+
+int64_t RDMACommunicator::post_batch(ibv_wr_opcode opcode, const void* local_buf,
+                                     const std::vector<RDMABatchEntry>& entries, uint32_t rkey, int signal_every) {
+    if (entries.empty()) return -1;
+    if (signal_every <= 0) signal_every = (int)entries.size();
+    
+    // Resolve one registration spanning every local range of the batch
+    size_t lo = entries[0].local_offset, hi = 0;
+    for (const auto& e : entries) {
+        lo = std::min(lo, e.local_offset);
+        hi = std::max(hi, e.local_offset + e.len);
+    }
+    uint32_t lkey;
+    std::vector<ibv_mr*> held;
+    int access = (opcode == IBV_WR_RDMA_READ) ? IBV_ACCESS_LOCAL_WRITE : 0;
+    if (lookup_lkey((const char*)local_buf + lo, hi - lo, access, &lkey, held)) return -1;
+    
+    std::vector<ibv_sge> sges(entries.size());
+    std::vector<ibv_send_wr> wrs(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        sges[i].addr = (uintptr_t)local_buf + entries[i].local_offset;
+        sges[i].length = entries[i].len;
+        sges[i].lkey = lkey;
+        
+        wrs[i] = ibv_send_wr{};
+        wrs[i].opcode = opcode;
+        wrs[i].sg_list = &sges[i];
+        wrs[i].num_sge = 1;
+        wrs[i].wr.rdma.remote_addr = entries[i].remote_addr;
+        wrs[i].wr.rdma.rkey = rkey;
+    }
+    
+    // The parent holds one extra child until every chain is posted, and the
+    // registration until every chain completed
+    uint64_t parent = new_parent(1, &held);
+    
+    // Post in chains that fit the send queue, one doorbell per chain,
+    // spreading the chains over the QPs
+    StatsOp op = stats_op_of(opcode);
+    std::unique_lock<std::mutex> lock(mtx);
+    size_t pos = 0;
+    while (pos < entries.size()) {
+        int qp_idx = (int)(next_rdma_qp++ % qps.size());
+        size_t n = std::min(entries.size() - pos, (size_t)config.max_send_wr);
+        while (qp_outstanding[qp_idx] + (int)n > config.max_send_wr) {
+            if (progress(lock, send_cq) < 0) {
+                requests[parent].detached = true;
+                complete_child(parent, false, 0);
+                return -1;
+            }
+        }
+        
+        int unsignaled = 0;
+        uint64_t post_ns = CommStats::now_ns();
+        uint64_t bytes = 0;
+        for (size_t i = pos; i < pos + n; i++) {
+            bytes += entries[i].len;
+            wrs[i].next = (i + 1 < pos + n) ? &wrs[i + 1] : nullptr;
+            unsignaled++;
+            if (unsignaled < signal_every && i + 1 < pos + n) {
+                wrs[i].wr_id = 0;
+                wrs[i].send_flags = 0;
+                continue;
+            }
+            
+            // Every signaled WR retires the unsignaled ones posted before it
+            uint64_t id = next_wr_id++;
+            wrs[i].wr_id = id;
+            wrs[i].send_flags = IBV_SEND_SIGNALED;
+            RDMARequest& req = requests[id];
+            req.state = REQ_PENDING;
+            req.result = 0;
+            req.wr_count = unsignaled;
+            req.detached = true;
+            req.qp = qp_idx;
+            req.parent = parent;
+            req.children = 0;
+            req.failed = false;
+            req.stats_op = op;
+            req.post_ns = post_ns;
+            requests[parent].children++;
+            unsignaled = 0;
+        }
+        
+        ibv_send_wr* bad = nullptr;
+        if (ibv_post_send(qps[qp_idx], &wrs[pos], &bad)) {
+            // Forget requests that were never handed to the device
+            for (ibv_send_wr* w = bad; w; w = w->next) {
+                if (w->wr_id) {
+                    requests.erase(w->wr_id);
+                    requests[parent].children--;
+                }
+            }
+            // Only WRs up to the last posted signaled one are retired by a
+            // completion; the unsignaled tail behind it needs a signaled WR
+            int covered = 0, tail = 0;
+            ibv_send_wr* last = nullptr;
+            for (ibv_send_wr* w = &wrs[pos]; w != bad; w = w->next) {
+                tail++;
+                last = w;
+                if (w->wr_id) {
+                    covered += tail;
+                    tail = 0;
+                }
+            }
+            if (tail > 0) {
+                // A zero-length WR of the same kind, not counted in the stats.
+                // If it cannot be posted either, the tail is left uncounted
+                ibv_send_wr cover = ibv_send_wr{};
+                cover.wr_id = next_wr_id++;
+                cover.opcode = opcode;
+                cover.send_flags = IBV_SEND_SIGNALED;
+                cover.wr.rdma.remote_addr = last->wr.rdma.remote_addr;
+                cover.wr.rdma.rkey = rkey;
+                ibv_send_wr* cover_bad = nullptr;
+                if (ibv_post_send(qps[qp_idx], &cover, &cover_bad) == 0) {
+                    RDMARequest& req = requests[cover.wr_id];
+                    req.state = REQ_PENDING;
+                    req.result = 0;
+                    req.wr_count = tail + 1;
+                    req.detached = true;
+                    req.qp = qp_idx;
+                    req.parent = parent;
+                    req.children = 0;
+                    req.failed = false;
+                    req.stats_op = STATS_NUM_OPS;
+                    req.post_ns = post_ns;
+                    requests[parent].children++;
+                    covered += tail + 1;
+                }
+            }
+            op_stats.record_error(op);
+            send_outstanding += covered;
+            qp_outstanding[qp_idx] += covered;
+            requests[parent].detached = true;
+            complete_child(parent, false, 0);
+            return -1;
+        }
+        op_stats.record_post(op, n, bytes);
+        if (trace_enabled()) {
+            // One slice per signaled WR, covering the WRs it retires
+            uint64_t covered = 0;
+            for (size_t i = pos; i < pos + n; i++) {
+                covered += entries[i].len;
+                if (!wrs[i].wr_id) continue;
+                trace_record(TRACE_POST, stats_op_name(op), this, wrs[i].wr_id, covered,
+                             qps[qp_idx]->qp_num, 0);
+                covered = 0;
+            }
+        }
+        send_outstanding += n;
+        qp_outstanding[qp_idx] += n;
+        pos += n;
+    }
+    
+    // Drop the guard, the last chain to complete completes the batch
+    complete_child(parent, true, 0);
+    return (int64_t)parent;
+}
+
+int RDMACommunicator::poll_cq(std::unique_lock<std::mutex>& lock, ibv_cq* cq) {
+    // Reap up to poll_batch completions with mtx dropped, so a thread
+    // waiting here never keeps others from posting or collecting, then
+    // route each to its owner under it
+    ibv_wc wcs[MAX_POLL_BATCH];
+    lock.unlock();
+    std::lock_guard<std::mutex> order(poll_mtx);
+    int np = ibv_poll_cq(cq, config.poll_batch, wcs);
+    if (np == 0) op_stats.record_empty_poll();
+    if (np > 0 && trace_enabled()) trace_record(TRACE_POLL, "poll", this, 0, 0, 0, np);
+    lock.lock();
+    for (int i = 0; i < np; i++) dispatch(wcs[i]);
+    return np;
+}
+
+int RDMACommunicator::progress(std::unique_lock<std::mutex>& lock, ibv_cq* cq) {
+    // Called with mtx held, which is dropped meanwhile; either wait for the
+    // progress thread or poll the CQ the caller is waiting on inline
+    if (progress_running.load(std::memory_order_acquire)) {
+        if (progress_failed) return -1;
+        cv.wait(lock);
+        return 0;
+    }
+    return poll_cq(lock, cq);
+}
+
+int RDMACommunicator::start_progress_thread(int spin_count) {
+    if (progress_running.load()) return 0;
+    if (event_mode) return -1;
+    
+    // Non-blocking channel so a spurious wakeup never blocks the thread
+    int flags = fcntl(channel->fd, F_GETFL);
+    if (fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    if (wake_fd < 0) wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0) return -1;
+    
+    progress_spin = std::max(spin_count, (int)MIN_SPIN);
+    progress_failed = false;
+    progress_stop.store(false);
+    progress_running.store(true);
+    progress_thread = std::thread(&RDMACommunicator::progress_loop, this);
     return 0;
 }
 
-int RDMACommunicator::read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+void RDMACommunicator::stop_progress_thread() {
+    if (!progress_running.load()) return;
+    
+    progress_stop.store(true);
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0) perror("eventfd write");
+    progress_thread.join();
+    if (::read(wake_fd, &one, sizeof(one)) < 0) perror("eventfd read");
+    
+    std::lock_guard<std::mutex> lock(mtx);
+    progress_running.store(false);
+    cv.notify_all();
+}
+
+int RDMACommunicator::get_event_fd() {
+    if (event_mode) return channel->fd;
+    if (progress_running.load()) return -1;
+    
+    int flags = fcntl(channel->fd, F_GETFL);
+    if (fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    if (ibv_req_notify_cq(send_cq, 0) || ibv_req_notify_cq(recv_cq, 0)) return -1;
+    std::lock_guard<std::mutex> lock(mtx);
+    event_mode = true;
+    return channel->fd;
+}
+
+int RDMACommunicator::process_events(std::vector<int64_t>& done) {
+    if (!event_mode) return -1;
+    
+    // The fd stays readable until every event is consumed
+    ibv_cq* ev_cq;
+    void* ev_ctx;
+    while (ibv_get_cq_event(channel, &ev_cq, &ev_ctx) == 0) ibv_ack_cq_events(ev_cq, 1);
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    
+    // Re-arm before draining: a completion that lands after the last poll
+    // raises a new event instead of waiting for the next one
+    if (ibv_req_notify_cq(send_cq, 0) || ibv_req_notify_cq(recv_cq, 0)) return -1;
+    int total = 0;
+    int np;
+    while ((np = reap_all()) > 0) total += np;
+    if (np < 0) return -1;
+    
+    std::lock_guard<std::mutex> lock(mtx);
+    done.insert(done.end(), event_done.begin(), event_done.end());
+    event_done.clear();
+    cv.notify_all();
+    return total;
+}
+
+int RDMACommunicator::wait_cq_event() {
+    pollfd fds[2];
+    fds[0].fd = channel->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) return errno == EINTR ? 0 : -1;
+    
+    if (fds[0].revents & POLLIN) {
+        ibv_cq* ev_cq;
+        void* ev_ctx;
+        if (ibv_get_cq_event(channel, &ev_cq, &ev_ctx) == 0) {
+            ibv_ack_cq_events(ev_cq, 1);
+        }
+    }
+    return 0;
+}
+
+int RDMACommunicator::reap_all() {
+    // Progress thread side: drain a batch from each CQ, dispatching under the lock
+    ibv_wc wcs[MAX_POLL_BATCH];
+    ibv_cq* cqs[2] = { send_cq, recv_cq };
+    int total = 0;
+    for (ibv_cq* c : cqs) {
+        int np = ibv_poll_cq(c, config.poll_batch, wcs);
+        if (np < 0) return -1;
+        if (np == 0) {
+            op_stats.record_empty_poll();
+            continue;
+        }
+        if (trace_enabled()) trace_record(TRACE_POLL, "poll", this, 0, 0, 0, np);
+        std::lock_guard<std::mutex> lock(mtx);
+        for (int i = 0; i < np; i++) dispatch(wcs[i]);
+        total += np;
+    }
+    return total;
+}
+
+void RDMACommunicator::progress_loop() {
+    int spin = progress_spin;
+    int idle = 0;
+    
+    while (!progress_stop.load(std::memory_order_acquire)) {
+        int np = reap_all();
+        if (np > 0) {
+            cv.notify_all();
+            // Spinning paid off, allow a longer spin next time
+            if (idle > 0) spin = std::min(spin * 2, (int)MAX_SPIN);
+            idle = 0;
+            continue;
+        }
+        if (np < 0) break;
+        if (++idle < spin) continue;
+        
+        // Idle for the whole spin budget: shrink it and sleep until the
+        // next completion event, re-polling once to close the arming race
+        spin = std::max(spin / 2, (int)MIN_SPIN);
+        idle = 0;
+        if (ibv_req_notify_cq(send_cq, 0) || ibv_req_notify_cq(recv_cq, 0)) break;
+        np = reap_all();
+        if (np > 0) {
+            cv.notify_all();
+            continue;
+        }
+        if (np < 0 || wait_cq_event() < 0) break;
+    }
+    
+    if (!progress_stop.load()) {
+        std::lock_guard<std::mutex> lock(mtx);
+        progress_failed = true;
+    }
+    cv.notify_all();
+}
+
+void RDMACommunicator::dispatch(const ibv_wc& wc) {
+    if (wc.wr_id & RECV_WR_FLAG) {
+        op_stats.record_recv(wc.byte_len, wc.status == IBV_WC_SUCCESS);
+        if (trace_enabled()) {
+            trace_record(TRACE_COMPLETE, "recv", this, wc.wr_id, wc.status == IBV_WC_SUCCESS ? wc.byte_len : 0,
+                         wc.qp_num, wc.status);
+        }
+        // SRQ completions are queued as they arrive for recv()
+        if (srq) {
+            RDMARecvCompletion rc;
+            rc.wr_id = wc.wr_id;
+            rc.status = wc.status;
+            rc.byte_len = wc.byte_len;
+            rc.with_imm = wc.status == IBV_WC_SUCCESS && wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM;
+            rc.imm = rc.with_imm ? ntohl(wc.imm_data) : 0;
+            recv_completions.push_back(rc);
+            return;
+        }
+        
+        // Otherwise account the chunk to the post_receive call it belongs to;
+        // chunks on different QPs may complete out of order
+        uint64_t id = wc.wr_id & ~RECV_WR_FLAG;
+        for (auto& g : recv_groups) {
+            if (id < g.first_id || id >= g.first_id + g.count) continue;
+            if (wc.status != IBV_WC_SUCCESS) {
+                g.failed = true;
+            } else {
+                g.bytes += wc.byte_len;
+                if (wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+                    g.with_imm = true;
+                    g.imm = ntohl(wc.imm_data);
+                }
+            }
+            if (--g.remaining == 0) release_mrs(g.mrs);
+            break;
+        }
+        return;
+    }
+    
+    // Unsignaled WRs only show up here when they fail; the signaled WR
+    // behind them is flushed as well and accounts for their slots
+    auto it = requests.find(wc.wr_id);
+    if (it == requests.end()) return;
+    RDMARequest& req = it->second;
+    send_outstanding -= req.wr_count;
+    qp_outstanding[req.qp] -= req.wr_count;
+    release_mrs(req.mrs);
+    
+    // wc.opcode is only valid on success
+    bool ok = (wc.status == IBV_WC_SUCCESS);
+    int result = (ok && wc.opcode == IBV_WC_SEND) ? (int)wc.byte_len : 0;
+    uint64_t parent = req.parent;
+    if (req.stats_op != STATS_NUM_OPS) {
+        op_stats.record_completion((StatsOp)req.stats_op, req.post_ns, ok);
+        if (trace_enabled()) {
+            trace_record(TRACE_COMPLETE, stats_op_name((StatsOp)req.stats_op), this, wc.wr_id,
+                         ok ? wc.byte_len : 0, wc.qp_num, wc.status);
+        }
+    }
+    
+    if (req.detached) {
+        requests.erase(it);
+    } else {
+        req.state = ok ? REQ_DONE : REQ_ERROR;
+        req.result = result;
+        if (event_mode) event_done.push_back((int64_t)wc.wr_id);
+    }
+    if (parent) complete_child(parent, ok, result);
+}
+
+int64_t RDMACommunicator::post_send(const void* buf, size_t len, size_t offset) {
     ibv_sge sge{};
-    sge.addr = (uintptr_t)local_buf + offset;
+    sge.addr = (uintptr_t)buf + offset;
     sge.length = len;
-    sge.lkey = mr->lkey;
+    ibv_send_wr wr{};
+    std::vector<ibv_mr*> held;
+    if (len <= (size_t)config.inline_threshold) {
+        // Small messages are copied into the WQE and may be unregistered
+        wr.send_flags = IBV_SEND_INLINE;
+    } else if (lookup_lkey((void*)sge.addr, len, 0, &sge.lkey, held)) {
+        return -1;
+    }
+    
+    wr.opcode = IBV_WR_SEND;
+    wr.sg_list = &sge;
+    wr.num_sge = (len > 0) ? 1 : 0;
     
+    std::lock_guard<std::mutex> order(send_order_mtx);
+    return post_message(wr, held);
+}
+
+int64_t RDMACommunicator::post_write_with_imm(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey,
+                                              uint32_t imm, size_t offset) {
+    ibv_sge sge{};
+    sge.addr = (uintptr_t)local_buf + offset;
+    sge.length = len;
     ibv_send_wr wr{};
-    wr.wr_id = 1;
-    wr.opcode = IBV_WR_RDMA_READ;
+    std::vector<ibv_mr*> held;
+    if (len <= (size_t)config.inline_threshold) {
+        wr.send_flags = IBV_SEND_INLINE;
+    } else if (lookup_lkey((void*)sge.addr, len, 0, &sge.lkey, held)) {
+        return -1;
+    }
+    
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
     wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.num_sge = (len > 0) ? 1 : 0;
+    wr.imm_data = htonl(imm);
     wr.wr.rdma.remote_addr = remote_addr + offset;
     wr.wr.rdma.rkey = rkey;
     
-    ibv_send_wr* bad = nullptr;
-    if (ibv_post_send(qp, &wr, &bad)) return -1;
+    // Consumes a receive like a SEND, so it keeps its place in the message order
+    std::lock_guard<std::mutex> order(send_order_mtx);
+    return post_message(wr, held);
+}
+
+int RDMACommunicator::write_with_imm(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey,
+                                     uint32_t imm, size_t offset) {
+    int64_t req = post_write_with_imm(local_buf, len, remote_addr, rkey, imm, offset);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int64_t RDMACommunicator::post_write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    return post_rdma(IBV_WR_RDMA_WRITE, local_buf, len, remote_addr, rkey, offset);
+}
+
+int64_t RDMACommunicator::post_read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    return post_rdma(IBV_WR_RDMA_READ, local_buf, len, remote_addr, rkey, offset);
+}
+
+int64_t RDMACommunicator::post_sendv(const struct iovec* iov, int iovcnt) {
+    ibv_sge sges[MAX_SGE];
+    ibv_send_wr wr{};
+    std::vector<ibv_mr*> held;
+    if (fill_inline_sges(iov, iovcnt, sges)) {
+        wr.send_flags = IBV_SEND_INLINE;
+    } else if (fill_sges(iov, iovcnt, max_sge, 0, sges, held)) {
+        return -1;
+    }
     
-    // Poll completion
-    ibv_wc wc{};
-    int np;
-    do { 
-        np = ibv_poll_cq(cq, 1, &wc); 
-    } while (np == 0);
+    wr.opcode = IBV_WR_SEND;
+    wr.sg_list = sges;
+    wr.num_sge = iovcnt;
     
-    if (np < 0 || wc.status != IBV_WC_SUCCESS) {
+    std::lock_guard<std::mutex> order(send_order_mtx);
+    return post_message(wr, held);
+}
+
+int64_t RDMACommunicator::post_writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    return post_rdmav(IBV_WR_RDMA_WRITE, iov, iovcnt, remote_addr, rkey);
+}
+
+int64_t RDMACommunicator::post_readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    return post_rdmav(IBV_WR_RDMA_READ, iov, iovcnt, remote_addr, rkey);
+}
+
+int64_t RDMACommunicator::post_write_batch(const void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                                           uint32_t rkey, int signal_every) {
+    return post_batch(IBV_WR_RDMA_WRITE, local_buf, entries, rkey, signal_every);
+}
+
+int64_t RDMACommunicator::post_read_batch(void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                                          uint32_t rkey, int signal_every) {
+    return post_batch(IBV_WR_RDMA_READ, local_buf, entries, rkey, signal_every);
+}
+
+int RDMACommunicator::write_batch(const void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                                  uint32_t rkey, int signal_every) {
+    int64_t req = post_write_batch(local_buf, entries, rkey, signal_every);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int RDMACommunicator::read_batch(void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                                 uint32_t rkey, int signal_every) {
+    int64_t req = post_read_batch(local_buf, entries, rkey, signal_every);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+StatsSnapshot RDMACommunicator::get_stats() {
+    StatsSnapshot snap = op_stats.snapshot();
+    std::lock_guard<std::mutex> lock(mtx);
+    snap.send_outstanding = send_outstanding;
+    for (const auto& g : recv_groups) snap.recv_outstanding += g.remaining;
+    return snap;
+}
+
+int RDMACommunicator::test(int64_t req) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = requests.find((uint64_t)req);
+    if (it == requests.end()) return -1;
+    if (it->second.state == REQ_PENDING && !progress_running.load()) {
+        if (poll_cq(lock, send_cq) < 0) return -1;
+        // Other threads may have changed the table while the lock was dropped
+        it = requests.find((uint64_t)req);
+        if (it == requests.end()) return -1;
+    }
+    return it->second.state == REQ_PENDING ? 0 : 1;
+}
+
+int RDMACommunicator::wait(int64_t req) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = requests.find((uint64_t)req);
+    if (it == requests.end()) return -1;
+    
+    // progress() drops the lock, and posts from other threads may rehash
+    // the table meanwhile
+    while (it->second.state == REQ_PENDING) {
+        if (progress(lock, send_cq) < 0) return -1;
+        it = requests.find((uint64_t)req);
+        if (it == requests.end()) return -1;
+    }
+    
+    int ret = (it->second.state == REQ_DONE) ? it->second.result : -1;
+    requests.erase(it);
+    return ret;
+}
+
+int RDMACommunicator::wait_all() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (send_outstanding > 0) {
+        if (progress(lock, send_cq) < 0) return -1;
+    }
+    
+    // Requests already queued for process_events() stay for their owner to collect
+    std::unordered_set<int64_t> reported(event_done.begin(), event_done.end());
+    int ret = 0;
+    for (auto it = requests.begin(); it != requests.end();) {
+        if (reported.count((int64_t)it->first)) {
+            ++it;
+            continue;
+        }
+        if (it->second.state != REQ_DONE) ret = -1;
+        it = requests.erase(it);
+    }
+    return ret;
+}
+
+int RDMACommunicator::send(const void* buf, size_t len, size_t offset) {
+    int64_t req = post_send(buf, len, offset);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int RDMACommunicator::post_receive(void* buf, size_t len, size_t offset) {
+    // Shared receive queues are replenished by the SRQ itself
+    if (srq) return -1;
+    
+    ibv_sge sge{};
+    sge.addr = (uintptr_t)buf + offset;
+    sge.length = len;
+    std::vector<ibv_mr*> held;
+    if (len > 0 && lookup_lkey((void*)sge.addr, len, IBV_ACCESS_LOCAL_WRITE, &sge.lkey, held)) return -1;
+    return post_recv_message(&sge, (len > 0) ? 1 : 0, held);
+}
+
+int RDMACommunicator::post_receivev(const struct iovec* iov, int iovcnt) {
+    if (srq) return -1;
+    
+    ibv_sge sges[MAX_SGE];
+    std::vector<ibv_mr*> held;
+    if (fill_sges(iov, iovcnt, max_sge, IBV_ACCESS_LOCAL_WRITE, sges, held)) return -1;
+    return post_recv_message(sges, iovcnt, held);
+}
+
+int RDMACommunicator::post_recv_message(const ibv_sge* sges, int nsge, std::vector<ibv_mr*>& held) {
+    // One receive per QP, split like the send; see split_message()
+    std::vector<std::vector<ibv_sge>> pieces;
+    if (qps.size() == 1) {
+        pieces.emplace_back(sges, sges + nsge);
+    } else if (split_message(sges, nsge, pieces)) {
+        release_mrs(held);
         return -1;
     }
+    int n = (int)pieces.size();
+    
+    std::lock_guard<std::mutex> lock(mtx);
+    RDMARecvGroup g;
+    g.first_id = next_recv_id;
+    g.count = n;
+    g.remaining = n;
+    g.bytes = 0;
+    g.failed = false;
+    g.with_imm = false;
+    g.imm = 0;
+    g.mrs.swap(held);
+    recv_groups.push_back(g);
     
+    for (int i = 0; i < n; i++) {
+        ibv_recv_wr wr{};
+        wr.wr_id = RECV_WR_FLAG | next_recv_id++;
+        wr.sg_list = pieces[i].data();
+        wr.num_sge = (int)pieces[i].size();
+        
+        ibv_recv_wr* bad = nullptr;
+        if (ibv_post_recv(qps[i], &wr, &bad)) {
+            // The pieces already posted still complete into the group
+            RDMARecvGroup& last = recv_groups.back();
+            last.failed = true;
+            last.remaining -= n - i;
+            last.count = i;
+            next_recv_id = last.first_id + i;
+            if (i == 0) {
+                release_mrs(last.mrs);
+                recv_groups.pop_back();
+            }
+            return -1;
+        }
+        if (trace_enabled()) trace_record(TRACE_POST, "recv", this, wr.wr_id, wr_bytes(wr), qps[i]->qp_num, 0);
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+size_t RDMACommunicator::posted_receives() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return recv_groups.size();
+}
+
+int RDMACommunicator::pop_recv_completion(RDMARecvCompletion& rc) {
+    // Called with mtx held; 1 if the oldest receive completed, 0 if pending
+    if (srq) {
+        if (recv_completions.empty()) return 0;
+        rc = recv_completions.front();
+        recv_completions.pop_front();
+        return 1;
+    }
+    
+    // Receives complete in posting order, whatever QP their chunks used
+    if (recv_groups.empty()) return -1;
+    const RDMARecvGroup& g = recv_groups.front();
+    if (g.remaining > 0) return 0;
+    rc.wr_id = RECV_WR_FLAG | g.first_id;
+    rc.status = g.failed ? IBV_WC_GENERAL_ERR : IBV_WC_SUCCESS;
+    rc.byte_len = g.bytes;
+    rc.with_imm = g.with_imm;
+    rc.imm = g.imm;
+    recv_groups.pop_front();
+    return 1;
+}
+
+int RDMACommunicator::next_recv_completion(RDMARecvCompletion& rc) {
+    std::unique_lock<std::mutex> lock(mtx);
+    // Only the receive CQ is polled; send completions stay with their waiters
+    int ret;
+    while ((ret = pop_recv_completion(rc)) == 0) {
+        if (progress(lock, recv_cq) < 0) return -1;
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+int RDMACommunicator::recv(void* buf, size_t len, size_t offset) {
+    RDMARecvCompletion rc;
+    return complete_recv(buf, len, offset, rc);
+}
+
+int RDMACommunicator::recv_imm(RDMAImmRecv& out, void* buf, size_t len, size_t offset) {
+    RDMARecvCompletion rc;
+    int ret = complete_recv(buf, len, offset, rc);
+    if (ret < 0) return -1;
+    out.len = rc.byte_len;
+    out.imm = rc.imm;
+    out.with_imm = rc.with_imm;
+    return ret;
+}
+
+int RDMACommunicator::try_recv(RDMAImmRecv& out, void* buf, size_t len, size_t offset) {
+    RDMARecvCompletion rc;
+    int ret;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ret = pop_recv_completion(rc);
+        // Nobody else reaps the CQ without events or a progress thread
+        if (ret == 0 && !event_mode && !progress_running.load()) {
+            if (poll_cq(lock, recv_cq) < 0) return -1;
+            ret = pop_recv_completion(rc);
+        }
+    }
+    if (ret <= 0) return ret;
+    
+    if (finish_recv(buf, len, offset, rc) < 0) return -1;
+    out.len = rc.byte_len;
+    out.imm = rc.imm;
+    out.with_imm = rc.with_imm;
+    return 1;
+}
+
+int RDMACommunicator::complete_recv(void* buf, size_t len, size_t offset, RDMARecvCompletion& rc) {
+    if (next_recv_completion(rc)) return -1;
+    return finish_recv(buf, len, offset, rc);
+}
+
+int RDMACommunicator::finish_recv(void* buf, size_t len, size_t offset, const RDMARecvCompletion& rc) {
+    if (!srq) {
+        // The data is already in the posted buffer
+        if (rc.status != IBV_WC_SUCCESS) return -1;
+        return rc.byte_len;
+    }
+    
+    // SRQ mode: copy out of the slot and hand it back for re-posting
+    uint32_t slot = (uint32_t)(rc.wr_id & ~RECV_WR_FLAG);
+    int ret = -1;
+    if (rc.status == IBV_WC_SUCCESS) {
+        // A write_with_imm left the slot empty, its data is in our memory.
+        // A message longer than buf fails, as a too-small posted buffer would
+        if (rc.with_imm) {
+            ret = rc.byte_len;
+        } else if (rc.byte_len <= len) {
+            memcpy((char*)buf + offset, srq->slot_data(slot), rc.byte_len);
+            ret = rc.byte_len;
+        }
+    }
+    srq->release(slot);
+    return ret;
+}
+
+int RDMACommunicator::recv_view(RDMARecvView& view) {
+    if (!srq) return -1;
+    if (release_view()) return -1;
+    
+    RDMARecvCompletion rc;
+    if (next_recv_completion(rc)) return -1;
+    
+    uint32_t slot = (uint32_t)(rc.wr_id & ~RECV_WR_FLAG);
+    if (rc.status != IBV_WC_SUCCESS) {
+        srq->release(slot);
+        return -1;
+    }
+    
+    held_slot = slot;
+    view.data = srq->slot_data(slot);
+    view.len = rc.byte_len;
+    return rc.byte_len;
+}
+
+int RDMACommunicator::release_view() {
+    if (held_slot < 0) return 0;
+    int ret = srq->release((uint32_t)held_slot);
+    held_slot = -1;
+    return ret;
+}
+
+int RDMACommunicator::write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    int64_t req = post_write(local_buf, len, remote_addr, rkey, offset);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int RDMACommunicator::read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    int64_t req = post_read(local_buf, len, remote_addr, rkey, offset);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int RDMACommunicator::sendv(const struct iovec* iov, int iovcnt) {
+    int64_t req = post_sendv(iov, iovcnt);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int RDMACommunicator::recvv(const struct iovec* /*iov*/, int /*iovcnt*/) {
+    // Segments were given to post_receivev, the completion is all that is left
+    return recv(nullptr, 0, 0);
+}
+
+int RDMACommunicator::writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    int64_t req = post_writev(iov, iovcnt, remote_addr, rkey);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int RDMACommunicator::readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    int64_t req = post_readv(iov, iovcnt, remote_addr, rkey);
+    if (req < 0) return -1;
+    return wait(req);
+}
@@ -1,9 +1,22 @@
 #ifndef RDMA_COMMUNICATOR_H
 #define RDMA_COMMUNICATOR_H
 
+#include "comm_stats.h"
 #include "communicator.h"
+#include "mr_cache.h"
+#include "rdma_context.h"
+#include "rdma_handshake.h"
+#include "rdma_srq.h"
 #include <infiniband/verbs.h>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 struct WireMsg {
     uint32_t qpn;
@@ -12,31 +25,221 @@ struct WireMsg {
     uint8_t  gid[16];
     uint32_t rkey;
     uint64_t vaddr;
+    uint8_t  active_mtu;    // enum ibv_mtu of the sender's port
+    uint8_t  rd_atomic;     // RDMA READ/atomic responder resources of the sender
+};
+
+// Queue pair and completion queue settings, validated against the device
+// limits when the communicator is created
+struct QPConfig {
+    int max_send_wr;        // send queue depth
+    int max_recv_wr;        // receive queue depth (ignored with an SRQ)
+    int max_inline_data;    // bytes a send may carry inline
+    int inline_threshold;   // sends/writes up to this size go inline, clipped to max_inline_data
+    int send_cq_depth;      // entries of the send completion queue
+    int recv_cq_depth;      // entries of the receive completion queue
+    int poll_batch;         // work completions reaped per poll call
+    int path_mtu;           // enum ibv_mtu, 0 to use the smaller active MTU of both ports
+    int max_rd_atomic;      // outstanding RDMA READ/atomic ops, 0 for the device maximum
+    int timeout;            // local ACK timeout, 4.096us * 2^timeout
+    int retry_cnt;
+    int rnr_retry;          // 7 retries forever
+    int min_rnr_timer;
+    int num_qps;            // RC QPs to the peer; ops above stripe_size are striped over them
+    size_t stripe_size;     // chunk size of striped transfers
+
+    QPConfig() : max_send_wr(128), max_recv_wr(64), max_inline_data(0), inline_threshold(64),
+                 send_cq_depth(256), recv_cq_depth(256), poll_batch(16),
+                 path_mtu(0), max_rd_atomic(0),
+                 timeout(14), retry_cnt(7), rnr_retry(7), min_rnr_timer(12),
+                 num_qps(1), stripe_size(1 << 20) {}
+};
+
+// Completion state of a posted send-side work request. Striped and batched
+// operations are a parent request that completes with its last child.
+struct RDMARequest {
+    int state;      // REQ_PENDING, REQ_DONE or REQ_ERROR
+    int result;     // bytes for SEND, 0 for WRITE/READ
+    int wr_count;   // send queue slots released on completion
+    bool detached;  // internal request, dropped once completed
+    int qp;         // index of the QP the WR was posted on
+    uint64_t parent;    // aggregating request, 0 if none
+    int children;       // children still in flight (parents only)
+    bool failed;        // a child failed (parents only)
+    int stats_op;       // StatsOp, STATS_NUM_OPS for parents, which are not counted
+    uint64_t post_ns;   // CommStats::now_ns() when posted
+    std::vector<ibv_mr*> mrs;   // acquired from the MR cache, released on completion
+};
+
+// Receives posted by one post_receive call, one per QP
+struct RDMARecvGroup {
+    uint64_t first_id;  // receive id of the first chunk, the rest follow
+    int count;
+    int remaining;
+    uint32_t bytes;
+    bool failed;
+    bool with_imm;      // completed by a WRITE_WITH_IMM
+    uint32_t imm;
+    std::vector<ibv_mr*> mrs;   // released once every chunk completed
+};
+
+// One transfer of a batched write/read
+struct RDMABatchEntry {
+    size_t local_offset;
+    uint64_t remote_addr;
+    size_t len;
+};
+
+// Completion of a posted receive work request
+struct RDMARecvCompletion {
+    uint64_t wr_id;
+    int status;
+    uint32_t byte_len;
+    bool with_imm;      // a WRITE_WITH_IMM, whose data is in our registered memory
+    uint32_t imm;       // host byte order
+};
+
+// What recv_imm() learned about the receive it completed
+struct RDMAImmRecv {
+    uint32_t len;       // bytes of the SEND, or bytes the peer wrote
+    uint32_t imm;       // immediate of a WRITE_WITH_IMM, 0 otherwise
+    bool with_imm;
+};
+
+// Zero-copy view of a message received into a shared receive queue slot
+struct RDMARecvView {
+    void* data;
+    uint32_t len;
 };
 
 class RDMACommunicator : public Communicator {
 private:
     int socket_fd;
-    char* device_name;
     int gid_index;
-    ibv_context* ctx;
+    std::shared_ptr<RDMAContext> context;
+    int port;
+    ibv_context* ctx;   // borrowed from context
     ibv_pd* pd;
-    ibv_cq* cq;
-    ibv_qp* qp;
-    ibv_mr* mr;
+    ibv_comp_channel* channel;  // completion events of both CQs
+    ibv_cq* send_cq;
+    ibv_cq* recv_cq;
+    std::vector<ibv_qp*> qps;
+    ibv_mr* mr;         // registration of the buffer given to set_buffer
+    MRCache* mr_cache;  // shared by every communicator of the context
     void* buf;
     size_t buf_size;
+    RDMASharedRecvQueue* srq;   // not owned, nullptr without SRQ
+    int64_t held_slot;          // SRQ slot backing the last RDMARecvView
     WireMsg peer_info;  // Store remote QP information
+    std::vector<ibv_mr*> regions;           // pinned by expose_memory, advertised by connect()
+    std::vector<ibv_mr*> pinned;            // pinned by pin_memory, local use only
+    std::vector<MRDescriptor> peer_regions; // advertised by the peer
+    uint32_t peer_caps;
+    uint16_t peer_version;
+    QPConfig config;
+    int peer_rd_atomic; // responder resources announced by the peer
+    bool atomics;       // the device executes remote atomics
+    CommStats op_stats;
+    
+    // Registered 8-byte slots the blocking atomics return their old value in
+    uint64_t* atomic_slots;
+    ibv_mr* atomic_mr;
+    std::vector<int> atomic_free;
+    std::mutex atomic_mtx;
+    std::condition_variable atomic_cv;
+    static const int ATOMIC_SLOTS = 64;
     
     // RDMA connection parameters
-    static const int IB_PORT = 1;
-    static const int DEFAULT_GID_INDEX = 0;
-    static const int CQE = 16;
+    static const int MAX_SGE = 16;
+    // Rounds of stripe_size chunks a multi-QP message is split into before
+    // the rest goes to the last QP; part of the wire protocol
+    static const int STRIPE_ROUNDS = 4;
+    static const int MAX_POLL_BATCH = 64;
+    static const int MIN_SPIN = 64;
+    static const int MAX_SPIN = 1 << 16;
+    
+    // Request states
+    static const int REQ_PENDING = 0;
+    static const int REQ_DONE = 1;
+    static const int REQ_ERROR = 2;
+    
+    // Receive wr_ids carry this bit so they never collide with request handles
+    static const uint64_t RECV_WR_FLAG = RDMASharedRecvQueue::RECV_WR_FLAG;
+    
+    // Outstanding requests keyed by wr_id
+    std::unordered_map<uint64_t, RDMARequest> requests;
+    std::deque<RDMARecvCompletion> recv_completions;   // SRQ mode
+    std::deque<RDMARecvGroup> recv_groups;             // posting order, without SRQ
+    uint64_t next_wr_id;
+    uint64_t next_recv_id;
+    int send_outstanding;
+    std::vector<int> qp_outstanding;
+    std::vector<uint32_t> peer_qpns;    // peer QPs after the first, in QP order
+    // A two-sided message takes one WR on every QP, in QP order, which keeps
+    // messages in order; the mutex keeps concurrent sends from interleaving
+    size_t next_rdma_qp;
+    std::mutex send_order_mtx;
+    int max_sge;        // SGEs per send/recv WR, clipped to the device limit
+    int max_sge_rd;     // SGEs per RDMA READ WR
+    
+    // The mutex guards the request state above; completions are reaped
+    // either inline by waiting callers or by the progress thread
+    std::mutex mtx;
+    std::condition_variable cv;
+    // Inline polls run without mtx; this keeps their dispatch in CQ order
+    std::mutex poll_mtx;
+    std::thread progress_thread;
+    std::atomic<bool> progress_running;
+    std::atomic<bool> progress_stop;
+    bool progress_failed;
+    int progress_spin;
+    int wake_fd;
+    bool event_mode;                // completions are reaped by process_events()
+    std::vector<int64_t> event_done;    // requests completed since the last process_events()
     
     // Helper functions
     static void readn(int fd, void* p, size_t n);
     static void writen(int fd, const void* p, size_t n);
     int init_rdma();
+    int validate_config(const ibv_device_attr& dev_attr);
+    int modify_qp(ibv_qp_attr& attr, int mask);
+    int fill_handshake(HandshakeMsg& msg, WireMsg& self);
+    int apply_handshake(const HandshakeMsg& peer, WireMsg& self);
+    int64_t post_send_wr(ibv_send_wr& wr, int qp_idx, uint64_t parent = 0, std::vector<ibv_mr*>* mrs = nullptr);
+    uint64_t new_parent(int children, std::vector<ibv_mr*>* mrs = nullptr);
+    void abort_children(uint64_t parent, int unposted);
+    void complete_child(uint64_t parent, bool ok, int result);
+    int64_t post_striped(ibv_wr_opcode opcode, const void* local_buf, size_t len,
+                         uint64_t remote_addr, uint32_t rkey);
+    int split_message(const ibv_sge* sges, int nsge, std::vector<std::vector<ibv_sge>>& pieces);
+    int64_t post_message(ibv_send_wr& wr, std::vector<ibv_mr*>& held);
+    int post_recv_message(const ibv_sge* sges, int nsge, std::vector<ibv_mr*>& held);
+    int64_t post_rdma(ibv_wr_opcode opcode, const void* local_buf, size_t len,
+                      uint64_t remote_addr, uint32_t rkey, size_t offset);
+    int lookup_lkey(const void* addr, size_t len, int access, uint32_t* lkey, std::vector<ibv_mr*>& held);
+    void release_mrs(std::vector<ibv_mr*>& mrs);
+    int init_atomics(const ibv_device_attr& dev_attr);
+    int64_t post_atomic(ibv_wr_opcode opcode, uint64_t remote_addr, uint32_t rkey,
+                        uint64_t compare_add, uint64_t swap, uint64_t* result);
+    int atomic_op(ibv_wr_opcode opcode, uint64_t remote_addr, uint32_t rkey,
+                  uint64_t compare_add, uint64_t swap, uint64_t* old);
+    int fill_sges(const struct iovec* iov, int iovcnt, int limit, int access, ibv_sge* sges,
+                  std::vector<ibv_mr*>& held);
+    int fill_inline_sges(const struct iovec* iov, int iovcnt, ibv_sge* sges);
+    int64_t post_rdmav(ibv_wr_opcode opcode, const struct iovec* iov, int iovcnt,
+                       uint64_t remote_addr, uint32_t rkey);
+    int64_t post_batch(ibv_wr_opcode opcode, const void* local_buf,
+                       const std::vector<RDMABatchEntry>& entries, uint32_t rkey, int signal_every);
+    int poll_cq(std::unique_lock<std::mutex>& lock, ibv_cq* cq);
+    int progress(std::unique_lock<std::mutex>& lock, ibv_cq* cq);
+    int reap_all();
+    void progress_loop();
+    int wait_cq_event();
+    void dispatch(const ibv_wc& wc);
+    int pop_recv_completion(RDMARecvCompletion& rc);
+    int next_recv_completion(RDMARecvCompletion& rc);
+    int finish_recv(void* buf, size_t len, size_t offset, const RDMARecvCompletion& rc);
+    int complete_recv(void* buf, size_t len, size_t offset, RDMARecvCompletion& rc);
     
 public:  // Make these methods accessible from main
     int exchange_qp_info(WireMsg& self, WireMsg& peer);
@@ -44,29 +247,158 @@ public:  // Make these methods accessible from main
     int modify_qp_to_rtr(WireMsg& peer);
     int modify_qp_to_rts(WireMsg& self);
     
+    // One-call bring-up over the socket: exchange a versioned handshake and
+    // move the QP to RTS. The connecting side sends first, the accepting side
+    // replies once its QP can receive, so the exchange is one round trip.
+    int connect();
+    int accept();
+    
 private:  // Return to private for other members
     
 public:
-    RDMACommunicator(int fd, char* device_name, int gid_index = 0);
+    RDMACommunicator(int fd, char* device_name, int gid_index = 0,
+                     const QPConfig& config = QPConfig());
+    // Create a QP on a device context shared with other communicators
+    RDMACommunicator(int fd, std::shared_ptr<RDMAContext> context, int gid_index = 0,
+                     const QPConfig& config = QPConfig());
+    // Share the device context and receive buffers of an SRQ
+    RDMACommunicator(int fd, RDMASharedRecvQueue* srq, int gid_index = 0,
+                     const QPConfig& config = QPConfig());
     ~RDMACommunicator();
     
     // Set external buffer
-    int set_buffer(void* buffer, size_t size);
+    int set_buffer(void* buffer, size_t size) override;
+    
+    // Keep memory used for many operations registered, beyond the LRU of
+    // recently used regions, until invalidate_memory()
+    int pin_memory(void* addr, size_t len) override;
+    // Drop registrations of memory that is about to be freed or remapped,
+    // including the set_buffer, expose_memory and pin_memory ones covering it
+    void invalidate_memory(void* addr, size_t len) override;
+    MRCache* get_mr_cache() { return mr_cache; }
     
-    // Post receive work request for RDMA RECV operation
-    int post_receive(void* buf, size_t len, size_t offset = 0);
+    // Register memory the peer may access; connect()/accept() advertise it
+    // after the set_buffer region
+    int expose_memory(void* addr, size_t len);
+    const std::vector<MRDescriptor>& get_peer_regions() { return peer_regions; }
+    uint32_t get_peer_caps() { return peer_caps; }
+    uint16_t get_peer_version() { return peer_version; }
+    std::shared_ptr<RDMAContext> get_rdma_context() { return context; }
     
-    // Implement send/recv operations using RDMA SEND/RECV
+    // Post receive work request for RDMA RECV operation. With several QPs
+    // every message takes one receive on each QP, split like the send so
+    // that any receive at least as long as the message completes with it.
+    // A zero-length receive (buf may be nullptr) is enough for a peer's
+    // write_with_imm, which consumes a receive but carries no data in it.
+    int post_receive(void* buf, size_t len, size_t offset = 0) override;
+    
+    // Post one receive WR scattering into several segments
+    int post_receivev(const struct iovec* iov, int iovcnt);
+    // Receives not collected yet, 0 with an SRQ
+    size_t posted_receives() override;
+    
+    // SRQ mode: receive without copying; the view stays valid until the next
+    // recv_view() or release_view() call, after which its slot is re-posted
+    int recv_view(RDMARecvView& view);
+    int release_view();
+    
+    // Implement send/recv operations using RDMA SEND/RECV. A message longer
+    // than the receive buffer fails the recv, in SRQ mode as well
     int send(const void* buf, size_t len, size_t offset = 0) override;
     int recv(void* buf, size_t len, size_t offset = 0) override;
     
+    // RDMA WRITE followed by a 32-bit notification in one operation: the
+    // data lands at remote_addr and the peer's next receive completes with
+    // imm, after the data is visible. Never striped; with several QPs the
+    // other QPs carry empty sends so that it consumes one whole receive.
+    int write_with_imm(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey,
+                       uint32_t imm, size_t offset = 0);
+    int64_t post_write_with_imm(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey,
+                                uint32_t imm, size_t offset = 0);
+    // recv() that also reports the immediate; for a write_with_imm nothing
+    // is copied to buf, out.len says how much the peer wrote
+    int recv_imm(RDMAImmRecv& out, void* buf = nullptr, size_t len = 0, size_t offset = 0);
+    // Non-blocking recv_imm(): 1 with out filled once the oldest posted
+    // receive has completed, 0 while it is pending, -1 on failure
+    int try_recv(RDMAImmRecv& out, void* buf = nullptr, size_t len = 0, size_t offset = 0);
+    
     // Implement RDMA operations
     int write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
     int read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
     
+    // Scatter-gather operations, one WR with one SGE per iovec segment
+    int sendv(const struct iovec* iov, int iovcnt) override;
+    int recvv(const struct iovec* iov, int iovcnt) override;
+    int writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+    int readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+    
+    // Non-blocking variants, return a request handle or -1 on failure
+    int64_t post_send(const void* buf, size_t len, size_t offset = 0);
+    int64_t post_write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0);
+    int64_t post_read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0);
+    int64_t post_sendv(const struct iovec* iov, int iovcnt);
+    int64_t post_writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey);
+    int64_t post_readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey);
+    
+    // Batched variants: the entries are posted as linked WR chains and only every
+    // signal_every-th WR (and the last one) is signaled; the returned handle
+    // completes once the whole batch has completed
+    int64_t post_write_batch(const void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                             uint32_t rkey, int signal_every = 16);
+    int64_t post_read_batch(void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                            uint32_t rkey, int signal_every = 16);
+    int write_batch(const void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                    uint32_t rkey, int signal_every = 16);
+    int read_batch(void* local_buf, const std::vector<RDMABatchEntry>& entries,
+                   uint32_t rkey, int signal_every = 16);
+    
+    // Remote atomics on 8-byte aligned memory registered by the peer. The old
+    // value is written to result, which must be 8-byte aligned and stay valid
+    // until the request completes. The HCA serializes them against other
+    // atomics only, not against the target CPU's own atomic instructions.
+    int64_t post_fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* result);
+    int64_t post_compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap,
+                              uint64_t* result);
+    int fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) override;
+    int compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap, uint64_t* old) override;
+    bool atomics_supported() { return atomics; }
+    
+    // Request completion: test returns 1 if done, 0 if pending, -1 if unknown;
+    // wait returns the request result or -1 on failure;
+    // wait_all returns 0 once every outstanding request completed successfully;
+    // requests already reported by process_events() are left for wait()
+    int test(int64_t req);
+    int wait(int64_t req);
+    int wait_all();
+    
+    // Reap completions on a background thread: it busy-polls for up to
+    // spin_count empty polls (adapted to the traffic), then sleeps on the
+    // completion channel. Waiting calls block instead of spinning meanwhile.
+    int start_progress_thread(int spin_count = 1024);
+    void stop_progress_thread();
+    
+    // Event-loop mode, the alternative to the progress thread: the returned
+    // completion channel fd turns readable when either CQ gets a completion,
+    // e.g. for epoll or asyncio's add_reader. The loop then calls
+    // process_events(), which never blocks: it consumes the events, re-arms
+    // both CQs and reaps every completion. done receives the handles of the
+    // requests that completed since the previous call, to be collected with
+    // wait(); receives are collected with try_recv(). Returns the number of
+    // completions reaped, or -1 on failure.
+    int get_event_fd();
+    int process_events(std::vector<int64_t>& done);
+    
+    // Counters and post-to-completion latency histograms per operation type.
+    // Counted per work request, so a striped transfer counts once per chunk;
+    // receives have no latency, it would measure the peer. The outstanding
+    // receive gauge covers receives posted without an SRQ.
+    StatsSnapshot get_stats();
+    
     // Getters for buffer information
-    uint32_t get_rkey() { return mr->rkey; }
+    uint32_t get_rkey() override { return mr ? mr->rkey : 0; }
     int get_fd() { return socket_fd; }
+    int get_num_qps() { return (int)qps.size(); }
+    const QPConfig& get_config() { return config; }
 };
 
 #endif // RDMA_COMMUNICATOR_H
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "rdma_context.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+RDMAContext::RDMAContext(const char* device_name, int port, size_t mr_cache_entries) :
+    device_name(device_name), port(port), ctx(nullptr), pd(nullptr), dev_attr(), port_attr(), numa_node(-1) {
+    if (init(mr_cache_entries) != 0) {
+        fprintf(stderr, "RDMAContext: failed to initialize device %s\n", device_name);
+    }
+}
+
+RDMAContext::~RDMAContext() {
+    // Registrations must go before the PD they belong to
+    mr_cache.reset();
+    if (pd) ibv_dealloc_pd(pd);
+    if (ctx) ibv_close_device(ctx);
+}
+
+int RDMAContext::init(size_t mr_cache_entries) {
+    int num;
+    ibv_device** dev_list = ibv_get_device_list(&num);
+    if (!dev_list) return -1;
+    for (int i = 0; i < num; i++) {
+        if (strcmp(ibv_get_device_name(dev_list[i]), device_name.c_str()) == 0) {
+            ctx = ibv_open_device(dev_list[i]);
+            break;
+        }
+    }
+    ibv_free_device_list(dev_list);
+
+    if (!ctx) {
+        fprintf(stderr, "Could not open device %s\n", device_name.c_str());
+        return -1;
+    }
+
+    if (ibv_query_device(ctx, &dev_attr)) return -1;
+    if (ibv_query_port(ctx, port, &port_attr)) return -1;
+
+    // Not every platform reports the node
+    std::ifstream f("/sys/class/infiniband/" + device_name + "/device/numa_node");
+    if (!(f >> numa_node)) numa_node = -1;
+
+    ibv_pd* p = ibv_alloc_pd(ctx);
+    if (!p) return -1;
+    mr_cache.reset(new MRCache(p, mr_cache_entries));
+    pd = p;
+    return 0;
+}
+
+double RDMAContext::get_link_gbps() const {
+    // active_width: 1, 2, 4, 8, 16 -> 1x, 4x, 8x, 12x, 2x lanes
+    int lanes;
+    switch (port_attr.active_width) {
+    case 1: lanes = 1; break;
+    case 2: lanes = 4; break;
+    case 4: lanes = 8; break;
+    case 8: lanes = 12; break;
+    case 16: lanes = 2; break;
+    default: lanes = 1; break;
+    }
+
+    // Per-lane rate of active_speed: SDR, DDR, QDR, FDR10, FDR, EDR, HDR, NDR
+    double lane;
+    switch (port_attr.active_speed) {
+    case 1: lane = 2.5; break;
+    case 2: lane = 5.0; break;
+    case 4: lane = 10.0; break;
+    case 8: lane = 10.3125; break;
+    case 16: lane = 14.0625; break;
+    case 32: lane = 25.78125; break;
+    case 64: lane = 50.0; break;
+    case 128: lane = 100.0; break;
+    default: lane = 0.0; break;
+    }
+    return lanes * lane;
+}
@@ -0,0 +1,52 @@
+#ifndef RDMA_CONTEXT_H
+#define RDMA_CONTEXT_H
+
+#include "mr_cache.h"
+#include <infiniband/verbs.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Device-level RDMA resources shared by many communicators: the opened
+// device, one protection domain and the MR cache on it. Every QP created
+// from the same context can use any registration made through it.
+class RDMAContext {
+private:
+    std::string device_name;
+    int port;
+    ibv_context* ctx;
+    ibv_pd* pd;
+    std::unique_ptr<MRCache> mr_cache;
+    ibv_device_attr dev_attr;
+    ibv_port_attr port_attr;
+    int numa_node;
+
+    int init(size_t mr_cache_entries);
+
+public:
+    static const int DEFAULT_PORT = 1;
+    static const int MR_CACHE_ENTRIES = 64;
+
+    RDMAContext(const char* device_name, int port = DEFAULT_PORT, size_t mr_cache_entries = MR_CACHE_ENTRIES);
+    ~RDMAContext();
+
+    RDMAContext(const RDMAContext&) = delete;
+    RDMAContext& operator=(const RDMAContext&) = delete;
+
+    bool valid() const { return pd != nullptr; }
+    const char* get_device_name() const { return device_name.c_str(); }
+    int get_port() const { return port; }
+    ibv_context* get_context() { return ctx; }
+    ibv_pd* get_pd() { return pd; }
+    MRCache* get_mr_cache() { return mr_cache.get(); }
+    const ibv_device_attr& get_device_attr() const { return dev_attr; }
+    const ibv_port_attr& get_port_attr() const { return port_attr; }
+
+    // NUMA node the device is attached to, -1 if unknown
+    int get_numa_node() const { return numa_node; }
+    // Data rate of the port from its active width and speed, in Gb/s
+    double get_link_gbps() const;
+};
+
+#endif // RDMA_CONTEXT_H
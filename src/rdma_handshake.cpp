@@ -0,0 +1,138 @@
+#include "rdma_handshake.h"
+#include <arpa/inet.h>
+#include <endian.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+static const size_t HEADER_LEN = 12;
+static const size_t FIXED_LEN = 4 + 4 + 4 + 2 + 16 + 1 + 1 + 4 + 4 + 4;
+static const size_t MR_LEN = 8 + 8 + 4;
+
+// Big-endian writer/reader over a byte buffer
+static void put16(uint8_t*& p, uint16_t v) { v = htons(v); memcpy(p, &v, 2); p += 2; }
+static void put32(uint8_t*& p, uint32_t v) { v = htonl(v); memcpy(p, &v, 4); p += 4; }
+static void put64(uint8_t*& p, uint64_t v) { v = htobe64(v); memcpy(p, &v, 8); p += 8; }
+static uint16_t get16(const uint8_t*& p) { uint16_t v; memcpy(&v, p, 2); p += 2; return ntohs(v); }
+static uint32_t get32(const uint8_t*& p) { uint32_t v; memcpy(&v, p, 4); p += 4; return ntohl(v); }
+static uint64_t get64(const uint8_t*& p) { uint64_t v; memcpy(&v, p, 8); p += 8; return be64toh(v); }
+
+int encode_handshake(const HandshakeMsg& msg, std::vector<uint8_t>& out) {
+    size_t total = HEADER_LEN + FIXED_LEN + 2 + msg.mrs.size() * MR_LEN + 2 + msg.extra_qpns.size() * 4;
+    if (total > HS_MAX_LEN || msg.mrs.size() > UINT16_MAX || msg.extra_qpns.size() > UINT16_MAX) return -1;
+    out.resize(total);
+
+    uint8_t* p = out.data();
+    put32(p, HS_MAGIC);
+    put16(p, msg.version);
+    put16(p, (uint16_t)FIXED_LEN);
+    put32(p, (uint32_t)total);
+
+    put32(p, msg.flags);
+    put32(p, msg.qpn);
+    put32(p, msg.psn);
+    put16(p, msg.lid);
+    memcpy(p, msg.gid, 16);
+    p += 16;
+    *p++ = msg.active_mtu;
+    *p++ = msg.rd_atomic;
+    put32(p, msg.max_send_wr);
+    put32(p, msg.max_recv_wr);
+    put32(p, msg.max_inline_data);
+
+    put16(p, (uint16_t)msg.mrs.size());
+    for (const auto& d : msg.mrs) {
+        put64(p, d.addr);
+        put64(p, d.len);
+        put32(p, d.rkey);
+    }
+
+    put16(p, (uint16_t)msg.extra_qpns.size());
+    for (uint32_t qpn : msg.extra_qpns) put32(p, qpn);
+    return 0;
+}
+
+int decode_handshake(const uint8_t* data, size_t len, HandshakeMsg& msg) {
+    if (len < HEADER_LEN) return -1;
+    const uint8_t* p = data;
+    if (get32(p) != HS_MAGIC) return -1;
+    msg.version = get16(p);
+    size_t fixed_len = get16(p);
+    size_t total = get32(p);
+    // Every version carries at least the version 1 fields
+    if (msg.version == 0 || fixed_len < FIXED_LEN || total != len ||
+        HEADER_LEN + fixed_len + 2 > len) return -1;
+
+    const uint8_t* fixed = p;
+    msg.flags = get32(p);
+    msg.qpn = get32(p);
+    msg.psn = get32(p);
+    msg.lid = get16(p);
+    memcpy(msg.gid, p, 16);
+    p += 16;
+    msg.active_mtu = *p++;
+    msg.rd_atomic = *p++;
+    msg.max_send_wr = get32(p);
+    msg.max_recv_wr = get32(p);
+    msg.max_inline_data = get32(p);
+    p = fixed + fixed_len;
+
+    size_t num_mrs = get16(p);
+    if ((size_t)(p - data) + num_mrs * MR_LEN > len) return -1;
+    msg.mrs.resize(num_mrs);
+    for (auto& d : msg.mrs) {
+        d.addr = get64(p);
+        d.len = get64(p);
+        d.rkey = get32(p);
+    }
+
+    msg.extra_qpns.clear();
+    if (msg.version < 2) return 0;
+    if ((size_t)(p - data) + 2 > len) return -1;
+    size_t num_qpns = get16(p);
+    if ((size_t)(p - data) + num_qpns * 4 > len) return -1;
+    msg.extra_qpns.resize(num_qpns);
+    for (auto& qpn : msg.extra_qpns) qpn = get32(p);
+    return 0;
+}
+
+static int write_all(int fd, const uint8_t* p, size_t n) {
+    while (n > 0) {
+        ssize_t k = ::write(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int read_all(int fd, uint8_t* p, size_t n) {
+    while (n > 0) {
+        ssize_t k = ::read(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+int send_handshake(int fd, const HandshakeMsg& msg) {
+    std::vector<uint8_t> out;
+    if (encode_handshake(msg, out)) return -1;
+    return write_all(fd, out.data(), out.size());
+}
+
+int recv_handshake(int fd, HandshakeMsg& msg) {
+    // The header tells how much follows
+    std::vector<uint8_t> in(HEADER_LEN);
+    if (read_all(fd, in.data(), HEADER_LEN)) return -1;
+    const uint8_t* p = in.data() + 8;
+    size_t total = get32(p);
+    if (total < HEADER_LEN || total > HS_MAX_LEN) return -1;
+
+    in.resize(total);
+    if (read_all(fd, in.data() + HEADER_LEN, total - HEADER_LEN)) return -1;
+    return decode_handshake(in.data(), in.size(), msg);
+}
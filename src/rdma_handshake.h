@@ -0,0 +1,57 @@
+#ifndef RDMA_HANDSHAKE_H
+#define RDMA_HANDSHAKE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Remote memory region a peer may access with RDMA WRITE/READ
+struct MRDescriptor {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t rkey;
+};
+
+// Connection parameters exchanged by RDMACommunicator::connect()/accept().
+//
+// Wire format, all integers in network byte order, no padding:
+//   magic u32 | version u16 | fixed_len u16 | total_len u32
+//   fixed section (fixed_len bytes, see encode_handshake)
+//   num_mrs u16 | num_mrs * (addr u64 | len u64 | rkey u32)
+//   version >= 2: num_qpns u16 | num_qpns * qpn u32
+// Newer versions only append to the fixed section and after the MR list,
+// so a reader skips whatever it does not know.
+struct HandshakeMsg {
+    uint16_t version;
+    uint32_t flags;         // HS_CAP_* bits
+    uint32_t qpn;
+    uint32_t psn;
+    uint16_t lid;
+    uint8_t  gid[16];
+    uint8_t  active_mtu;    // enum ibv_mtu
+    uint8_t  rd_atomic;     // responder resources
+    uint32_t max_send_wr;
+    uint32_t max_recv_wr;
+    uint32_t max_inline_data;
+    std::vector<MRDescriptor> mrs;
+    std::vector<uint32_t> extra_qpns;   // QPs after qpn, for multi-QP connections
+};
+
+static const uint32_t HS_MAGIC = 0x5052444d;   // "PRDM"
+static const uint16_t HS_VERSION = 2;
+static const uint32_t HS_MAX_LEN = 1 << 16;
+
+// Capability flags
+static const uint32_t HS_CAP_INLINE = 1u << 0;  // sends small messages inline
+static const uint32_t HS_CAP_SRQ = 1u << 1;     // receives through a shared receive queue
+
+// Serialize msg; returns 0, or -1 if it does not fit HS_MAX_LEN
+int encode_handshake(const HandshakeMsg& msg, std::vector<uint8_t>& out);
+// Parse a complete message; returns 0, or -1 on a malformed message
+int decode_handshake(const uint8_t* data, size_t len, HandshakeMsg& msg);
+
+// Send our message and read the peer's over a connected socket
+int send_handshake(int fd, const HandshakeMsg& msg);
+int recv_handshake(int fd, HandshakeMsg& msg);
+
+#endif // RDMA_HANDSHAKE_H
@@ -0,0 +1,98 @@
+#include "rdma_srq.h"
+#include <sys/mman.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+RDMASharedRecvQueue::RDMASharedRecvQueue(std::shared_ptr<RDMAContext> context, size_t num_buffers,
+                                         size_t buffer_size, size_t refill_batch) :
+    context(context), srq(nullptr), mr(nullptr), buffers(nullptr),
+    num_buffers(num_buffers), buffer_size(buffer_size), refill_batch(refill_batch ? refill_batch : 1) {
+    if (init() != 0) {
+        die("Failed to initialize shared receive queue");
+    }
+}
+
+RDMASharedRecvQueue::RDMASharedRecvQueue(const char* device_name, size_t num_buffers,
+                                         size_t buffer_size, size_t refill_batch) :
+    RDMASharedRecvQueue(std::make_shared<RDMAContext>(device_name), num_buffers, buffer_size, refill_batch) {
+}
+
+RDMASharedRecvQueue::~RDMASharedRecvQueue() {
+    if (srq) ibv_destroy_srq(srq);
+    if (mr) ibv_dereg_mr(mr);
+    if (buffers) munmap(buffers, num_buffers * buffer_size);
+}
+
+int RDMASharedRecvQueue::init() {
+    if (!context->valid()) return -1;
+
+    const ibv_device_attr& dev_attr = context->get_device_attr();
+    if (num_buffers == 0 || num_buffers > (size_t)dev_attr.max_srq_wr) {
+        fprintf(stderr, "SRQ depth %zu exceeds device limit %d\n", num_buffers, dev_attr.max_srq_wr);
+        return -1;
+    }
+
+    // One registered region holds every slot of the ring
+    void* p = mmap(nullptr, num_buffers * buffer_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return -1;
+    buffers = (char*)p;
+    mr = ibv_reg_mr(context->get_pd(), buffers, num_buffers * buffer_size, IBV_ACCESS_LOCAL_WRITE);
+    if (!mr) return -1;
+
+    ibv_srq_init_attr sia{};
+    sia.attr.max_wr = num_buffers;
+    sia.attr.max_sge = 1;
+    srq = ibv_create_srq(context->get_pd(), &sia);
+    if (!srq) return -1;
+
+    std::vector<uint32_t> slots(num_buffers);
+    for (size_t i = 0; i < num_buffers; i++) slots[i] = (uint32_t)i;
+    return post_slots(slots.data(), slots.size());
+}
+
+int RDMASharedRecvQueue::post_slots(const uint32_t* slots, size_t n) {
+    if (n == 0) return 0;
+
+    // Chain the receives so the whole refill costs one post call
+    std::vector<ibv_sge> sges(n);
+    std::vector<ibv_recv_wr> wrs(n);
+    for (size_t i = 0; i < n; i++) {
+        sges[i].addr = (uintptr_t)slot_data(slots[i]);
+        sges[i].length = buffer_size;
+        sges[i].lkey = mr->lkey;
+
+        wrs[i] = ibv_recv_wr{};
+        wrs[i].wr_id = RECV_WR_FLAG | slots[i];
+        wrs[i].sg_list = &sges[i];
+        wrs[i].num_sge = 1;
+        wrs[i].next = (i + 1 < n) ? &wrs[i + 1] : nullptr;
+    }
+
+    ibv_recv_wr* bad = nullptr;
+    return ibv_post_srq_recv(srq, wrs.data(), &bad);
+}
+
+int RDMASharedRecvQueue::release(uint32_t slot) {
+    if (slot >= num_buffers) return -1;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    pending.push_back(slot);
+    if (pending.size() < refill_batch) return 0;
+    int ret = post_slots(pending.data(), pending.size());
+    pending.clear();
+    return ret;
+}
+
+int RDMASharedRecvQueue::replenish() {
+    std::lock_guard<std::mutex> lock(mtx);
+    int ret = post_slots(pending.data(), pending.size());
+    pending.clear();
+    return ret;
+}
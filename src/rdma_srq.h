@@ -0,0 +1,56 @@
+#ifndef RDMA_SRQ_H
+#define RDMA_SRQ_H
+
+#include "rdma_context.h"
+#include <infiniband/verbs.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Shared receive queue with a ring of pre-posted, registered buffers.
+// Communicators created on it share one pool of receive buffers instead of
+// per-QP receive queues. Consumed slots are handed back with release() and
+// re-posted in batches, so callers never post receives themselves.
+class RDMASharedRecvQueue {
+private:
+    std::shared_ptr<RDMAContext> context;
+    ibv_srq* srq;
+    ibv_mr* mr;
+    char* buffers;
+    size_t num_buffers;
+    size_t buffer_size;
+    size_t refill_batch;
+    std::vector<uint32_t> pending;  // released slots not yet re-posted
+    std::mutex mtx;
+
+    int init();
+    int post_slots(const uint32_t* slots, size_t n);
+
+public:
+    // Receive wr_ids are RECV_WR_FLAG | slot, see RDMACommunicator
+    static const uint64_t RECV_WR_FLAG = 1ULL << 63;
+
+    RDMASharedRecvQueue(std::shared_ptr<RDMAContext> context, size_t num_buffers = 256,
+                        size_t buffer_size = 4096, size_t refill_batch = 16);
+    RDMASharedRecvQueue(const char* device_name, size_t num_buffers = 256,
+                        size_t buffer_size = 4096, size_t refill_batch = 16);
+    ~RDMASharedRecvQueue();
+
+    RDMASharedRecvQueue(const RDMASharedRecvQueue&) = delete;
+    RDMASharedRecvQueue& operator=(const RDMASharedRecvQueue&) = delete;
+
+    // Return a consumed slot; slots are re-posted once refill_batch accumulate
+    int release(uint32_t slot);
+    // Re-post every released slot now
+    int replenish();
+
+    void* slot_data(uint32_t slot) { return buffers + (size_t)slot * buffer_size; }
+    size_t get_buffer_size() { return buffer_size; }
+    size_t get_num_buffers() { return num_buffers; }
+    std::shared_ptr<RDMAContext> get_rdma_context() { return context; }
+    ibv_srq* get_srq() { return srq; }
+};
+
+#endif // RDMA_SRQ_H
@@ -0,0 +1,183 @@
+#include "reduce_kernels.h"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REDUCE_X86 1
+#endif
+
+size_t dtype_size(ReduceDtype dtype) {
+    return dtype == DTYPE_FLOAT32 ? 4 : 2;
+}
+
+float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);    // inf, nan
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half, normal as a float
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+uint16_t float_to_half(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t exp = (bits >> 23) & 0xff;
+    uint32_t mant = bits & 0x7fffff;
+
+    if (exp == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+    int e = (int)exp - 112;
+    if (e >= 0x1f) return sign | 0x7c00;
+    if (e <= 0) {
+        // Subnormal or zero; shift with the implicit bit, round to nearest even
+        if (e < -10) return sign;
+        mant |= 0x800000;
+        int shift = 14 - e;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return sign | (uint16_t)h;
+    }
+    uint32_t h = ((uint32_t)e << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    // A carry out of the mantissa correctly bumps the exponent, up to inf
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | (uint16_t)h;
+}
+
+float bf16_to_float(uint16_t b) {
+    uint32_t bits = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+uint16_t float_to_bf16(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    if ((bits & 0x7fffffff) > 0x7f800000) return (uint16_t)((bits >> 16) | 0x40);   // quiet nan
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+static inline float combine(float a, float b, ReduceOp op) {
+    return op == REDUCE_SUM ? a + b : (b > a ? b : a);
+}
+
+static void reduce_scalar(void* dst, const void* src, size_t start, size_t count, ReduceDtype dtype, ReduceOp op) {
+    if (dtype == DTYPE_FLOAT32) {
+        float* d = (float*)dst;
+        const float* s = (const float*)src;
+        for (size_t i = start; i < count; i++) d[i] = combine(d[i], s[i], op);
+        return;
+    }
+    uint16_t* d = (uint16_t*)dst;
+    const uint16_t* s = (const uint16_t*)src;
+    if (dtype == DTYPE_FLOAT16) {
+        for (size_t i = start; i < count; i++) {
+            d[i] = float_to_half(combine(half_to_float(d[i]), half_to_float(s[i]), op));
+        }
+    } else {
+        for (size_t i = start; i < count; i++) {
+            d[i] = float_to_bf16(combine(bf16_to_float(d[i]), bf16_to_float(s[i]), op));
+        }
+    }
+}
+
+#ifdef REDUCE_X86
+__attribute__((target("avx2,f16c")))
+static inline __m256 combine8(__m256 a, __m256 b, ReduceOp op) {
+    return op == REDUCE_SUM ? _mm256_add_ps(a, b) : _mm256_max_ps(b, a);
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256 load_bf16(const uint16_t* p) {
+    __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(v, 16));
+}
+
+__attribute__((target("avx2,f16c")))
+static inline void store_bf16(uint16_t* p, __m256 x) {
+    // Round to nearest even like float_to_bf16, quieting nans
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff)));
+    rounded = _mm256_srli_epi32(rounded, 16);
+    __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+    __m256 unord = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    rounded = _mm256_blendv_epi8(rounded, nan, _mm256_castps_si256(unord));
+    // Pack the 32-bit lanes to 16 bits, packus works within 128-bit halves
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0xd8);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(packed));
+}
+
+__attribute__((target("avx2,f16c")))
+static void reduce_avx2(void* dst, const void* src, size_t count, ReduceDtype dtype, ReduceOp op) {
+    size_t i = 0;
+    if (dtype == DTYPE_FLOAT32) {
+        float* d = (float*)dst;
+        const float* s = (const float*)src;
+        for (; i + 16 <= count; i += 16) {
+            __m256 a0 = _mm256_loadu_ps(d + i);
+            __m256 a1 = _mm256_loadu_ps(d + i + 8);
+            _mm256_storeu_ps(d + i, combine8(a0, _mm256_loadu_ps(s + i), op));
+            _mm256_storeu_ps(d + i + 8, combine8(a1, _mm256_loadu_ps(s + i + 8), op));
+        }
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(d + i, combine8(_mm256_loadu_ps(d + i), _mm256_loadu_ps(s + i), op));
+        }
+    } else if (dtype == DTYPE_FLOAT16) {
+        uint16_t* d = (uint16_t*)dst;
+        const uint16_t* s = (const uint16_t*)src;
+        for (; i + 8 <= count; i += 8) {
+            __m256 a = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(d + i)));
+            __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(s + i)));
+            __m128i r = _mm256_cvtps_ph(combine8(a, b, op), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i*)(d + i), r);
+        }
+    } else {
+        uint16_t* d = (uint16_t*)dst;
+        const uint16_t* s = (const uint16_t*)src;
+        for (; i + 8 <= count; i += 8) {
+            store_bf16(d + i, combine8(load_bf16(d + i), load_bf16(s + i), op));
+        }
+    }
+    reduce_scalar(dst, src, i, count, dtype, op);
+}
+#endif
+
+bool reduce_simd_enabled() {
+#ifdef REDUCE_X86
+    static const bool simd = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+    return simd;
+#else
+    return false;
+#endif
+}
+
+void reduce_into(void* dst, const void* src, size_t count, ReduceDtype dtype, ReduceOp op) {
+#ifdef REDUCE_X86
+    if (reduce_simd_enabled()) {
+        reduce_avx2(dst, src, count, dtype, op);
+        return;
+    }
+#endif
+    reduce_scalar(dst, src, 0, count, dtype, op);
+}
@@ -0,0 +1,36 @@
+#ifndef REDUCE_KERNELS_H
+#define REDUCE_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Element types of reductions; FLOAT16 is IEEE half, BFLOAT16 the upper
+// half of a float32
+enum ReduceDtype {
+    DTYPE_FLOAT32 = 0,
+    DTYPE_FLOAT16 = 1,
+    DTYPE_BFLOAT16 = 2,
+};
+
+enum ReduceOp {
+    REDUCE_SUM = 0,
+    REDUCE_MAX = 1,
+};
+
+size_t dtype_size(ReduceDtype dtype);
+
+// dst[i] = op(dst[i], src[i]) for count elements, in any alignment. Half
+// types are widened to float32, combined and rounded back to nearest even.
+// Uses AVX2/F16C when the CPU has them, picked once at first use.
+void reduce_into(void* dst, const void* src, size_t count, ReduceDtype dtype, ReduceOp op);
+
+// Whether the vector kernels are in use
+bool reduce_simd_enabled();
+
+// Scalar conversions, also used for the tails of the vector kernels
+float half_to_float(uint16_t h);
+uint16_t float_to_half(float f);
+float bf16_to_float(uint16_t b);
+uint16_t float_to_bf16(float f);
+
+#endif // REDUCE_KERNELS_H
@@ -0,0 +1,19 @@
+#include "registered_buffer.h"
+#include <cstdio>
+
+RegisteredBuffer::RegisteredBuffer(MRCache* cache, void* addr, size_t len) :
+    cache(cache), mr(nullptr), addr((char*)addr), len(len) {
+    if (!cache || len == 0) return;
+    // Whatever access the memory allows; read-only memory can still be sent
+    mr = cache->pin(addr, len);
+    if (!mr) fprintf(stderr, "RegisteredBuffer: failed to register %zu bytes\n", len);
+}
+
+RegisteredBuffer::~RegisteredBuffer() {
+    release();
+}
+
+void RegisteredBuffer::release() {
+    if (mr) cache->unpin(mr);
+    mr = nullptr;
+}
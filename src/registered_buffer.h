@@ -0,0 +1,44 @@
+#ifndef REGISTERED_BUFFER_H
+#define REGISTERED_BUFFER_H
+
+#include "mr_cache.h"
+#include <cstddef>
+#include <cstdint>
+
+// Caller-owned memory registered once and kept pinned in an MRCache for the
+// handle's lifetime, so every operation on it hits the cache. Without a
+// cache (TCP, emulated or shared-memory transports) it only records the
+// range, for bounds checks. The memory must outlive the handle.
+class RegisteredBuffer {
+private:
+    MRCache* cache;
+    ibv_mr* mr;
+    char* addr;
+    size_t len;
+
+public:
+    // cache may be nullptr
+    RegisteredBuffer(MRCache* cache, void* addr, size_t len);
+    ~RegisteredBuffer();
+
+    RegisteredBuffer(const RegisteredBuffer&) = delete;
+    RegisteredBuffer& operator=(const RegisteredBuffer&) = delete;
+
+    // Unpin early; the handle keeps its range but no longer a registration
+    void release();
+
+    // [offset, offset + n) inside the buffer, nullptr if it is not
+    void* slice(size_t offset, size_t n) const {
+        if (offset > len || n > len - offset) return nullptr;
+        return addr + offset;
+    }
+
+    bool valid() const { return cache == nullptr || mr != nullptr; }
+    bool registered() const { return mr != nullptr; }
+    void* data() const { return addr; }
+    size_t size() const { return len; }
+    uint32_t get_lkey() const { return mr ? mr->lkey : 0; }
+    uint32_t get_rkey() const { return mr ? mr->rkey : 0; }
+};
+
+#endif // REGISTERED_BUFFER_H
@@ -0,0 +1,80 @@
+#include "remote_sync.h"
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+RemoteCounter::RemoteCounter(Communicator* comm, uint64_t remote_addr, uint32_t rkey) :
+    comm(comm), remote_addr(remote_addr), rkey(rkey) {
+}
+
+int RemoteCounter::fetch_add(int64_t delta, uint64_t* old) {
+    return comm->fetch_add(remote_addr, rkey, (uint64_t)delta, old);
+}
+
+int RemoteCounter::next(uint64_t* value) {
+    uint64_t old;
+    if (comm->fetch_add(remote_addr, rkey, 1, &old)) return -1;
+    *value = old + 1;
+    return 0;
+}
+
+int RemoteCounter::get(uint64_t* value) {
+    // Adding zero reads the value atomically with respect to other updates
+    return comm->fetch_add(remote_addr, rkey, 0, value);
+}
+
+int RemoteCounter::reset(uint64_t value) {
+    // A compare-and-swap against the current value, retried until no update
+    // slipped in between
+    uint64_t cur;
+    if (get(&cur)) return -1;
+    while (true) {
+        uint64_t old;
+        if (comm->compare_swap(remote_addr, rkey, cur, value, &old)) return -1;
+        if (old == cur) return 0;
+        cur = old;
+    }
+}
+
+RemoteSpinLock::RemoteSpinLock(Communicator* comm, uint64_t remote_addr, uint32_t rkey, uint64_t owner_id) :
+    comm(comm), remote_addr(remote_addr), rkey(rkey), owner(owner_id) {
+    if (owner == 0) {
+        std::random_device rd;
+        owner = ((uint64_t)getpid() << 32) | rd();
+        if (owner == 0) owner = 1;
+    }
+    rng.seed((uint32_t)(owner ^ (owner >> 32)));
+}
+
+int RemoteSpinLock::try_lock() {
+    uint64_t old;
+    if (comm->compare_swap(remote_addr, rkey, 0, owner, &old)) return -1;
+    return old == 0 ? 1 : 0;
+}
+
+int RemoteSpinLock::lock(int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+    unsigned backoff = MIN_BACKOFF_US;
+    while (true) {
+        int ret = try_lock();
+        if (ret != 0) return ret;
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) return 0;
+
+        // Randomized exponential backoff keeps contenders from retrying in
+        // lockstep and flooding the holder's HCA with atomics
+        std::this_thread::sleep_for(std::chrono::microseconds(rng() % backoff + 1));
+        backoff = std::min(backoff * 2, (unsigned)MAX_BACKOFF_US);
+    }
+}
+
+int RemoteSpinLock::unlock() {
+    uint64_t old;
+    if (comm->compare_swap(remote_addr, rkey, owner, 0, &old)) return -1;
+    return old == owner ? 0 : -1;
+}
+
+int RemoteSpinLock::holder(uint64_t* owner_id) {
+    // A compare-and-swap that never matches reads the word atomically
+    return comm->compare_swap(remote_addr, rkey, 0, 0, owner_id);
+}
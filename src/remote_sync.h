@@ -0,0 +1,64 @@
+#ifndef REMOTE_SYNC_H
+#define REMOTE_SYNC_H
+
+#include "communicator.h"
+#include <cstdint>
+#include <random>
+
+// 64-bit counter in memory the peer registered, updated with remote
+// fetch-and-add. Any number of processes may share it through their own
+// communicators to the owner, e.g. to hand out sequence numbers or slots.
+class RemoteCounter {
+private:
+    Communicator* comm;     // not owned
+    uint64_t remote_addr;   // 8-byte aligned
+    uint32_t rkey;
+
+public:
+    RemoteCounter(Communicator* comm, uint64_t remote_addr, uint32_t rkey);
+
+    // Add delta (wrapping, so a negative delta subtracts); *old receives the
+    // value before. All return 0 on success, -1 on failure.
+    int fetch_add(int64_t delta, uint64_t* old);
+    // The value after adding one, for sequence numbers
+    int next(uint64_t* value);
+    int get(uint64_t* value);
+    // Only safe while no one else updates the counter
+    int reset(uint64_t value = 0);
+};
+
+// Spin lock on a 64-bit word in memory the peer registered: 0 when free,
+// the holder's owner id when held. Acquired with remote compare-and-swap and
+// released with a compare-and-swap back to 0, so only the holder can release
+// it. The owner of the memory must zero the word before first use.
+//
+// The lock is not recursive, and a holder that dies leaves it held.
+class RemoteSpinLock {
+private:
+    Communicator* comm;     // not owned
+    uint64_t remote_addr;   // 8-byte aligned
+    uint32_t rkey;
+    uint64_t owner;         // never 0
+    std::minstd_rand rng;   // backoff jitter
+
+    static const unsigned MIN_BACKOFF_US = 1;
+    static const unsigned MAX_BACKOFF_US = 1000;
+
+public:
+    // owner_id 0 picks one from the pid and a random number; it must differ
+    // between everyone sharing the lock
+    RemoteSpinLock(Communicator* comm, uint64_t remote_addr, uint32_t rkey, uint64_t owner_id = 0);
+
+    // Both return 1 once held, 0 if not acquired (held by someone else, or
+    // timeout_ms elapsed; negative waits forever), -1 on failure
+    int try_lock();
+    int lock(int timeout_ms = -1);
+    // Returns -1 if the lock is not held by this owner
+    int unlock();
+
+    // Current holder's owner id, 0 if free
+    int holder(uint64_t* owner_id);
+    uint64_t get_owner() { return owner; }
+};
+
+#endif // REMOTE_SYNC_H
@@ -0,0 +1,475 @@
+#include "shm_communicator.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+static const uint32_t SHM_VERSION = 2;
+static const size_t NAME_LEN = sizeof(((ShmRegion*)0)->seg_name);
+static const size_t PAGE = 4096;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+static int write_all(int fd, const void* buf, size_t n) {
+    const char* p = (const char*)buf;
+    while (n > 0) {
+        ssize_t k = ::write(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void* buf, size_t n) {
+    char* p = (char*)buf;
+    while (n > 0) {
+        ssize_t k = ::read(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// Create and map a fresh /dev/shm segment with a name nobody else uses
+static int create_segment(size_t size, ShmSegment& seg) {
+    static std::atomic<unsigned> seq(0);
+    std::random_device rd;
+    char name[NAME_LEN];
+    snprintf(name, sizeof(name), "/pyrdma-%d-%u-%08x", (int)getpid(), seq++, (unsigned)rd());
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return -1;
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name);
+        return -1;
+    }
+    seg.name = name;
+    seg.base = (char*)base;
+    seg.size = size;
+    return 0;
+}
+
+static void destroy_segment(ShmSegment& seg) {
+    munmap(seg.base, seg.size);
+    shm_unlink(seg.name.c_str());
+}
+
+// Map a segment the peer created; size 0 takes the size of the segment
+static int map_segment(const char* name, size_t size, ShmSegment& seg) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) || (size && (size_t)st.st_size < size)) {
+        close(fd);
+        return -1;
+    }
+    if (!size) size = st.st_size;
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    seg.name = name;
+    seg.base = (char*)base;
+    seg.size = size;
+    return 0;
+}
+
+ShmCommunicator::ShmCommunicator(int fd, size_t ring_size) :
+    socket_fd(fd), ring_size(PAGE), ctl(nullptr), ring(nullptr), peer_ctl(nullptr), peer_ring(nullptr),
+    peer_map_size(0), next_rkey(1), buffer_rkey(0), open_recvs(0) {
+    // Positions are masked, so the ring is a power of two
+    while (this->ring_size < ring_size) this->ring_size <<= 1;
+
+    size_t ring_offset = (sizeof(ShmControl) + PAGE - 1) / PAGE * PAGE;
+    if (create_segment(ring_offset + this->ring_size, control)) die("Failed to create shared memory segment");
+
+    // The pages start out zeroed
+    ctl = (ShmControl*)control.base;
+    ctl->magic = ShmControl::MAGIC;
+    ctl->version = SHM_VERSION;
+    ctl->ring_size = this->ring_size;
+    ctl->ring_offset = ring_offset;
+    ring = control.base + ring_offset;
+}
+
+ShmCommunicator::~ShmCommunicator() {
+    if (peer_ctl) munmap(peer_ctl, peer_map_size);
+    for (auto& kv : peer_maps) munmap(kv.second.base, kv.second.size);
+    for (auto& seg : segments) destroy_segment(seg);
+    destroy_segment(control);
+}
+
+int ShmCommunicator::peer_is_local(int fd) {
+    // Each side leaves a random token in a fresh segment and checks that it
+    // can map the peer's and read its token
+    ShmSegment probe;
+    if (create_segment(PAGE, probe)) return -1;
+    std::random_device rd;
+    uint64_t token = ((uint64_t)rd() << 32) | rd();
+    memcpy(probe.base, &token, sizeof(token));
+
+    // Segment name followed by the token
+    char out[NAME_LEN + sizeof(token)] = {0};
+    char in[sizeof(out)];
+    strncpy(out, probe.name.c_str(), NAME_LEN - 1);
+    memcpy(out + NAME_LEN, &token, sizeof(token));
+
+    int ret = -1;
+    if (write_all(fd, out, sizeof(out)) == 0 && read_all(fd, in, sizeof(in)) == 0) {
+        in[NAME_LEN - 1] = '\0';
+        ShmSegment peer;
+        uint8_t ok = 0;
+        if (map_segment(in, PAGE, peer) == 0) {
+            ok = memcmp(peer.base, in + NAME_LEN, sizeof(token)) == 0;
+            munmap(peer.base, peer.size);
+        }
+        uint8_t peer_ok;
+        if (write_all(fd, &ok, 1) == 0 && read_all(fd, &peer_ok, 1) == 0) ret = (ok && peer_ok) ? 1 : 0;
+    }
+    destroy_segment(probe);
+    return ret;
+}
+
+int ShmCommunicator::connect() {
+    char out[NAME_LEN] = {0};
+    char in[NAME_LEN];
+    strncpy(out, control.name.c_str(), NAME_LEN - 1);
+    if (write_all(socket_fd, out, sizeof(out)) || read_all(socket_fd, in, sizeof(in))) return -1;
+    in[NAME_LEN - 1] = '\0';
+
+    ShmSegment peer;
+    if (map_segment(in, 0, peer)) return -1;
+    ShmControl* pc = (ShmControl*)peer.base;
+    if (peer.size < sizeof(ShmControl) || pc->magic != ShmControl::MAGIC || pc->version != SHM_VERSION ||
+        (pc->ring_size & (pc->ring_size - 1)) || pc->ring_offset + pc->ring_size > peer.size) {
+        munmap(peer.base, peer.size);
+        return -1;
+    }
+    peer_ctl = pc;
+    peer_ring = peer.base + pc->ring_offset;
+    peer_map_size = peer.size;
+    return 0;
+}
+
+int ShmCommunicator::accept() {
+    // The exchange is symmetric
+    return connect();
+}
+
+void* ShmCommunicator::alloc_buffer(size_t size) {
+    ShmSegment seg;
+    if (create_segment((size + PAGE - 1) / PAGE * PAGE, seg)) return nullptr;
+    std::lock_guard<std::mutex> lock(region_mtx);
+    segments.push_back(seg);
+    return seg.base;
+}
+
+int ShmCommunicator::add_region(void* addr, size_t len, uint32_t* rkey) {
+    std::lock_guard<std::mutex> lock(region_mtx);
+    uint32_t n = ctl->num_regions.load(std::memory_order_relaxed);
+    if (n >= ShmControl::MAX_REGIONS) return -1;
+
+    // The peer can only reach memory it maps too
+    const ShmSegment* in = nullptr;
+    for (const auto& seg : segments) {
+        if ((char*)addr >= seg.base && (char*)addr + len <= seg.base + seg.size) {
+            in = &seg;
+            break;
+        }
+    }
+    if (!in) return -1;
+
+    ShmRegion& r = ctl->regions[n];
+    memset(&r, 0, sizeof(r));
+    r.addr = (uint64_t)(uintptr_t)addr;
+    r.len = len;
+    r.rkey = next_rkey++;
+    r.seg_offset = (char*)addr - in->base;
+    r.seg_size = in->size;
+    strncpy(r.seg_name, in->name.c_str(), NAME_LEN - 1);
+    *rkey = r.rkey;
+    // The entry is complete before the peer can see it
+    ctl->num_regions.store(n + 1, std::memory_order_release);
+    return 0;
+}
+
+int ShmCommunicator::set_buffer(void* buffer, size_t size) {
+    return add_region(buffer, size, &buffer_rkey);
+}
+
+int ShmCommunicator::expose_memory(void* addr, size_t len) {
+    uint32_t rkey;
+    return add_region(addr, len, &rkey);
+}
+
+int ShmCommunicator::resolve(uint64_t remote_addr, size_t len, uint32_t rkey, ShmPeerRegion& out) {
+    std::lock_guard<std::mutex> lock(region_mtx);
+    if (!peer_ctl) return -1;
+
+    auto it = peer_regions.find(rkey);
+    if (it == peer_regions.end()) {
+        // Pick up regions the peer registered since the last miss
+        uint32_t n = std::min(peer_ctl->num_regions.load(std::memory_order_acquire), (uint32_t)ShmControl::MAX_REGIONS);
+        for (uint32_t i = 0; i < n; i++) {
+            const ShmRegion& r = peer_ctl->regions[i];
+            if (peer_regions.count(r.rkey)) continue;
+
+            ShmPeerRegion pr;
+            pr.desc = r;
+            pr.desc.seg_name[NAME_LEN - 1] = '\0';
+            auto m = peer_maps.find(pr.desc.seg_name);
+            if (m == peer_maps.end()) {
+                ShmSegment seg;
+                if (map_segment(pr.desc.seg_name, pr.desc.seg_size, seg)) continue;
+                m = peer_maps.insert(std::make_pair(seg.name, seg)).first;
+            }
+            if (pr.desc.seg_offset + pr.desc.len > m->second.size) continue;
+            pr.base = m->second.base + pr.desc.seg_offset;
+            peer_regions[r.rkey] = pr;
+        }
+        it = peer_regions.find(rkey);
+        if (it == peer_regions.end()) return -1;
+    }
+
+    const ShmRegion& d = it->second.desc;
+    if (remote_addr < d.addr || len > d.len || remote_addr - d.addr > d.len - len) return -1;
+    out = it->second;
+    return 0;
+}
+
+int ShmCommunicator::transfer(bool is_read, const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    ShmPeerRegion pr;
+    if (resolve(remote_addr, total, rkey, pr)) return -1;
+
+    char* remote = pr.base + (remote_addr - pr.desc.addr);
+    for (int i = 0; i < iovcnt; i++) {
+        if (is_read) memcpy(iov[i].iov_base, remote, iov[i].iov_len);
+        else memcpy(remote, iov[i].iov_base, iov[i].iov_len);
+        remote += iov[i].iov_len;
+    }
+    return 0;
+}
+
+bool ShmCommunicator::peer_alive() {
+    // Nothing travels on the socket after connect, so any event means it closed
+    pollfd pfd;
+    pfd.fd = socket_fd;
+    pfd.events = POLLIN | POLLRDHUP;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0) return true;
+    return !(pfd.revents & (POLLHUP | POLLRDHUP | POLLERR | POLLNVAL));
+}
+
+int ShmCommunicator::backoff(unsigned& spins) {
+    // Spin first for latency, then yield; check on the peer now and then
+    if (++spins < SPIN_COUNT) {
+        cpu_relax();
+        return 0;
+    }
+    sched_yield();
+    if (spins % PEER_CHECK_INTERVAL == 0 && !peer_alive()) return -1;
+    return 0;
+}
+
+int ShmCommunicator::ring_write(const char* p, size_t n) {
+    size_t size = peer_ctl->ring_size;
+    uint64_t tail = peer_ctl->tail.load(std::memory_order_relaxed);
+    unsigned spins = 0;
+    while (n > 0) {
+        size_t room = size - (size_t)(tail - peer_ctl->head.load(std::memory_order_acquire));
+        if (room == 0) {
+            if (backoff(spins)) return -1;
+            continue;
+        }
+        spins = 0;
+
+        size_t k = std::min(room, n);
+        size_t pos = tail & (size - 1);
+        size_t first = std::min(k, size - pos);
+        memcpy(peer_ring + pos, p, first);
+        memcpy(peer_ring, p + first, k - first);
+        tail += k;
+        peer_ctl->tail.store(tail, std::memory_order_release);
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+int ShmCommunicator::ring_read(char* p, size_t n) {
+    // A null p drops the bytes
+    size_t size = ring_size;
+    uint64_t head = ctl->head.load(std::memory_order_relaxed);
+    unsigned spins = 0;
+    while (n > 0) {
+        size_t avail = (size_t)(ctl->tail.load(std::memory_order_acquire) - head);
+        if (avail == 0) {
+            if (backoff(spins)) return -1;
+            continue;
+        }
+        spins = 0;
+
+        size_t k = std::min(avail, n);
+        if (p) {
+            size_t pos = head & (size - 1);
+            size_t first = std::min(k, size - pos);
+            memcpy(p, ring + pos, first);
+            memcpy(p + first, ring, k - first);
+            p += k;
+        }
+        head += k;
+        ctl->head.store(head, std::memory_order_release);
+        n -= k;
+    }
+    return 0;
+}
+
+int ShmCommunicator::post_receive(void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    std::lock_guard<std::mutex> lock(recv_mtx);
+    posted_recvs.push_back(std::vector<struct iovec>(1, iov));
+    open_recvs++;
+    return 0;
+}
+
+int ShmCommunicator::send(const void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    return sendv(&iov, 1);
+}
+
+int ShmCommunicator::recv(void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    return recvv(&iov, 1);
+}
+
+int ShmCommunicator::sendv(const struct iovec* iov, int iovcnt) {
+    if (!peer_ctl) return -1;
+    // Messages are a 64-bit length followed by the payload
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+    std::lock_guard<std::mutex> lock(send_mtx);
+    if (ring_write((const char*)&total, sizeof(total))) return -1;
+    for (int i = 0; i < iovcnt; i++) {
+        if (ring_write((const char*)iov[i].iov_base, iov[i].iov_len)) return -1;
+    }
+    return (int)total;
+}
+
+int ShmCommunicator::recvv(const struct iovec* iov, int iovcnt) {
+    if (!peer_ctl) return -1;
+    std::lock_guard<std::mutex> lock(recv_mtx);
+    std::vector<struct iovec> dst(iov, iov + iovcnt);
+    if (posted_recvs.empty()) return read_message(dst);
+
+    dst.swap(posted_recvs.front());
+    posted_recvs.pop_front();
+    int ret = read_message(dst);
+    // The posted buffer is done with only now
+    open_recvs--;
+    return ret;
+}
+
+int ShmCommunicator::read_message(const std::vector<struct iovec>& dst) {
+    uint64_t len;
+    if (ring_read((char*)&len, sizeof(len))) return -1;
+    size_t cap = 0;
+    for (const auto& v : dst) cap += v.iov_len;
+    // Like an HCA, a message longer than the receive buffer fails the receive
+    if (len > cap) {
+        ring_read(nullptr, len);
+        return -1;
+    }
+
+    size_t left = len;
+    for (const auto& v : dst) {
+        size_t n = std::min((size_t)v.iov_len, left);
+        if (ring_read((char*)v.iov_base, n)) return -1;
+        left -= n;
+    }
+    return (int)len;
+}
+
+int ShmCommunicator::write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)local_buf + offset;
+    iov.iov_len = len;
+    return transfer(false, &iov, 1, remote_addr + offset, rkey);
+}
+
+int ShmCommunicator::read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)local_buf + offset;
+    iov.iov_len = len;
+    return transfer(true, &iov, 1, remote_addr + offset, rkey);
+}
+
+int ShmCommunicator::writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    return transfer(false, iov, iovcnt, remote_addr, rkey);
+}
+
+int ShmCommunicator::readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    return transfer(true, iov, iovcnt, remote_addr, rkey);
+}
+
+// Atomics use the CPU's own instructions on the shared mapping, so they are
+// atomic against the owner's __atomic accesses too
+uint64_t* ShmCommunicator::atomic_target(uint64_t remote_addr, uint32_t rkey) {
+    ShmPeerRegion pr;
+    if (remote_addr % 8 || resolve(remote_addr, 8, rkey, pr)) return nullptr;
+    return (uint64_t*)(pr.base + (remote_addr - pr.desc.addr));
+}
+
+int ShmCommunicator::fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) {
+    uint64_t* p = atomic_target(remote_addr, rkey);
+    if (!p) return -1;
+    *old = __atomic_fetch_add(p, add, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+int ShmCommunicator::compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap,
+                                  uint64_t* old) {
+    uint64_t* p = atomic_target(remote_addr, rkey);
+    if (!p) return -1;
+    // On failure expected is updated to the current value, on success it
+    // already is the old one
+    uint64_t expected = compare;
+    __atomic_compare_exchange_n(p, &expected, swap, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    *old = expected;
+    return 0;
+}
@@ -0,0 +1,149 @@
+#ifndef SHM_COMMUNICATOR_H
+#define SHM_COMMUNICATOR_H
+
+#include "communicator.h"
+#include <sys/types.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Region a process registered, as published in its control segment
+struct ShmRegion {
+    uint64_t addr;          // address in the owner's address space
+    uint64_t len;
+    uint32_t rkey;
+    uint32_t reserved;
+    uint64_t seg_offset;    // of addr in the segment
+    uint64_t seg_size;
+    char seg_name[48];
+};
+
+// Head of every control segment: the owner's receive ring and region table.
+// The peer produces into the ring and reads the table; the owner only
+// appends regions, publishing each one by bumping num_regions.
+struct ShmControl {
+    static const uint32_t MAGIC = 0x5052534d;   // "PRSM"
+    static const uint32_t MAX_REGIONS = 64;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;     // power of two
+    uint64_t ring_offset;   // of the ring data from the start of the segment
+    alignas(64) std::atomic<uint64_t> head;     // bytes consumed by the owner
+    alignas(64) std::atomic<uint64_t> tail;     // bytes produced by the peer
+    alignas(64) std::atomic<uint32_t> num_regions;
+    ShmRegion regions[MAX_REGIONS];
+};
+
+// Region of the peer, mapped on first use
+struct ShmPeerRegion {
+    ShmRegion desc;
+    char* base;             // local mapping of desc.addr
+};
+
+// Shared segment created by this process
+struct ShmSegment {
+    std::string name;
+    char* base;
+    size_t size;
+};
+
+// Communicator for two processes on the same host. Messages go through a
+// lock-free single-producer/single-consumer byte ring in the receiver's
+// control segment; one-sided write/read are a memcpy into the peer's memory,
+// with (addr, rkey) resolved through the peer's region table. Only memory
+// from alloc_buffer(), which both processes map, can be registered; nothing
+// else of either process is reachable by the peer.
+//
+// The socket is used to exchange segment names on connect and afterwards
+// only to notice that the peer went away. Segments are unlinked when the
+// communicator is destroyed.
+class ShmCommunicator : public Communicator {
+private:
+    int socket_fd;
+    size_t ring_size;
+
+    ShmSegment control;             // our receive ring and region table
+    ShmControl* ctl;
+    char* ring;
+    ShmControl* peer_ctl;           // the peer's, we produce into its ring
+    char* peer_ring;
+    size_t peer_map_size;
+
+    std::vector<ShmSegment> segments;           // alloc_buffer() memory
+    std::unordered_map<uint32_t, ShmPeerRegion> peer_regions;
+    std::unordered_map<std::string, ShmSegment> peer_maps;     // by segment name
+    uint32_t next_rkey;
+    uint32_t buffer_rkey;
+    std::deque<std::vector<struct iovec>> posted_recvs;
+    std::atomic<size_t> open_recvs;     // posted and not yet completed, see posted_receives()
+
+    // Each ring has one producer and one consumer thread at a time
+    std::mutex send_mtx;
+    std::mutex recv_mtx;
+    std::mutex region_mtx;
+
+    static const unsigned SPIN_COUNT = 4096;
+    static const unsigned PEER_CHECK_INTERVAL = 4096;
+
+    int add_region(void* addr, size_t len, uint32_t* rkey);
+    int resolve(uint64_t remote_addr, size_t len, uint32_t rkey, ShmPeerRegion& out);
+    int backoff(unsigned& spins);
+    bool peer_alive();
+    int ring_write(const char* p, size_t n);
+    int ring_read(char* p, size_t n);
+    int read_message(const std::vector<struct iovec>& dst);
+    int transfer(bool is_read, const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey);
+    uint64_t* atomic_target(uint64_t remote_addr, uint32_t rkey);
+
+public:
+    static const size_t DEFAULT_RING_SIZE = 8 << 20;
+
+    ShmCommunicator(int fd, size_t ring_size = DEFAULT_RING_SIZE);
+    ~ShmCommunicator();
+
+    // Whether the process at the other end of fd shares our /dev/shm; both
+    // sides call it together. Returns 1 if so, 0 if not, -1 on socket errors.
+    static int peer_is_local(int fd);
+
+    // Exchange control segments; both sides call one of them
+    int connect();
+    int accept();
+
+    // Memory both processes map, so the peer's writes and reads are a memcpy.
+    // It stays valid until the communicator is destroyed.
+    void* alloc_buffer(size_t size);
+
+    // Register alloc_buffer() memory the peer may access, -1 for any other
+    // memory; regions are visible to the peer as soon as they are registered
+    int set_buffer(void* buffer, size_t size) override;
+    int expose_memory(void* addr, size_t len);
+
+    // Receive into buf instead of the buffer given to the next recv()
+    int post_receive(void* buf, size_t len, size_t offset = 0) override;
+    size_t posted_receives() override { return open_recvs.load(); }
+
+    int send(const void* buf, size_t len, size_t offset = 0) override;
+    // Takes the oldest posted receive buffer, or buf if none is posted;
+    // returns the message length, -1 if it does not fit
+    int recv(void* buf, size_t len, size_t offset = 0) override;
+
+    int write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
+    int read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
+
+    int sendv(const struct iovec* iov, int iovcnt) override;
+    int recvv(const struct iovec* iov, int iovcnt) override;
+    int writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+    int readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+
+    int fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) override;
+    int compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap, uint64_t* old) override;
+
+    uint32_t get_rkey() override { return buffer_rkey; }
+    int get_fd() { return socket_fd; }
+};
+
+#endif // SHM_COMMUNICATOR_H
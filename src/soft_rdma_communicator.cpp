@@ -0,0 +1,668 @@
+#include "soft_rdma_communicator.h"
+#include "comm_trace.h"
+#include <arpa/inet.h>
+#include <endian.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+// Frame header, all integers in network byte order:
+//   type u8 | flags u8 | reserved u16 | rkey u32 | req u64 | addr u64 | len u64
+// followed by len payload bytes, except for READ where len is the size requested
+static const size_t HDR_LEN = 32;
+static const size_t MR_LEN = 8 + 8 + 4;
+
+enum {
+    FRAME_REGIONS = 1,      // payload: the sender's regions
+    FRAME_SEND = 2,
+    FRAME_WRITE = 3,        // one chunk of a write to addr
+    FRAME_READ = 4,         // request for len bytes at addr
+    FRAME_READ_DATA = 5,    // one chunk of a read, addr is the offset in the request
+    FRAME_ACK = 6,          // completes a write, or fails a write/read; addr carries an atomic's old value
+    FRAME_ATOMIC = 7,       // 8-byte atomic at addr, payload: compare_add u64 | swap u64
+};
+
+static const uint8_t FLAG_LAST = 1;     // last chunk of an operation
+static const uint8_t FLAG_ERROR = 2;    // access outside the target's regions
+static const uint8_t FLAG_CAS = 4;      // atomic is a compare-and-swap, else a fetch-and-add
+static const size_t ATOMIC_LEN = 16;
+
+static void put32(uint8_t* p, uint32_t v) { v = htonl(v); memcpy(p, &v, 4); }
+static void put64(uint8_t* p, uint64_t v) { v = htobe64(v); memcpy(p, &v, 8); }
+static uint32_t get32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return ntohl(v); }
+static uint64_t get64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return be64toh(v); }
+
+// Complete a receive with a buffered send; too long a message fails it
+static void deliver(SoftRecv& r, const std::vector<char>& data) {
+    r.state = 1;
+    r.result = -1;
+    if (data.size() > r.cap) return;
+    size_t pos = 0;
+    for (size_t i = 0; i < r.iov.size() && pos < data.size(); i++) {
+        size_t n = std::min(r.iov[i].iov_len, data.size() - pos);
+        memcpy(r.iov[i].iov_base, data.data() + pos, n);
+        pos += n;
+    }
+    r.result = (int)data.size();
+}
+
+// The segments covering [off, off + len) of an iovec list
+static void slice_iov(const struct iovec* iov, int iovcnt, size_t off, size_t len, std::vector<struct iovec>& out) {
+    out.clear();
+    for (int i = 0; i < iovcnt && len > 0; i++) {
+        if (off >= iov[i].iov_len) {
+            off -= iov[i].iov_len;
+            continue;
+        }
+        size_t n = std::min(iov[i].iov_len - off, len);
+        struct iovec seg;
+        seg.iov_base = (char*)iov[i].iov_base + off;
+        seg.iov_len = n;
+        out.push_back(seg);
+        len -= n;
+        off = 0;
+    }
+}
+
+static size_t iov_total(const struct iovec* iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    return total;
+}
+
+SoftRDMACommunicator::SoftRDMACommunicator(int fd, const TCPConfig& config) :
+    socket_fd(fd), stream(fd, config), broken(false), stopping(false), peer_ready(false),
+    connected(false), next_rkey(1), buffer_rkey(0), next_req(1), filled_recvs(0) {
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) die("Failed to create eventfd");
+
+    progress_thread = std::thread(&SoftRDMACommunicator::progress_loop, this);
+    responder_thread = std::thread(&SoftRDMACommunicator::responder_loop, this);
+}
+
+SoftRDMACommunicator::~SoftRDMACommunicator() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    // The progress thread notices between two frames
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0) perror("eventfd write");
+    responder_cv.notify_all();
+    progress_thread.join();
+    responder_thread.join();
+    close(wake_fd);
+}
+
+int SoftRDMACommunicator::send_frame(uint8_t type, uint8_t flags, uint32_t rkey, uint64_t req, uint64_t addr,
+                                     const struct iovec* iov, int iovcnt, size_t len) {
+    uint8_t hdr[HDR_LEN] = {0};
+    hdr[0] = type;
+    hdr[1] = flags;
+    put32(hdr + 4, rkey);
+    put64(hdr + 8, req);
+    put64(hdr + 16, addr);
+    put64(hdr + 24, len);
+
+    std::vector<struct iovec> v(1 + iovcnt);
+    v[0].iov_base = hdr;
+    v[0].iov_len = HDR_LEN;
+    std::copy(iov, iov + iovcnt, v.begin() + 1);
+
+    std::lock_guard<std::mutex> lock(send_mtx);
+    return stream.sendv(v.data(), (int)v.size()) < 0 ? -1 : 0;
+}
+
+int SoftRDMACommunicator::advertise_regions() {
+    std::vector<uint8_t> payload;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        payload.resize(regions.size() * MR_LEN);
+        uint8_t* p = payload.data();
+        for (const auto& d : regions) {
+            put64(p, d.addr);
+            put64(p + 8, d.len);
+            put32(p + 16, d.rkey);
+            p += MR_LEN;
+        }
+    }
+    struct iovec iov;
+    iov.iov_base = payload.data();
+    iov.iov_len = payload.size();
+    return send_frame(FRAME_REGIONS, 0, 0, 0, 0, &iov, 1, payload.size());
+}
+
+int SoftRDMACommunicator::connect() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        connected = true;
+    }
+    if (advertise_regions()) return -1;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return peer_ready || broken; });
+    return peer_ready ? 0 : -1;
+}
+
+int SoftRDMACommunicator::accept() {
+    // The exchange is symmetric
+    return connect();
+}
+
+int SoftRDMACommunicator::add_region(void* addr, size_t len, uint32_t* rkey) {
+    bool advertise;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        MRDescriptor d;
+        d.addr = (uint64_t)(uintptr_t)addr;
+        d.len = len;
+        d.rkey = next_rkey++;
+        regions.push_back(d);
+        *rkey = d.rkey;
+        advertise = connected;
+    }
+    return advertise ? advertise_regions() : 0;
+}
+
+int SoftRDMACommunicator::set_buffer(void* buffer, size_t size) {
+    return add_region(buffer, size, &buffer_rkey);
+}
+
+int SoftRDMACommunicator::expose_memory(void* addr, size_t len) {
+    uint32_t rkey;
+    return add_region(addr, len, &rkey);
+}
+
+std::vector<MRDescriptor> SoftRDMACommunicator::get_peer_regions() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return peer_regions;
+}
+
+bool SoftRDMACommunicator::check_region(uint64_t addr, uint64_t len, uint32_t rkey) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto& d : regions) {
+        if (d.rkey == rkey && addr >= d.addr && len <= d.len && addr - d.addr <= d.len - len) return true;
+    }
+    return false;
+}
+
+int64_t SoftRDMACommunicator::new_request(const char* name, uint64_t bytes, const struct iovec* dst, int iovcnt) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (broken) return -1;
+    uint64_t id = next_req++;
+    SoftRequest& req = requests[id];
+    req.state = 0;
+    req.result = 0;
+    req.value = 0;
+    req.dst.assign(dst, dst + iovcnt);
+    req.name = name;
+    if (trace_enabled()) trace_record(TRACE_POST, name, this, id, bytes, 0, 0);
+    return (int64_t)id;
+}
+
+void SoftRDMACommunicator::complete_request(uint64_t req, bool ok, uint64_t value) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = requests.find(req);
+    // A failed write may be acknowledged again by its last chunk
+    if (it == requests.end() || it->second.state) return;
+    it->second.state = 1;
+    it->second.result = ok ? 0 : -1;
+    it->second.value = value;
+    if (trace_enabled()) trace_record(TRACE_COMPLETE, it->second.name, this, req, 0, 0, ok ? 0 : -1);
+    cv.notify_all();
+}
+
+void SoftRDMACommunicator::fail_all() {
+    std::lock_guard<std::mutex> lock(mtx);
+    broken = true;
+    for (auto& kv : requests) {
+        if (kv.second.state) continue;
+        kv.second.state = 1;
+        kv.second.result = -1;
+    }
+    for (size_t i = filled_recvs; i < posted_recvs.size(); i++) {
+        posted_recvs[i].state = 1;
+        posted_recvs[i].result = -1;
+    }
+    filled_recvs = posted_recvs.size();
+    cv.notify_all();
+    responder_cv.notify_all();
+}
+
+int SoftRDMACommunicator::post_receive(void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    return post_receivev(&iov, 1);
+}
+
+int SoftRDMACommunicator::post_receivev(const struct iovec* iov, int iovcnt) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (broken) return -1;
+
+    SoftRecv r;
+    r.iov.assign(iov, iov + iovcnt);
+    r.cap = iov_total(iov, iovcnt);
+    r.state = 0;
+    r.result = 0;
+
+    // A send that arrived early completes the receive right away
+    if (!unexpected.empty()) {
+        deliver(r, unexpected.front());
+        unexpected.pop_front();
+        filled_recvs++;
+    }
+    posted_recvs.push_back(std::move(r));
+    return 0;
+}
+
+size_t SoftRDMACommunicator::posted_receives() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return posted_recvs.size();
+}
+
+int SoftRDMACommunicator::complete_recv() {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (posted_recvs.empty()) return -1;
+    cv.wait(lock, [this] { return posted_recvs.front().state || broken; });
+    if (!posted_recvs.front().state) return -1;
+    int result = posted_recvs.front().result;
+    posted_recvs.pop_front();
+    filled_recvs--;
+    return result;
+}
+
+int SoftRDMACommunicator::send(const void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    return sendv(&iov, 1);
+}
+
+int SoftRDMACommunicator::recv(void* buf, size_t len, size_t offset) {
+    bool none;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        none = posted_recvs.empty();
+    }
+    if (none && post_receive(buf, len, offset)) return -1;
+    return complete_recv();
+}
+
+int SoftRDMACommunicator::sendv(const struct iovec* iov, int iovcnt) {
+    size_t total = iov_total(iov, iovcnt);
+    if (send_frame(FRAME_SEND, 0, 0, 0, 0, iov, iovcnt, total)) return -1;
+    return (int)total;
+}
+
+int SoftRDMACommunicator::recvv(const struct iovec* iov, int iovcnt) {
+    bool none;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        none = posted_recvs.empty();
+    }
+    if (none && post_receivev(iov, iovcnt)) return -1;
+    return complete_recv();
+}
+
+int64_t SoftRDMACommunicator::post_writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    size_t total = iov_total(iov, iovcnt);
+    int64_t req = new_request("write", total, nullptr, 0);
+    if (req < 0) return -1;
+
+    // Chunks go out back to back; the target acknowledges the last one
+    size_t off = 0;
+    std::vector<struct iovec> part;
+    do {
+        size_t n = std::min((size_t)CHUNK_SIZE, total - off);
+        slice_iov(iov, iovcnt, off, n, part);
+        uint8_t flags = (off + n == total) ? FLAG_LAST : 0;
+        if (send_frame(FRAME_WRITE, flags, rkey, (uint64_t)req, remote_addr + off, part.data(), (int)part.size(), n)) {
+            std::lock_guard<std::mutex> lock(mtx);
+            requests.erase((uint64_t)req);
+            return -1;
+        }
+        off += n;
+    } while (off < total);
+    return req;
+}
+
+int64_t SoftRDMACommunicator::post_readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    int64_t req = new_request("read", iov_total(iov, iovcnt), iov, iovcnt);
+    if (req < 0) return -1;
+    if (send_frame(FRAME_READ, 0, rkey, (uint64_t)req, remote_addr, nullptr, 0, iov_total(iov, iovcnt))) {
+        std::lock_guard<std::mutex> lock(mtx);
+        requests.erase((uint64_t)req);
+        return -1;
+    }
+    return req;
+}
+
+int64_t SoftRDMACommunicator::post_write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)local_buf + offset;
+    iov.iov_len = len;
+    return post_writev(&iov, 1, remote_addr + offset, rkey);
+}
+
+int64_t SoftRDMACommunicator::post_read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)local_buf + offset;
+    iov.iov_len = len;
+    return post_readv(&iov, 1, remote_addr + offset, rkey);
+}
+
+int SoftRDMACommunicator::write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    int64_t req = post_write(local_buf, len, remote_addr, rkey, offset);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int SoftRDMACommunicator::read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset) {
+    int64_t req = post_read(local_buf, len, remote_addr, rkey, offset);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int SoftRDMACommunicator::writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    int64_t req = post_writev(iov, iovcnt, remote_addr, rkey);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int SoftRDMACommunicator::readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) {
+    int64_t req = post_readv(iov, iovcnt, remote_addr, rkey);
+    if (req < 0) return -1;
+    return wait(req);
+}
+
+int SoftRDMACommunicator::test(int64_t req) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = requests.find((uint64_t)req);
+    if (it == requests.end()) return -1;
+    return it->second.state ? 1 : 0;
+}
+
+int SoftRDMACommunicator::wait(int64_t req) {
+    return wait_request(req, nullptr);
+}
+
+int SoftRDMACommunicator::wait_request(int64_t req, uint64_t* value) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = requests.find((uint64_t)req);
+    if (it == requests.end()) return -1;
+    cv.wait(lock, [&] { return it->second.state != 0; });
+    int result = it->second.result;
+    if (value) *value = it->second.value;
+    requests.erase(it);
+    return result;
+}
+
+int SoftRDMACommunicator::atomic_op(uint8_t flags, uint64_t remote_addr, uint32_t rkey, uint64_t compare_add,
+                                    uint64_t swap, uint64_t* old) {
+    if (remote_addr % 8) return -1;
+    int64_t req = new_request("atomic", 8, nullptr, 0);
+    if (req < 0) return -1;
+
+    uint8_t payload[ATOMIC_LEN];
+    put64(payload, compare_add);
+    put64(payload + 8, swap);
+    struct iovec iov;
+    iov.iov_base = payload;
+    iov.iov_len = ATOMIC_LEN;
+    if (send_frame(FRAME_ATOMIC, flags, rkey, (uint64_t)req, remote_addr, &iov, 1, ATOMIC_LEN)) {
+        std::lock_guard<std::mutex> lock(mtx);
+        requests.erase((uint64_t)req);
+        return -1;
+    }
+    return wait_request(req, old);
+}
+
+int SoftRDMACommunicator::fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) {
+    return atomic_op(0, remote_addr, rkey, add, 0, old);
+}
+
+int SoftRDMACommunicator::compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap,
+                                       uint64_t* old) {
+    return atomic_op(FLAG_CAS, remote_addr, rkey, compare, swap, old);
+}
+
+int SoftRDMACommunicator::discard(size_t len) {
+    char scratch[64 * 1024];
+    while (len > 0) {
+        size_t n = std::min(len, sizeof(scratch));
+        if (stream.recv(scratch, n) < 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+int SoftRDMACommunicator::fill_recv(size_t len) {
+    // Results are ints; nothing on the wire may size a buffer unchecked
+    if (len > (size_t)INT_MAX) return -1;
+    std::vector<struct iovec> iov;
+    size_t cap = 0;
+    bool have;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        have = filled_recvs < posted_recvs.size();
+        if (have) {
+            iov = posted_recvs[filled_recvs].iov;
+            cap = posted_recvs[filled_recvs].cap;
+        }
+    }
+
+    if (!have) {
+        if (len > MAX_UNEXPECTED_LEN) return -1;
+        std::vector<char> data(len);
+        if (stream.recv(data.data(), len) < 0) return -1;
+        std::lock_guard<std::mutex> lock(mtx);
+        // A receive posted while we were reading found nothing buffered yet
+        if (unexpected.empty() && filled_recvs < posted_recvs.size()) {
+            deliver(posted_recvs[filled_recvs], data);
+            filled_recvs++;
+            cv.notify_all();
+        } else {
+            unexpected.push_back(std::move(data));
+        }
+        return 0;
+    }
+
+    // Like an HCA, a message longer than the receive buffer fails the receive
+    int result = (int)len;
+    if (len > cap) {
+        if (discard(len)) return -1;
+        result = -1;
+    } else {
+        std::vector<struct iovec> part;
+        slice_iov(iov.data(), (int)iov.size(), 0, len, part);
+        if (stream.recvv(part.data(), (int)part.size()) < 0) return -1;
+    }
+
+    // Earlier receives may have been completed meanwhile, which shifts the
+    // index; a failed connection has completed them all
+    std::lock_guard<std::mutex> lock(mtx);
+    if (broken) return -1;
+    posted_recvs[filled_recvs].state = 1;
+    posted_recvs[filled_recvs].result = result;
+    filled_recvs++;
+    cv.notify_all();
+    return 0;
+}
+
+void SoftRDMACommunicator::progress_loop() {
+    while (true) {
+        pollfd pfds[2];
+        pfds[0].fd = socket_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = wake_fd;
+        pfds[1].events = POLLIN;
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfds[1].revents) break;
+
+        uint8_t hdr[HDR_LEN];
+        if (stream.recv(hdr, HDR_LEN) < 0) break;
+        uint8_t type = hdr[0];
+        uint8_t flags = hdr[1];
+        uint32_t rkey = get32(hdr + 4);
+        uint64_t req = get64(hdr + 8);
+        uint64_t addr = get64(hdr + 16);
+        uint64_t len = get64(hdr + 24);
+
+        int ret = 0;
+        switch (type) {
+        case FRAME_REGIONS: {
+            if (len % MR_LEN || len > HS_MAX_LEN) {
+                ret = -1;
+                break;
+            }
+            std::vector<uint8_t> payload(len);
+            if (stream.recv(payload.data(), len) < 0) {
+                ret = -1;
+                break;
+            }
+            std::vector<MRDescriptor> mrs(len / MR_LEN);
+            for (size_t i = 0; i < mrs.size(); i++) {
+                const uint8_t* p = payload.data() + i * MR_LEN;
+                mrs[i].addr = get64(p);
+                mrs[i].len = get64(p + 8);
+                mrs[i].rkey = get32(p + 16);
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            peer_regions.swap(mrs);
+            peer_ready = true;
+            cv.notify_all();
+            break;
+        }
+        case FRAME_SEND:
+            ret = fill_recv(len);
+            break;
+        case FRAME_WRITE: {
+            // The payload lands directly in the registered memory
+            bool ok = check_region(addr, len, rkey);
+            ret = ok ? stream.recv((void*)(uintptr_t)addr, len) : discard(len);
+            if (ret < 0) break;
+            if (!ok || (flags & FLAG_LAST)) {
+                std::lock_guard<std::mutex> lock(mtx);
+                responses.push_back(SoftResponse{ FRAME_ACK, (uint8_t)(ok ? 0 : FLAG_ERROR), req, 0, 0 });
+                responder_cv.notify_one();
+            }
+            break;
+        }
+        case FRAME_READ: {
+            bool ok = check_region(addr, len, rkey);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (ok) {
+                responses.push_back(SoftResponse{ FRAME_READ_DATA, 0, req, addr, len });
+            } else {
+                responses.push_back(SoftResponse{ FRAME_ACK, FLAG_ERROR, req, 0, 0 });
+            }
+            responder_cv.notify_one();
+            break;
+        }
+        case FRAME_ATOMIC: {
+            uint8_t payload[ATOMIC_LEN];
+            if (len != ATOMIC_LEN || stream.recv(payload, ATOMIC_LEN) < 0) {
+                ret = -1;
+                break;
+            }
+            bool ok = addr % 8 == 0 && check_region(addr, 8, rkey);
+            uint64_t old = 0;
+            if (ok) {
+                uint64_t* p = (uint64_t*)(uintptr_t)addr;
+                if (flags & FLAG_CAS) {
+                    old = get64(payload);
+                    __atomic_compare_exchange_n(p, &old, get64(payload + 8), false, __ATOMIC_SEQ_CST,
+                                                __ATOMIC_SEQ_CST);
+                } else {
+                    old = __atomic_fetch_add(p, get64(payload), __ATOMIC_SEQ_CST);
+                }
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            responses.push_back(SoftResponse{ FRAME_ACK, (uint8_t)(ok ? 0 : FLAG_ERROR), req, old, 0 });
+            responder_cv.notify_one();
+            break;
+        }
+        case FRAME_READ_DATA: {
+            // addr is the offset of the chunk within the read. Data for no
+            // pending read, or past its end, means the peer is out of step:
+            // the connection fails, failing the read with it
+            std::vector<struct iovec> part;
+            bool known;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                auto it = requests.find(req);
+                known = it != requests.end() && !it->second.state;
+                if (known) {
+                    size_t total = iov_total(it->second.dst.data(), (int)it->second.dst.size());
+                    known = addr <= total && len <= total - addr;
+                }
+                if (known) slice_iov(it->second.dst.data(), (int)it->second.dst.size(), addr, len, part);
+            }
+            if (!known) {
+                ret = -1;
+                break;
+            }
+            ret = stream.recvv(part.data(), (int)part.size());
+            if (ret >= 0 && (flags & FLAG_LAST)) complete_request(req, true);
+            break;
+        }
+        case FRAME_ACK:
+            complete_request(req, !(flags & FLAG_ERROR), addr);
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+        if (ret < 0) break;
+    }
+    fail_all();
+}
+
+void SoftRDMACommunicator::responder_loop() {
+    while (true) {
+        SoftResponse r;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            responder_cv.wait(lock, [this] { return stopping || broken || !responses.empty(); });
+            if (stopping || broken) return;
+            r = responses.front();
+            responses.pop_front();
+        }
+
+        int ret = 0;
+        if (r.type == FRAME_ACK) {
+            ret = send_frame(FRAME_ACK, r.flags, 0, r.req, r.addr, nullptr, 0, 0);
+        } else {
+            // Served in chunks, so the caller's own frames can go in between
+            uint64_t off = 0;
+            do {
+                size_t n = (size_t)std::min((uint64_t)CHUNK_SIZE, r.len - off);
+                struct iovec iov;
+                iov.iov_base = (void*)(uintptr_t)(r.addr + off);
+                iov.iov_len = n;
+                uint8_t flags = (off + n == r.len) ? FLAG_LAST : 0;
+                ret = send_frame(FRAME_READ_DATA, flags, 0, r.req, off, &iov, 1, n);
+                off += n;
+            } while (ret == 0 && off < r.len);
+        }
+        if (ret < 0) {
+            fail_all();
+            return;
+        }
+    }
+}
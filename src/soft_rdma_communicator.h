@@ -0,0 +1,164 @@
+#ifndef SOFT_RDMA_COMMUNICATOR_H
+#define SOFT_RDMA_COMMUNICATOR_H
+
+#include "communicator.h"
+#include "rdma_handshake.h"
+#include "tcp_communicator.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Outstanding one-sided operation, completed by an acknowledgement (write)
+// or by the last chunk of data (read) from the peer
+struct SoftRequest {
+    int state;                      // 0 pending, 1 done
+    int result;                     // 0, or -1 on failure
+    std::vector<struct iovec> dst;  // read destination
+    uint64_t value;                 // atomic: the old value at the target
+    const char* name;               // operation, for the trace
+};
+
+// Receive buffer posted for the peer's next send
+struct SoftRecv {
+    std::vector<struct iovec> iov;
+    size_t cap;
+    int state;
+    int result;
+};
+
+// Response queued for the responder thread
+struct SoftResponse {
+    uint8_t type;
+    uint8_t flags;
+    uint64_t req;
+    uint64_t addr;
+    uint64_t len;
+};
+
+// Communicator emulating RDMA over a TCP connection, so code written against
+// the one-sided API runs (and can be benchmarked) without an HCA.
+//
+// Every operation travels as a framed message. WRITE payloads are applied
+// by a progress thread on the target straight into the registered memory;
+// READs are served from it by a responder thread. Large transfers are split
+// into CHUNK_SIZE frames that are pipelined on the stream, with one
+// acknowledgement per operation. Remote addresses and rkeys are checked
+// against the regions the target registered with set_buffer()/expose_memory(),
+// like an HCA checks them.
+//
+// Frames are processed in order, so a WRITE is visible at the target before
+// a SEND posted after it. A SEND with no receive posted is buffered until
+// the next post_receive().
+class SoftRDMACommunicator : public Communicator {
+private:
+    int socket_fd;
+    TCPCommunicator stream;
+    int wake_fd;        // eventfd to stop the progress thread
+
+    // Guards everything below; cv signals completions and peer state
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool broken;        // the connection failed, nothing completes any more
+    bool stopping;
+    bool peer_ready;    // the peer advertised its regions
+    bool connected;     // regions registered from now on are advertised at once
+
+    std::vector<MRDescriptor> regions;
+    std::vector<MRDescriptor> peer_regions;
+    uint32_t next_rkey;
+    uint32_t buffer_rkey;
+
+    std::unordered_map<uint64_t, SoftRequest> requests;
+    uint64_t next_req;
+    std::deque<SoftRecv> posted_recvs;
+    size_t filled_recvs;                        // posted receives already matched
+    std::deque<std::vector<char>> unexpected;   // sends that arrived before a receive
+
+    std::deque<SoftResponse> responses;
+    std::condition_variable responder_cv;
+
+    // Serializes frames from the caller and the responder thread
+    std::mutex send_mtx;
+
+    std::thread progress_thread;
+    std::thread responder_thread;
+
+    static const size_t CHUNK_SIZE = 256 * 1024;
+    // Longest send buffered before its receive is posted; a longer one, like
+    // any malformed frame, fails the connection
+    static const size_t MAX_UNEXPECTED_LEN = 256 << 20;
+
+    int send_frame(uint8_t type, uint8_t flags, uint32_t rkey, uint64_t req, uint64_t addr,
+                   const struct iovec* iov, int iovcnt, size_t len);
+    int advertise_regions();
+    int add_region(void* addr, size_t len, uint32_t* rkey);
+    bool check_region(uint64_t addr, uint64_t len, uint32_t rkey);
+    int64_t new_request(const char* name, uint64_t bytes, const struct iovec* dst, int iovcnt);
+    void complete_request(uint64_t req, bool ok, uint64_t value = 0);
+    int wait_request(int64_t req, uint64_t* value);
+    int atomic_op(uint8_t flags, uint64_t remote_addr, uint32_t rkey, uint64_t compare_add, uint64_t swap,
+                  uint64_t* old);
+    int complete_recv();
+    int fill_recv(size_t len);
+    int discard(size_t len);
+    void fail_all();
+    void progress_loop();
+    void responder_loop();
+
+public:
+    SoftRDMACommunicator(int fd, const TCPConfig& config = TCPConfig());
+    ~SoftRDMACommunicator();
+
+    // Advertise our regions and wait for the peer's; both sides call one
+    // of them, in either order
+    int connect();
+    int accept();
+
+    // Register memory the peer may access; after connect()/accept() the
+    // peer learns about it with the next frame it reads
+    int set_buffer(void* buffer, size_t size) override;
+    int expose_memory(void* addr, size_t len);
+    std::vector<MRDescriptor> get_peer_regions();
+
+    // Receives are matched to the peer's sends in posting order
+    int post_receive(void* buf, size_t len, size_t offset = 0) override;
+    int post_receivev(const struct iovec* iov, int iovcnt);
+    size_t posted_receives() override;
+
+    int send(const void* buf, size_t len, size_t offset = 0) override;
+    // Completes the oldest posted receive, posting buf first if none is
+    // pending; returns the number of bytes received
+    int recv(void* buf, size_t len, size_t offset = 0) override;
+
+    int write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
+    int read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0) override;
+
+    int sendv(const struct iovec* iov, int iovcnt) override;
+    int recvv(const struct iovec* iov, int iovcnt) override;
+    int writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+    int readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey) override;
+
+    // Non-blocking variants, return a request handle or -1 on failure
+    int64_t post_write(const void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0);
+    int64_t post_read(void* local_buf, size_t len, uint64_t remote_addr, uint32_t rkey, size_t offset = 0);
+    int64_t post_writev(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey);
+    int64_t post_readv(const struct iovec* iov, int iovcnt, uint64_t remote_addr, uint32_t rkey);
+
+    // test returns 1 if done, 0 if pending, -1 if unknown;
+    // wait returns the request result or -1 on failure
+    int test(int64_t req);
+    int wait(int64_t req);
+
+    // Executed by the target's progress thread with CPU atomics, so they are
+    // atomic against each other and against the target's own __atomic accesses
+    int fetch_add(uint64_t remote_addr, uint32_t rkey, uint64_t add, uint64_t* old) override;
+    int compare_swap(uint64_t remote_addr, uint32_t rkey, uint64_t compare, uint64_t swap, uint64_t* old) override;
+
+    uint32_t get_rkey() override { return buffer_rkey; }
+    int get_fd() { return socket_fd; }
+};
+
+#endif // SOFT_RDMA_COMMUNICATOR_H
@@ -1,36 +1,225 @@
 #include "tcp_communicator.h"
-#include <cstdlib>
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <unistd.h>
 #include <cerrno>
-#include <cstdio>
-#include <iostream>
+#include <vector>
 
-static void die(const char* msg) { 
-    perror(msg); 
-    exit(1); 
+// Older headers lack the zerocopy definitions
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+TCPCommunicator::TCPCommunicator(int fd, const TCPConfig& config) :
+    socket_fd(fd), config(config), zerocopy(false), zc_next(0), zc_done(0) {
+    // Best effort: not every socket type takes every option
+    int on = 1;
+    if (config.nodelay) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (config.sndbuf > 0) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &config.sndbuf, sizeof(config.sndbuf));
+    if (config.rcvbuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config.rcvbuf, sizeof(config.rcvbuf));
+    if (config.zerocopy_threshold > 0) {
+        zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+    }
 }
 
-int TCPCommunicator::send(const void* buf, size_t len, size_t offset) {
-    const char* p = (const char*)buf + offset;
-    ssize_t ret = ::send(socket_fd, p, len, 0);
-    std::cout << "send " << ret << " bytes" << std::endl;
-    if (ret < 0) {
-        die("send");
+int TCPCommunicator::wait_fd(short events) {
+    // Also used with events = 0, which waits for POLLERR only
+    pollfd pfd;
+    pfd.fd = socket_fd;
+    pfd.events = events;
+    while (true) {
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, -1);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 || (pfd.revents & POLLNVAL)) return -1;
+        // A hung-up peer never makes the socket writable, nor sends
+        // notifications; readers still get the data before the hangup
+        if ((pfd.revents & POLLHUP) && !(events & POLLIN)) return -1;
+        return 0;
     }
-    return ret;
 }
 
-int TCPCommunicator::recv(void* buf, size_t len, size_t offset) {
-    char* p = (char*)buf + offset;
-    ssize_t ret = ::recv(socket_fd, p, len, 0);
-    std::cout << "recv " << ret << " bytes" << std::endl;
-    if (ret < 0) {
-        die("recv");
+int TCPCommunicator::reap_zerocopy(bool block) {
+    int reaped = 0;
+    bool woken = false;
+    while (true) {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(socket_fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            // Notifications raise POLLERR; sleep until one is there. POLLERR
+            // with an empty queue is a socket error, which never clears
+            if (reaped > 0 || !block) return reaped;
+            if (woken || wait_fd(0) < 0) return -1;
+            woken = true;
+            continue;
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) continue;
+            sock_extended_err* ee = (sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            // The kernel had to copy after all (e.g. loopback): stop paying
+            // for the notifications
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zerocopy = false;
+
+            zc_ranges[ee->ee_info] = ee->ee_data;
+            // Looked up by number, the map order breaks where the numbers wrap
+            for (auto it = zc_ranges.find(zc_done); it != zc_ranges.end(); it = zc_ranges.find(zc_done)) {
+                zc_done = it->second + 1;
+                zc_ranges.erase(it);
+            }
+            reaped++;
+        }
+        woken = false;
+    }
+}
+
+int TCPCommunicator::send_all(const struct iovec* iov, int iovcnt, int flags) {
+    std::vector<struct iovec> v(iov, iov + iovcnt);
+    size_t idx = 0;
+    size_t total = 0;
+    while (idx < v.size()) {
+        if (v[idx].iov_len == 0) {
+            idx++;
+            continue;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = &v[idx];
+        msg.msg_iovlen = std::min(v.size() - idx, (size_t)IOV_MAX);
+        ssize_t k = sendmsg(socket_fd, &msg, flags | MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (wait_fd(POLLOUT) < 0) return -1;
+                continue;
+            }
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                // Out of pinned-page budget: free some, else copy the rest
+                if (reap_zerocopy(false) <= 0) flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+            return -1;
+        }
+        if (flags & MSG_ZEROCOPY) zc_next++;
+
+        total += k;
+        size_t left = k;
+        while (left > 0 && left >= v[idx].iov_len) {
+            left -= v[idx].iov_len;
+            idx++;
+        }
+        if (left > 0) {
+            v[idx].iov_base = (char*)v[idx].iov_base + left;
+            v[idx].iov_len -= left;
+        }
+    }
+    return (int)total;
+}
+
+int TCPCommunicator::recv_all(const struct iovec* iov, int iovcnt) {
+    std::vector<struct iovec> v(iov, iov + iovcnt);
+    size_t idx = 0;
+    size_t total = 0;
+    while (idx < v.size()) {
+        if (v[idx].iov_len == 0) {
+            idx++;
+            continue;
+        }
+
+        ssize_t k = ::readv(socket_fd, &v[idx], (int)std::min(v.size() - idx, (size_t)IOV_MAX));
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (wait_fd(POLLIN) < 0) return -1;
+                continue;
+            }
+            return -1;
+        }
+        // Peer closed before the whole message arrived
+        if (k == 0) return -1;
+
+        total += k;
+        size_t left = k;
+        while (left > 0 && left >= v[idx].iov_len) {
+            left -= v[idx].iov_len;
+            idx++;
+        }
+        if (left > 0) {
+            v[idx].iov_base = (char*)v[idx].iov_base + left;
+            v[idx].iov_len -= left;
+        }
     }
+    return (int)total;
+}
+
+int64_t TCPCommunicator::post_send(const void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    bool zc = zerocopy && len >= config.zerocopy_threshold;
+    if (send_all(&iov, 1, zc ? MSG_ZEROCOPY : 0) < 0) return -1;
+    // Copied sends are complete once queued
+    return zc ? (ZC_HANDLE | zc_next) : 0;
+}
+
+int TCPCommunicator::wait(int64_t req) {
+    if (req < 0) return -1;
+    if (req == 0) return 0;
+    // Every call before number `target` must be done
+    uint32_t target = (uint32_t)req;
+    while ((int32_t)(zc_done - target) < 0) {
+        if (reap_zerocopy(true) < 0) return -1;
+    }
+    return 0;
+}
+
+int TCPCommunicator::send(const void* buf, size_t len, size_t offset) {
+    int64_t req = post_send(buf, len, offset);
+    if (req < 0 || wait(req) < 0) return -1;
+    return (int)len;
+}
+
+int TCPCommunicator::recv(void* buf, size_t len, size_t offset) {
+    struct iovec iov;
+    iov.iov_base = (char*)buf + offset;
+    iov.iov_len = len;
+    return recv_all(&iov, 1);
+}
+
+int TCPCommunicator::sendv(const struct iovec* iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    bool zc = zerocopy && total >= config.zerocopy_threshold;
+    int ret = send_all(iov, iovcnt, zc ? MSG_ZEROCOPY : 0);
+    if (ret < 0 || (zc && wait(ZC_HANDLE | zc_next) < 0)) return -1;
     return ret;
 }
 
+int TCPCommunicator::recvv(const struct iovec* iov, int iovcnt) {
+    return recv_all(iov, iovcnt);
+}
+
 int TCPCommunicator::get_fd() {
     return socket_fd;
-}
\ No newline at end of file
+}
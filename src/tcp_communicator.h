@@ -6,34 +6,82 @@
 #include <netinet/in.h>
 #include <unistd.h>
 #include <cstdint>
+#include <map>
+
+// Socket settings applied when the communicator is created
+struct TCPConfig {
+    bool nodelay;               // disable Nagle, small messages go out at once
+    int sndbuf;                 // SO_SNDBUF in bytes, 0 keeps the system default
+    int rcvbuf;                 // SO_RCVBUF in bytes, 0 keeps the system default
+    size_t zerocopy_threshold;  // sends from this size use MSG_ZEROCOPY, 0 disables
+
+    TCPConfig() : nodelay(true), sndbuf(0), rcvbuf(0), zerocopy_threshold(0) {}
+};
 
 class TCPCommunicator : public Communicator {
 private:
     int socket_fd;
-    
+    TCPConfig config;
+    bool zerocopy;      // SO_ZEROCOPY accepted by the socket
+
+    // MSG_ZEROCOPY sends are numbered by the kernel in call order; the error
+    // queue reports completed ranges, kept here until they join up. The
+    // numbers wrap at 2^32, so they are compared as serial numbers.
+    uint32_t zc_next;           // number of the next zerocopy sendmsg call
+    uint32_t zc_done;           // every call before this one has completed
+    std::map<uint32_t, uint32_t> zc_ranges;  // completed [lo, hi] beyond zc_done
+
+    // Zerocopy handles carry this bit so they are never 0, the handle of a copied send
+    static const int64_t ZC_HANDLE = (int64_t)1 << 32;
+
     // Helper functions for socket operations
-    static void readn(int fd, void* p, size_t n);
-    static void writen(int fd, const void* p, size_t n);
-    
+    int send_all(const struct iovec* iov, int iovcnt, int flags);
+    int recv_all(const struct iovec* iov, int iovcnt);
+    int wait_fd(short events);
+    int reap_zerocopy(bool block);
+
 public:
-    TCPCommunicator(int fd) : socket_fd(fd) {}
-    
-    // Implement send/recv operations
+    TCPCommunicator(int fd, const TCPConfig& config = TCPConfig());
+
+    // Send/recv transfer exactly len bytes; they return len or -1 on error
+    // or when the peer closes the connection first
     int send(const void* buf, size_t len, size_t offset = 0) override;
     int recv(void* buf, size_t len, size_t offset = 0) override;
-    
+
+    // Non-blocking send: zerocopy sends return before the kernel is done
+    // with the buffer, which must stay untouched until wait() returns.
+    // Returns a request handle, or -1 on failure.
+    int64_t post_send(const void* buf, size_t len, size_t offset = 0);
+    // Wait for a request from post_send; returns 0, or -1 on error
+    int wait(int64_t req);
+
     // RDMA operations are not supported in TCP
-    int write(const void* /*local_buf*/, size_t /*len*/, uint64_t /*remote_addr*/, uint32_t /*rkey*/, size_t offset = 0) override {
+    int write(const void* /*local_buf*/, size_t /*len*/, uint64_t /*remote_addr*/, uint32_t /*rkey*/, size_t /*offset*/ = 0) override {
         // Not supported
         return -1;
     }
-    
-    int read(void* /*local_buf*/, size_t /*len*/, uint64_t /*remote_addr*/, uint32_t /*rkey*/, size_t offset = 0) override {
+
+    int read(void* /*local_buf*/, size_t /*len*/, uint64_t /*remote_addr*/, uint32_t /*rkey*/, size_t /*offset*/ = 0) override {
+        // Not supported
+        return -1;
+    }
+
+    // Vectored send/recv gather/scatter every segment with sendmsg/readv
+    int sendv(const struct iovec* iov, int iovcnt) override;
+    int recvv(const struct iovec* iov, int iovcnt) override;
+
+    int writev(const struct iovec* /*iov*/, int /*iovcnt*/, uint64_t /*remote_addr*/, uint32_t /*rkey*/) override {
+        // Not supported
+        return -1;
+    }
+
+    int readv(const struct iovec* /*iov*/, int /*iovcnt*/, uint64_t /*remote_addr*/, uint32_t /*rkey*/) override {
         // Not supported
         return -1;
     }
 
+    bool zerocopy_enabled() { return zerocopy; }
     int get_fd();
 };
 
-#endif // TCP_COMMUNICATOR_H
\ No newline at end of file
+#endif // TCP_COMMUNICATOR_H